@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Locality-improving orders of the nodes of a graph, used to renumber the elements of an index so that the records a
+// search reads after one another lie close together in memory. The graph is given in CSR layout: the neighbors of
+// node v are targets[offsets[v]] to targets[offsets[v + 1] - 1]. Both orders return the nodes in their new order.
+//
+/////////////////////////////////////////////////////////
+
+enum class GraphOrder {
+    BFS,     // breadth-first search, which places the unvisited neighbors of a node next to each other
+    Gorder   // greedy placement of the node sharing the most edges and in-neighbors with the last placed nodes
+};
+
+// Breadth-first search from start, restarting at the first unvisited node whenever the graph is not connected
+template<typename T>
+std::vector<T> bfsOrder(const std::vector<size_t> &offsets, const std::vector<T> &targets, T start) {
+    size_t count = offsets.size() - 1;
+    std::vector<T> order;
+    order.reserve(count);
+    std::vector<bool> visited(count, false);
+
+    size_t head = 0;
+    for (size_t next = 0; next <= count; next++) {
+        T seed = next == 0 ? start : (T) (next - 1);
+        if (seed >= count || visited[seed])
+            continue;
+        visited[seed] = true;
+        order.push_back(seed);
+
+        for (; head < order.size(); head++) {
+            T node = order[head];
+            for (size_t j = offsets[node]; j < offsets[node + 1]; j++) {
+                if (!visited[targets[j]]) {
+                    visited[targets[j]] = true;
+                    order.push_back(targets[j]);
+                }
+            }
+        }
+    }
+    return order;
+}
+
+// The greedy of Gorder (Wei et al., Speedup Graph Processing by Graph Ordering, 2016): each step places the node with
+// the highest score against the last window placed nodes, where a node scores one for every edge between them, in
+// either direction, and one for every in-neighbor they share. The scores are kept in a unit heap, a list of the nodes
+// of each score, as they only change by one.
+template<typename T>
+std::vector<T> gorderOrder(const std::vector<size_t> &offsets, const std::vector<T> &targets, T start, size_t window = 5) {
+    size_t count = offsets.size() - 1;
+    const T none = (T) -1;
+
+    // In-neighbors in CSR layout
+    std::vector<size_t> in_offsets(count + 1, 0);
+    for (T target : targets)
+        in_offsets[target + 1]++;
+    for (size_t v = 0; v < count; v++)
+        in_offsets[v + 1] += in_offsets[v];
+    std::vector<T> sources(targets.size());
+    std::vector<size_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (size_t v = 0; v < count; v++) {
+        for (size_t j = offsets[v]; j < offsets[v + 1]; j++)
+            sources[fill[targets[j]]++] = (T) v;
+    }
+    std::vector<size_t>().swap(fill);
+
+    // Unit heap: the unplaced nodes of each score in a doubly linked list
+    std::vector<size_t> score(count, 0);
+    std::vector<T> prev(count), next(count);
+    std::vector<T> heads(1, none);
+    std::vector<bool> placed(count, false);
+    size_t top = 0;
+
+    auto unlink = [&](T v) {
+        if (prev[v] != none)
+            next[prev[v]] = next[v];
+        else
+            heads[score[v]] = next[v];
+        if (next[v] != none)
+            prev[next[v]] = prev[v];
+    };
+    auto link = [&](T v) {
+        if (heads.size() <= score[v])
+            heads.resize(score[v] + 1, none);
+        prev[v] = none;
+        next[v] = heads[score[v]];
+        if (next[v] != none)
+            prev[next[v]] = v;
+        heads[score[v]] = v;
+    };
+    auto update = [&](T v, bool increase) {
+        if (placed[v])
+            return;
+        unlink(v);
+        if (increase) {
+            score[v]++;
+            top = std::max(top, score[v]);
+        } else {
+            score[v]--;
+        }
+        link(v);
+    };
+
+    // Adds or removes the scores a placed node gives to the other nodes while it is in the window
+    auto scoreAgainst = [&](T v, bool increase) {
+        for (size_t j = offsets[v]; j < offsets[v + 1]; j++)
+            update(targets[j], increase);
+        for (size_t i = in_offsets[v]; i < in_offsets[v + 1]; i++) {
+            T u = sources[i];
+            update(u, increase);
+            for (size_t j = offsets[u]; j < offsets[u + 1]; j++) {
+                if (targets[j] != v)
+                    update(targets[j], increase);
+            }
+        }
+    };
+
+    for (size_t v = count; v-- > 0;)
+        link((T) v);
+
+    std::vector<T> order;
+    order.reserve(count);
+    T v = start < count ? start : 0;
+    while (true) {
+        unlink(v);
+        placed[v] = true;
+        order.push_back(v);
+        scoreAgainst(v, true);
+        if (order.size() > window)
+            scoreAgainst(order[order.size() - window - 1], false);
+        if (order.size() == count)
+            break;
+
+        while (heads[top] == none)
+            top--;
+        v = heads[top];
+    }
+    return order;
+}
+
+}  // namespace hnswlib
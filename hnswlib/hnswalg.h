@@ -2,12 +2,24 @@
 
 #include "visited_list_pool.h"
 #include "tag_index.h"
+#include "tag_filter.h"
+#include "query_planner.h"
+#include "parallel.h"
+#include "vector_file.h"
+#include "index_file.h"
+#include "label_map.h"
+#include "memory_policy.h"
+#include "link_list_arena.h"
+#include "graph_order.h"
 #include <atomic>
+#include <functional>
+#include <shared_mutex>
 #include <random>
 #include <cstdlib>
 #include <cassert>
 #include <unordered_set>
 #include <list>
+#include <map>
 #include <memory>
 #include <random>
 
@@ -19,6 +31,8 @@ template<typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
+    static const size_t MAX_TAG_OPERATION_LOCKS = 1024;
+    static constexpr size_t BATCH_GROUP_SIZE = 16;  // Queries whose base layer searches are interleaved in searchKnnBatch
     static const unsigned char DELETE_MARK = 0x01;
 
     size_t max_elements_{0};
@@ -46,20 +60,53 @@ public:
     tableint enterpoint_node_{0};
     std::unordered_map<std::string, std::pair<unsigned, tableint>> enterpoints;
 
+    // Diverse entry points of a tag on one level, all elements with the tag on that level or higher
+    struct TagSeeds {
+        std::vector<tableint> ids;
+        std::vector<dist_t> spread;  // Distance from each seed to its nearest other seed
+    };
+    std::unordered_map<std::string, std::vector<TagSeeds>> tag_seeds_;  // Seeds of each tag, indexed by level
+    size_t max_tag_seeds_{4};
+
     size_t size_links_level0_{0};
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
+    size_t inline_tag_slots_{0};  // Tag IDs stored in the level-0 record, 0 disables inline tags
+    size_t offsetTags_{0};
+    size_t tag_link_lists_{0};  // Extra level-0 link lists for an element's most frequent tags, 0 disables them
+    size_t tag_link_size_{0};   // Neighbors per tag link list
+    size_t size_tag_link_list_{0};
+    size_t offsetTagLinks_{0};
 
     char *data_level0_memory_{nullptr};
+    size_t level0_size_{0};  // bytes allocated for data_level0_memory_, unless the index is mapped
+    MemoryPolicy memory_policy_;  // allocation of the level-0 block and the link list slabs
     char **linkLists_{nullptr};
+    LinkListArena link_list_arena_;  // holds the blocks linkLists_ points to, unless the index is mapped
     std::vector<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    BATCHDISTFUNC<dist_t> fstbatchdistfunc_{nullptr};
     void *dist_func_param_{nullptr};
 
-    mutable std::mutex label_lookup_lock;  // lock for label_lookup_
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    // Spaces storing compressed codes encode the added and searched vectors, and the full precision vectors can be
+    // kept in a memory-mapped file to re-rank the search results with exact distances
+    SpaceInterface<dist_t> *quantized_space_{nullptr};
+    size_t input_size_{0};  // Size of an added vector, larger than data_size_ when the space stores codes
+    DISTFUNC<dist_t> exact_distfunc_{nullptr};
+    void *exact_dist_func_param_{nullptr};
+    std::unique_ptr<VectorFile> exact_vectors_{nullptr};  // Full precision vectors by internal ID
+
+    // An index loaded by mapIndex() reads its level-0 block and upper-level link lists from the mapped file
+    std::shared_ptr<MappedFile> mapped_file_{nullptr};
+
+    // Spaces searching with a lookup table per query encode queries apart from the stored vectors, and searches take
+    // the distances from a query with querydistfunc_, which is fstdistfunc_ for the other spaces
+    size_t query_size_{0};  // Size of an encoded query, 0 when queries are encoded like the stored vectors
+    DISTFUNC<dist_t> querydistfunc_{nullptr};
+
+    LabelMap<tableint> label_lookup_;  // labels below max_elements_ are looked up in an array, others in a hash table
 
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
@@ -72,7 +119,12 @@ public:
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    // tag_lock_ is only held exclusively to add a tag to enterpoints and tag_seeds_, entries are updated under the tag operation locks
+    mutable std::shared_mutex tag_lock_;
+    mutable std::vector<std::mutex> tag_op_locks_;
+    std::mutex level_generator_lock_;
     TagIndex<tableint> tag_index;
+    QueryPlanner query_planner_;
     bool adaptive;
     std::mt19937 gen;
     std::uniform_int_distribution<> distr;
@@ -103,18 +155,24 @@ public:
         size_t ef_construction = 200,
         size_t random_seed = 100,
         bool allow_replace_deleted = false,
-        bool adaptive = false)
+        bool adaptive = false,
+        size_t inline_tag_slots = 0,
+        size_t tag_link_lists = 0,
+        size_t tag_link_size = 0)
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
             link_list_locks_(max_elements),
             element_levels_(max_elements),
             allow_replace_deleted_(allow_replace_deleted),
+            tag_op_locks_(MAX_TAG_OPERATION_LOCKS),
             tag_index(max_elements),
             adaptive(adaptive) {
         max_elements_ = max_elements;
         num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstbatchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
+        setExactSpace(s);
         if ( M <= 10000 ) {
             M_ = M;
         } else {
@@ -130,17 +188,31 @@ public:
         level_generator_.seed(random_seed);
         update_probability_generator_.seed(random_seed + 1);
 
+        // The inline tags are a count followed by the tag ID slots, placed right before the data so that they share its cache lines
+        inline_tag_slots_ = inline_tag_slots;
+        size_t size_tags_level0 = inline_tag_slots_ ? (inline_tag_slots_ + 1) * sizeof(tag_type) : 0;
+
+        // Each tag link list is the tag ID followed by a link list of neighbors with that tag, right after the level-0 links
+        tag_link_lists_ = tag_link_lists;
+        tag_link_size_ = tag_link_lists_ ? (tag_link_size ? tag_link_size : M_) : 0;
+        size_tag_link_list_ = sizeof(tag_type) + sizeof(linklistsizeint) + tag_link_size_ * sizeof(tableint);
+        size_t size_tag_links_level0 = tag_link_lists_ * size_tag_link_list_;
+
         size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        size_data_per_element_ = size_links_level0_ + data_size_ + sizeof(labeltype);
-        offsetData_ = size_links_level0_;
-        label_offset_ = size_links_level0_ + data_size_;
+        size_data_per_element_ = size_links_level0_ + size_tag_links_level0 + size_tags_level0 + data_size_ + sizeof(labeltype);
+        offsetTagLinks_ = size_links_level0_;
+        offsetTags_ = size_links_level0_ + size_tag_links_level0;
+        offsetData_ = offsetTags_ + size_tags_level0;
+        label_offset_ = offsetData_ + data_size_;
         offsetLevel0_ = 0;
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
+        data_level0_memory_ = (char *) allocateMemory(max_elements_ * size_data_per_element_, memory_policy_);
         if (data_level0_memory_ == nullptr)
             throw std::runtime_error("Not enough memory");
+        level0_size_ = max_elements_ * size_data_per_element_;
 
         cur_element_count = 0;
+        label_lookup_.resize(max_elements_);
 
         visited_list_pool_ = std::unique_ptr<VisitedListPool>(new VisitedListPool(1, max_elements));
 
@@ -152,6 +224,7 @@ public:
         if (linkLists_ == nullptr)
             throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        link_list_arena_.reset(size_links_per_element_);
         mult_ = 1 / log(1.0 * M_);
         revSize_ = 1.0 / mult_;
     }
@@ -161,17 +234,29 @@ public:
     }
 
     void clear() {
-        free(data_level0_memory_);
+        if (!mapped_file_)
+            freeMemory(data_level0_memory_, level0_size_, memory_policy_);
         data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
+        level0_size_ = 0;
         free(linkLists_);
         linkLists_ = nullptr;
+        link_list_arena_.clear();
         cur_element_count = 0;
         visited_list_pool_.reset(nullptr);
+        enterpoints.clear();
+        tag_seeds_.clear();
         tag_index.clear();
+        label_lookup_.clear();
+        mapped_file_.reset();
+    }
+
+    bool isReadOnly() const {
+        return mapped_file_ != nullptr;
+    }
+
+    void checkWritable() const {
+        if (mapped_file_)
+            throw std::runtime_error("The index is loaded read-only");
     }
 
     struct CompareByFirst {
@@ -185,12 +270,65 @@ public:
         ef_ = ef;
     }
 
+    void setExactSpace(SpaceInterface<dist_t> *s) {
+        SpaceInterface<dist_t> *exact_space = s->get_exact_space();
+        quantized_space_ = exact_space ? s : nullptr;
+        input_size_ = exact_space ? exact_space->get_data_size() : data_size_;
+        exact_distfunc_ = exact_space ? exact_space->get_dist_func() : nullptr;
+        exact_dist_func_param_ = exact_space ? exact_space->get_dist_func_param() : nullptr;
+        query_size_ = exact_space ? s->get_query_size() : 0;
+        querydistfunc_ = query_size_ ? s->get_query_dist_func() : fstdistfunc_;
+        exact_vectors_.reset();
+    }
+
+    /*
+    * Keeps the full precision vectors of a space storing codes in the given file, and re-ranks the results of searchKnn
+    * and searchKnnBatch with exact distances. Either set it before adding elements, or after loading the index with the
+    * file written while its elements were added.
+    */
+    void setExactVectorFile(const std::string& location) {
+        if (!quantized_space_)
+            throw std::runtime_error("Exact vectors are only kept for spaces storing compressed codes");
+        std::unique_ptr<VectorFile> exact_vectors(new VectorFile(location, input_size_, max_elements_));
+        if (exact_vectors->fileRecords() < cur_element_count)
+            throw std::runtime_error("The exact vector file holds fewer vectors than the index");
+        exact_vectors_ = std::move(exact_vectors);
+    }
+
+    // The stored form of a vector, which is the vector itself unless the space stores codes
+    inline const void *encodeVector(const void *vector, std::vector<char>& code) const {
+        if (!quantized_space_)
+            return vector;
+        code.resize(data_size_);
+        quantized_space_->encode(vector, code.data());
+        return code.data();
+    }
+
+    // The searched form of a query, which is its lookup table for spaces searching with one and its stored form otherwise
+    inline const void *encodeQuery(const void *vector, std::vector<char>& code) const {
+        if (!query_size_)
+            return encodeVector(vector, code);
+        code.resize(query_size_);
+        quantized_space_->encode_query(vector, code.data());
+        return code.data();
+    }
+
+    // Number of entry points kept per tag and level, applies to later insertions
+    void setMaxTagSeeds(size_t max_tag_seeds) {
+        max_tag_seeds_ = max_tag_seeds;
+    }
+
     inline std::mutex& getLabelOpMutex(labeltype label) const {
         // calculate hash
         size_t lock_id = label & (MAX_LABEL_OPERATION_LOCKS - 1);
         return label_op_locks_[lock_id];
     }
 
+    inline std::mutex& getTagOpMutex(const std::string& tag) const {
+        size_t lock_id = std::hash<std::string>()(tag) & (MAX_TAG_OPERATION_LOCKS - 1);
+        return tag_op_locks_[lock_id];
+    }
+
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
         memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
@@ -209,6 +347,72 @@ public:
         return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
     }
 
+
+    inline tag_type *getInlineTags(tableint internal_id) const {
+        return (tag_type *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetTags_);
+    }
+
+    // The tag of the i-th tag link list of an element, 0 if the list is unused, followed by the list itself
+    inline tag_type *getTagLinkList(tableint internal_id, size_t i) const {
+        return (tag_type *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetTagLinks_ + i * size_tag_link_list_);
+    }
+
+    // Copies the tag IDs of an element into its level-0 record
+    // The count is kept even when the tags overflow the slots, which sends filter checks of that element to the posting bitmaps
+    void setInlineTags(tableint internal_id) {
+        if (!inline_tag_slots_) return;
+
+        std::vector<tag_type> tag_ids = tag_index.tagIds(internal_id);
+        tag_type *inline_tags = getInlineTags(internal_id);
+        inline_tags[0] = static_cast<tag_type>(tag_ids.size());
+        if (tag_ids.size() <= inline_tag_slots_) {
+            std::copy(tag_ids.begin(), tag_ids.end(), inline_tags + 1);
+        }
+    }
+
+    // Tag filter of a search: the compiled filter expression, and the posting bitmaps of its tests for elements without inline tags
+    struct TagFilter {
+        TagFilterProgram program;
+        std::vector<QueryBitmap<tableint>> bitmaps;  // Union of the posting lists of every Any instruction, indexed by instruction
+        std::vector<tag_type> link_tags;              // Driving tags of the filter, whose tag link lists a search follows
+
+        bool matches(tableint internal_id) const {
+            return program.evaluate([this, internal_id](size_t index, const tag_type*, const tag_type*) {
+                return bitmaps[index].contains(internal_id);
+            });
+        }
+    };
+
+    TagFilter compileTagFilter(const TagExpression& expression) const {
+        TagFilter filter;
+        filter.program = TagFilterProgram::compile(expression, cur_element_count,
+            [this](const std::string& tag) { return tag_index.resolveTag(tag); },
+            [this](tag_type tag_id) { return tag_index.frequency(tag_id, 0); });
+        filter.bitmaps.resize(filter.program.size());
+        for (size_t i = 0; i < filter.program.size(); i++) {
+            if (filter.program.instruction(i).operation == TagFilterProgram::Operation::Any)
+                filter.bitmaps[i] = tag_index.postingUnion(filter.program.tags(i));
+        }
+        if (tag_link_lists_ && !filter.program.drivingTags(filter.link_tags))
+            filter.link_tags.clear();
+        return filter;
+    }
+
+    inline bool passesTagFilter(tableint internal_id, const TagFilter* tag_filter) const {
+        if (!tag_filter) return true;
+
+        if (inline_tag_slots_) {
+            const tag_type *inline_tags = getInlineTags(internal_id);
+            size_t size = inline_tags[0];
+
+            if (size <= inline_tag_slots_) {
+                return tag_filter->program.matches(inline_tags + 1, inline_tags + 1 + size);
+            }
+        }
+
+        return tag_filter->matches(internal_id);
+    }
+
     double tagFrequencyScore(const std::vector<std::string>& tags, const int& level)
     {
         double frequencySum = 0.0, maxFrequency = tag_index.maxLevelFrequency(level);
@@ -223,30 +427,41 @@ public:
 
     int getRandomLevel(double reverse_size) {
         std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        std::unique_lock <std::mutex> lock(level_generator_lock_);
         double r = -log(distribution(level_generator_)) * reverse_size;
         return (int) r;
     }
 
     int tagBasedLevel(const std::vector<std::string>& tags)
     {
+        int maxlevel;
+        {
+            std::unique_lock <std::mutex> lock(global);
+            maxlevel = maxlevel_;
+        }
+
         if (tags.empty() || tag_index.size() == 0)
         {
-            return std::max(getRandomLevel(mult_), maxlevel_);
+            return std::max(getRandomLevel(mult_), maxlevel);
         }
 
         for (const std::string& tag : tags) // This loop ensures that every newly introduced tag will be in the highest layer
         {
             if (!tag_index.exists(tag))
             {
-                return std::max(getRandomLevel(mult_), maxlevel_);
+                return std::max(getRandomLevel(mult_), maxlevel);
             }
         }
 
-        int level = maxlevel_;
+        int level = maxlevel;
 
         for (; level > 0; level--)
         {
-            double random = static_cast<double>(distr(gen)) / distr.max();
+            double random;
+            {
+                std::unique_lock <std::mutex> lock(level_generator_lock_);
+                random = static_cast<double>(distr(gen)) / distr.max();
+            }
             double score = tagFrequencyScore(tags, level);
 
             if (random >= score)
@@ -270,8 +485,9 @@ public:
         return num_deleted_;
     }
 
+    // With a tag filter, only elements passing it are returned, and the tag link lists of the filter's tags are followed
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
-    searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
+    searchBaseLayer(tableint ep_id, const void *data_point, int layer, const TagFilter* tag_filter = nullptr) {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
@@ -280,7 +496,7 @@ public:
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
 
         dist_t lowerBound;
-        if (!isMarkedDeleted(ep_id)) {
+        if (!isMarkedDeleted(ep_id) && passesTagFilter(ep_id, tag_filter)) {
             dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
             top_candidates.emplace(dist, ep_id);
             lowerBound = dist;
@@ -291,6 +507,39 @@ public:
         }
         visited_array[ep_id] = visited_array_tag;
 
+        auto consider = [&](tableint candidate_id, dist_t dist1) {
+            if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
+                candidateSet.emplace(-dist1, candidate_id);
+#ifdef USE_SSE
+                _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
+#endif
+
+                if (!isMarkedDeleted(candidate_id) && passesTagFilter(candidate_id, tag_filter))
+                    top_candidates.emplace(dist1, candidate_id);
+
+                if (top_candidates.size() > ef_construction_)
+                    top_candidates.pop();
+
+                if (!top_candidates.empty())
+                    lowerBound = top_candidates.top().first;
+            }
+        };
+
+        // The unvisited neighbors are gathered under the lock of the expanded node and their distances computed
+        // after releasing it, by one kernel call
+        size_t max_links = maxM0_ + tag_link_size_ * tag_link_lists_;
+        std::vector<tableint> pending(max_links);
+        std::vector<const void *> pending_data(max_links);
+        std::vector<dist_t> distances(max_links);
+        size_t pending_count = 0;
+
+        auto gather = [&](tableint candidate_id) {
+            if (visited_array[candidate_id] == visited_array_tag) return;
+            visited_array[candidate_id] = visited_array_tag;
+            pending[pending_count] = candidate_id;
+            pending_data[pending_count++] = getDataByInternalId(candidate_id);
+        };
+
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
             if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef_construction_) {
@@ -300,52 +549,54 @@ public:
 
             tableint curNodeNum = curr_el_pair.second;
 
-            std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
-
-            int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
-            if (layer == 0) {
-                data = (int*)get_linklist0(curNodeNum);
-            } else {
-                data = (int*)get_linklist(curNodeNum, layer);
-//                    data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
-            }
-            size_t size = getListCount((linklistsizeint*)data);
-            tableint *datal = (tableint *) (data + 1);
-#ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
-#endif
+            {
+                std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
 
-            for (size_t j = 0; j < size; j++) {
-                tableint candidate_id = *(datal + j);
-//                    if (candidate_id == 0) continue;
+                int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
+                if (layer == 0) {
+                    data = (int*)get_linklist0(curNodeNum);
+                } else {
+                    data = (int*)get_linklist(curNodeNum, layer);
+//                        data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
+                }
+                size_t size = getListCount((linklistsizeint*)data);
+                tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
+                _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
 #endif
-                if (visited_array[candidate_id] == visited_array_tag) continue;
-                visited_array[candidate_id] = visited_array_tag;
-                char *currObj1 = (getDataByInternalId(candidate_id));
 
-                dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
-                if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
-                    candidateSet.emplace(-dist1, candidate_id);
+                for (size_t j = 0; j < size; j++) {
+                    tableint candidate_id = *(datal + j);
+//                        if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
+                    _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
+                    _mm_prefetch(getDataByInternalId(*(datal + j)), _MM_HINT_T0);
 #endif
+                    gather(candidate_id);
+                }
 
-                    if (!isMarkedDeleted(candidate_id))
-                        top_candidates.emplace(dist1, candidate_id);
-
-                    if (top_candidates.size() > ef_construction_)
-                        top_candidates.pop();
-
-                    if (!top_candidates.empty())
-                        lowerBound = top_candidates.top().first;
+                if (layer == 0 && tag_link_lists_ && tag_filter && !tag_filter->link_tags.empty()) {
+                    for (size_t i = 0; i < tag_link_lists_; i++) {
+                        tag_type *tag_links = getTagLinkList(curNodeNum, i);
+                        if (!*tag_links)
+                            break;
+                        if (std::find(tag_filter->link_tags.begin(), tag_filter->link_tags.end(), *tag_links) == tag_filter->link_tags.end())
+                            continue;
+
+                        linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+                        size_t links_size = getListCount(links);
+                        for (size_t l = 1; l <= links_size; l++) {
+                            gather(links[l]);
+                        }
+                    }
                 }
             }
+
+            batchDistances(data_point, pending_data.data(), pending_count, distances.data());
+            for (size_t j = 0; j < pending_count; j++)
+                consider(pending[j], distances[j]);
+            pending_count = 0;
         }
         visited_list_pool_->releaseVisitedList(vl);
 
@@ -359,7 +610,21 @@ public:
         tableint ep_id,
         const void *data_point,
         size_t ef,
-        const std::vector<std::string>& tags,
+        const TagFilter* tag_filter,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
+        return searchBaseLayerST<bare_bone_search, collect_metrics>(
+            std::vector<tableint>(1, ep_id), data_point, ef, tag_filter, isIdAllowed, stop_condition);
+    }
+
+    // Starts from several entry points at once, which all go into the candidate set
+    template <bool bare_bone_search = true, bool collect_metrics = false>
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchBaseLayerST(
+        const std::vector<tableint>& ep_ids,
+        const void *data_point,
+        size_t ef,
+        const TagFilter* tag_filter,
         BaseFilterFunctor* isIdAllowed = nullptr,
         BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
@@ -369,23 +634,104 @@ public:
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
 
-        dist_t lowerBound;
-        if (bare_bone_search || 
-            (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
+        dist_t lowerBound = std::numeric_limits<dist_t>::max();
+        for (tableint ep_id : ep_ids) {
+            if (visited_array[ep_id] == visited_array_tag)
+                continue;
+            visited_array[ep_id] = visited_array_tag;
+
             char* ep_data = getDataByInternalId(ep_id);
-            dist_t dist = fstdistfunc_(data_point, ep_data, dist_func_param_);
-            lowerBound = dist;
-            top_candidates.emplace(dist, ep_id);    // We always know that ep_id satisfies query tags
-            if (!bare_bone_search && stop_condition) {
-                stop_condition->add_point_to_result(getExternalLabel(ep_id), ep_data, dist);
+            dist_t dist = querydistfunc_(data_point, ep_data, dist_func_param_);
+            if ((bare_bone_search ||
+                (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) &&
+                passesTagFilter(ep_id, tag_filter)) {
+                top_candidates.emplace(dist, ep_id);
+                if (!bare_bone_search && stop_condition) {
+                    stop_condition->add_point_to_result(getExternalLabel(ep_id), ep_data, dist);
+                }
             }
             candidate_set.emplace(-dist, ep_id);
-        } else {
-            lowerBound = std::numeric_limits<dist_t>::max();
-            candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        if (bare_bone_search || !stop_condition) {
+            while (top_candidates.size() > ef)
+                top_candidates.pop();
+        }
+        if (!top_candidates.empty())
+            lowerBound = top_candidates.top().first;
+
+        // Enters a neighbor at the given distance into the candidates and results
+        auto consider = [&](tableint candidate_id, const char *currObj1, dist_t dist) {
+            bool flag_consider_candidate;
+            if (!bare_bone_search && stop_condition) {
+                flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+            } else {
+                flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+            }
+
+            if (flag_consider_candidate) {
+                candidate_set.emplace(-dist, candidate_id);
+#ifdef USE_SSE
+                _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
+                                offsetLevel0_,  ///////////
+                                _MM_HINT_T0);  ////////////////////////
+#endif
+
+                if ((bare_bone_search || 
+                    (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) &&
+                    passesTagFilter(candidate_id, tag_filter)) {
+                    top_candidates.emplace(dist, candidate_id);
+                    if (!bare_bone_search && stop_condition) {
+                        stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
+                    }
+                }
+
+                bool flag_remove_extra = false;
+                if (!bare_bone_search && stop_condition) {
+                    flag_remove_extra = stop_condition->should_remove_extra();
+                } else {
+                    flag_remove_extra = top_candidates.size() > ef;
+                }
+                while (flag_remove_extra) {
+                    tableint id = top_candidates.top().second;
+                    top_candidates.pop();
+                    if (!bare_bone_search && stop_condition) {
+                        stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
+                        flag_remove_extra = stop_condition->should_remove_extra();
+                    } else {
+                        flag_remove_extra = top_candidates.size() > ef;
+                    }
+                }
+
+                if (!top_candidates.empty())
+                    lowerBound = top_candidates.top().first;
+            }
+        };
+
+        // The unvisited neighbors of a link list are gathered first, so that their distances take one kernel call
+        size_t max_links = std::max(maxM0_, tag_link_size_);
+        std::vector<tableint> pending(max_links);
+        std::vector<const void *> pending_data(max_links);
+        std::vector<dist_t> distances(max_links);
+        size_t pending_count = 0;
+
+        auto gather = [&](tableint candidate_id) {
+            if (!(visited_array[candidate_id] == visited_array_tag)) {
+                visited_array[candidate_id] = visited_array_tag;
+#ifdef USE_SSE
+                _mm_prefetch(data_level0_memory_ + candidate_id * size_data_per_element_ + offsetTags_, _MM_HINT_T0);
+#endif
+                pending[pending_count] = candidate_id;
+                pending_data[pending_count++] = getDataByInternalId(candidate_id);
+            }
+        };
+
+        auto visitPending = [&]() {
+            queryDistances(data_point, pending_data.data(), pending_count, distances.data());
+            for (size_t j = 0; j < pending_count; j++)
+                consider(pending[j], (const char *) pending_data[j], distances[j]);
+            pending_count = 0;
+        };
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -418,7 +764,6 @@ public:
 #ifdef USE_SSE
             _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
@@ -427,69 +772,147 @@ public:
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
                 _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
+                gather(candidate_id);
+            }
+            visitPending();
 
-                    char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+            // Follows the element's neighbors sharing a driving tag of the filter, which likely pass it as well
+            if (tag_link_lists_ && tag_filter && !tag_filter->link_tags.empty()) {
+                for (size_t i = 0; i < tag_link_lists_; i++) {
+                    tag_type *tag_links = getTagLinkList(current_node_id, i);
+                    if (!*tag_links)
+                        break;
+                    if (std::find(tag_filter->link_tags.begin(), tag_filter->link_tags.end(), *tag_links) == tag_filter->link_tags.end())
+                        continue;
 
-                    bool flag_consider_candidate;
-                    if (!bare_bone_search && stop_condition) {
-                        flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
-                    } else {
-                        flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+                    linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+                    size_t links_size = getListCount(links);
+                    if (collect_metrics) {
+                        metric_distance_computations += links_size;
                     }
+                    for (size_t l = 1; l <= links_size; l++) {
+                        gather(links[l]);
+                    }
+                    visitPending();
+                }
+            }
+        }
 
-                    if (flag_consider_candidate) {
-                        candidate_set.emplace(-dist, candidate_id);
-#ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
-#endif
+        visited_list_pool_->releaseVisitedList(vl);
+        return top_candidates;
+    }
 
-                        if (bare_bone_search || 
-                            (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
-                            if (tags.empty()) {
-                                top_candidates.emplace(dist, candidate_id);
-                            } else {
-                                std::vector<std::string> nodeTags = tag_index.get(candidate_id);
-
-                                for (const std::string& tag : nodeTags) {
-                                    if (std::find(tags.begin(), tags.end(), tag) != tags.end()) {
-                                        top_candidates.emplace(dist, candidate_id);
-                                        break;
-                                    }
-                                }
-                            }
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
-                            }
-                        }
+    // Filtered base layer search for selective filters in the style of ACORN: only nodes passing the filter are
+    // enqueued, but the neighbors of a failing neighbor are checked too, so that the search crosses regions without
+    // matches instead of flooding them. At most maxM0_ passing nodes are taken from the one- and two-hop neighborhood
+    // of an expanded node, which bounds its distance computations as in the unfiltered search
+    template <bool bare_bone_search = true, bool collect_metrics = false>
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchBaseLayerTwoHop(
+        const std::vector<tableint>& ep_ids,
+        const void *data_point,
+        size_t ef,
+        const TagFilter* tag_filter,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        vl_type *visited_array = vl->mass;
+        vl_type visited_array_tag = vl->curV;
 
-                        bool flag_remove_extra = false;
-                        if (!bare_bone_search && stop_condition) {
-                            flag_remove_extra = stop_condition->should_remove_extra();
-                        } else {
-                            flag_remove_extra = top_candidates.size() > ef;
-                        }
-                        while (flag_remove_extra) {
-                            tableint id = top_candidates.top().second;
-                            top_candidates.pop();
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
-                                flag_remove_extra = stop_condition->should_remove_extra();
-                            } else {
-                                flag_remove_extra = top_candidates.size() > ef;
-                            }
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
+        std::vector<tableint> passing;
+        passing.reserve(maxM0_);
+
+        // The entry points are expanded even if they fail the filter, as they may be the only way into the graph
+        for (tableint ep_id : ep_ids) {
+            if (visited_array[ep_id] == visited_array_tag)
+                continue;
+            visited_array[ep_id] = visited_array_tag;
+
+            dist_t dist = querydistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+            if ((bare_bone_search ||
+                (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) &&
+                passesTagFilter(ep_id, tag_filter)) {
+                top_candidates.emplace(dist, ep_id);
+            }
+            candidate_set.emplace(-dist, ep_id);
+        }
+
+        while (top_candidates.size() > ef)
+            top_candidates.pop();
+        dist_t lowerBound = top_candidates.empty() ? std::numeric_limits<dist_t>::max() : top_candidates.top().first;
+
+        while (!candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
+            if (-current_node_pair.first > lowerBound && top_candidates.size() == ef) {
+                break;
+            }
+            candidate_set.pop();
+
+            // Collects the unvisited passing nodes among the neighbors, looking through failing neighbors to theirs
+            passing.clear();
+            linklistsizeint *data = get_linklist0(current_node_pair.second);
+            size_t size = getListCount(data);
+            for (size_t j = 1; j <= size && passing.size() < maxM0_; j++) {
+                tableint neighbor_id = data[j];
+                if (visited_array[neighbor_id] == visited_array_tag)
+                    continue;
+                visited_array[neighbor_id] = visited_array_tag;
+
+                if (passesTagFilter(neighbor_id, tag_filter)) {
+                    passing.push_back(neighbor_id);
+                    continue;
+                }
+
+                linklistsizeint *second_data = get_linklist0(neighbor_id);
+                size_t second_size = getListCount(second_data);
+                for (size_t l = 1; l <= second_size && passing.size() < maxM0_; l++) {
+                    tableint second_id = second_data[l];
+                    if (visited_array[second_id] != visited_array_tag && passesTagFilter(second_id, tag_filter)) {
+                        visited_array[second_id] = visited_array_tag;
+                        passing.push_back(second_id);
+                    }
+                }
+            }
+
+            if (tag_link_lists_ && tag_filter && !tag_filter->link_tags.empty()) {
+                for (size_t i = 0; i < tag_link_lists_ && passing.size() < maxM0_; i++) {
+                    tag_type *tag_links = getTagLinkList(current_node_pair.second, i);
+                    if (!*tag_links)
+                        break;
+                    if (std::find(tag_filter->link_tags.begin(), tag_filter->link_tags.end(), *tag_links) == tag_filter->link_tags.end())
+                        continue;
+
+                    linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+                    size_t links_size = getListCount(links);
+                    for (size_t l = 1; l <= links_size && passing.size() < maxM0_; l++) {
+                        tableint link_id = links[l];
+                        if (visited_array[link_id] != visited_array_tag && passesTagFilter(link_id, tag_filter)) {
+                            visited_array[link_id] = visited_array_tag;
+                            passing.push_back(link_id);
                         }
+                    }
+                }
+            }
+
+            if (collect_metrics) {
+                metric_hops++;
+                metric_distance_computations += passing.size();
+            }
 
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
+            for (tableint candidate_id : passing) {
+                dist_t dist = querydistfunc_(data_point, getDataByInternalId(candidate_id), dist_func_param_);
+                if (top_candidates.size() < ef || lowerBound > dist) {
+                    candidate_set.emplace(-dist, candidate_id);
+                    if (bare_bone_search ||
+                        (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
+                        top_candidates.emplace(dist, candidate_id);
                     }
+                    if (top_candidates.size() > ef)
+                        top_candidates.pop();
+                    if (!top_candidates.empty())
+                        lowerBound = top_candidates.top().first;
                 }
             }
         }
@@ -761,6 +1184,7 @@ public:
     }
 
     void resizeIndex(size_t new_max_elements) {
+        checkWritable();
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
@@ -771,10 +1195,12 @@ public:
         std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
         // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        char * data_level0_memory_new = (char *) reallocateMemory(data_level0_memory_, level0_size_, new_max_elements * size_data_per_element_,
+                                                                  cur_element_count * size_data_per_element_, memory_policy_);
         if (data_level0_memory_new == nullptr)
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
         data_level0_memory_ = data_level0_memory_new;
+        level0_size_ = new_max_elements * size_data_per_element_;
 
         // Reallocate all other layers
         char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
@@ -782,9 +1208,176 @@ public:
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
         linkLists_ = linkLists_new;
 
+        if (exact_vectors_)
+            exact_vectors_->resize(new_max_elements);
+
+        label_lookup_.resize(new_max_elements);
         max_elements_ = new_max_elements;
     }
 
+    // Moves the level-0 records and the upper-level link lists of the elements to memory allocated with the policy,
+    // where element i takes the record and lists of element order[i]; the lists are packed into one slab, like a loaded
+    // index holds them
+    void relocateElements(const std::vector<tableint>& order, const MemoryPolicy& policy, size_t num_threads) {
+        size_t count = cur_element_count;
+        char *data_level0_memory_new = (char *) allocateMemory(max_elements_ * size_data_per_element_, policy);
+        if (data_level0_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate base layer");
+
+        size_t upper_links_size = 0;
+        for (size_t i = 0; i < count; i++)
+            upper_links_size += size_links_per_element_ * element_levels_[i];
+        std::vector<char> upper_links(upper_links_size);
+        std::vector<int> levels(count);
+        for (size_t i = 0, offset = 0; i < count; i++) {
+            levels[i] = element_levels_[order[i]];
+            memcpy(upper_links.data() + offset, linkLists_[order[i]], size_links_per_element_ * levels[i]);
+            offset += size_links_per_element_ * levels[i];
+        }
+
+        ParallelFor(0, count, num_threads, [&](size_t i, size_t threadId) {
+            memcpy(data_level0_memory_new + i * size_data_per_element_, data_level0_memory_ + order[i] * size_data_per_element_,
+                   size_data_per_element_);
+        });
+        freeMemory(data_level0_memory_, level0_size_, memory_policy_);
+        data_level0_memory_ = data_level0_memory_new;
+        level0_size_ = max_elements_ * size_data_per_element_;
+        memory_policy_ = policy;
+
+        link_list_arena_.setMemoryPolicy(policy);
+        link_list_arena_.reset(size_links_per_element_);
+        char *upper_links_slab = upper_links_size ? link_list_arena_.allocateSlab(upper_links_size) : nullptr;
+        if (upper_links_size)
+            memcpy(upper_links_slab, upper_links.data(), upper_links_size);
+        for (size_t i = 0, offset = 0; i < count; i++) {
+            element_levels_[i] = levels[i];
+            linkLists_[i] = levels[i] > 0 ? upper_links_slab + offset : nullptr;
+            offset += size_links_per_element_ * levels[i];
+        }
+    }
+
+    // Places the level-0 block and the link list slabs with the memory policy, moving them if the index holds any
+    // elements; set on an empty index before loadIndex() to load into memory of the policy
+    void setMemoryPolicy(const MemoryPolicy& policy, size_t num_threads = 0) {
+        checkWritable();
+        if (!data_level0_memory_) {
+            memory_policy_ = policy;
+            link_list_arena_.setMemoryPolicy(policy);
+            return;
+        }
+
+        std::vector<tableint> order(cur_element_count);
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (tableint) i;
+        relocateElements(order, policy, num_threads);
+    }
+
+    // Order of the elements placing the level-0 neighbors of an element close to it, as the old internal ID of each new
+    // internal ID; the orders start at the entry point
+    // With cluster_by_tags, the elements are grouped by their first tag, the groups following each other in the order
+    // of their first elements, so that the elements passing a tag filter lie together as well
+    std::vector<tableint> localityOrder(GraphOrder method, bool cluster_by_tags) const {
+        size_t count = cur_element_count;
+        std::vector<size_t> offsets(count + 1, 0);
+        for (size_t i = 0; i < count; i++)
+            offsets[i + 1] = offsets[i] + getListCount(get_linklist0(i));
+        std::vector<tableint> targets(offsets[count]);
+        for (size_t i = 0; i < count; i++) {
+            tableint *data = (tableint *) (get_linklist0(i) + 1);
+            std::copy(data, data + offsets[i + 1] - offsets[i], targets.begin() + offsets[i]);
+        }
+
+        std::vector<tableint> order = method == GraphOrder::Gorder ? gorderOrder(offsets, targets, enterpoint_node_)
+                                                                   : bfsOrder(offsets, targets, enterpoint_node_);
+
+        if (!cluster_by_tags)
+            return order;
+
+        std::unordered_map<tag_type, size_t> group_rank;
+        std::vector<size_t> rank(count);
+        for (tableint id : order) {
+            std::pair<const tag_type*, const tag_type*> tags = tag_index.nodeTags(id);
+            tag_type tag = tags.first != tags.second ? *tags.first : 0;
+            rank[id] = group_rank.emplace(tag, group_rank.size()).first->second;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](tableint a, tableint b) { return rank[a] < rank[b]; });
+        return order;
+    }
+
+    // Renumbers the elements in localityOrder(), so that a search reads the records of neighboring elements from nearby
+    // memory; a one-off pass over a built index, which cannot run concurrently with other calls
+    void reorder(GraphOrder method = GraphOrder::Gorder, bool cluster_by_tags = false, size_t num_threads = 0) {
+        checkWritable();
+        size_t count = cur_element_count;
+        if (count < 2)
+            return;
+
+        std::vector<tableint> order = localityOrder(method, cluster_by_tags);
+        std::vector<tableint> new_ids(count);
+        for (size_t i = 0; i < count; i++)
+            new_ids[order[i]] = (tableint) i;
+
+        relocateElements(order, memory_policy_, num_threads);
+
+        // The links of every level, including the tag link lists, now point to the new IDs
+        auto renumber = [&](linklistsizeint *links) {
+            size_t size = getListCount(links);
+            tableint *data = (tableint *) (links + 1);
+            for (size_t j = 0; j < size; j++)
+                data[j] = new_ids[data[j]];
+        };
+        ParallelFor(0, count, num_threads, [&](size_t i, size_t threadId) {
+            for (int level = 0; level <= element_levels_[i]; level++)
+                renumber(get_linklist_at_level(i, level));
+            for (size_t j = 0; j < tag_link_lists_; j++) {
+                tag_type *tag_links = getTagLinkList(i, j);
+                if (*tag_links)
+                    renumber((linklistsizeint *) (tag_links + 1));
+            }
+        });
+
+        std::vector<labeltype> labels(count);
+        for (size_t i = 0; i < count; i++)
+            labels[i] = getExternalLabel(i);
+        label_lookup_.rebuild(labels.data(), count, num_threads);
+
+        enterpoint_node_ = new_ids[enterpoint_node_];
+        for (auto& pair : enterpoints)
+            pair.second.second = new_ids[pair.second.second];
+        for (auto& pair : tag_seeds_) {
+            for (TagSeeds& seeds : pair.second) {
+                for (tableint& id : seeds.ids)
+                    id = new_ids[id];
+            }
+        }
+
+        std::unordered_set<tableint> deleted;
+        for (tableint id : deleted_elements)
+            deleted.insert(new_ids[id]);
+        deleted_elements.swap(deleted);
+
+        tag_index.permute(order);
+
+        // The full precision vectors are moved along the cycles of the permutation, one record at a time
+        if (exact_vectors_) {
+            std::vector<char> record(input_size_);
+            std::vector<bool> moved(count, false);
+            for (size_t start = 0; start < count; start++) {
+                if (moved[start])
+                    continue;
+                memcpy(record.data(), exact_vectors_->at(start), input_size_);
+                size_t id = start;
+                while (order[id] != start) {
+                    memcpy(exact_vectors_->at(id), exact_vectors_->at(order[id]), input_size_);
+                    moved[id] = true;
+                    id = order[id];
+                }
+                memcpy(exact_vectors_->at(id), record.data(), input_size_);
+                moved[id] = true;
+            }
+        }
+    }
+
     size_t indexFileSize() const {
         size_t size = 0;
         size += sizeof(offsetLevel0_);
@@ -793,6 +1386,11 @@ public:
         size += sizeof(size_data_per_element_);
         size += sizeof(label_offset_);
         size += sizeof(offsetData_);
+        size += sizeof(inline_tag_slots_);
+        size += sizeof(offsetTags_);
+        size += sizeof(tag_link_lists_);
+        size += sizeof(tag_link_size_);
+        size += sizeof(offsetTagLinks_);
         size += sizeof(maxlevel_);
         size += sizeof(enterpoint_node_);
         size += sizeof(maxM_);
@@ -813,69 +1411,296 @@ public:
     }
 
     void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
+        IndexFileWriter file(location, IndexKind::HierarchicalNSW);
+        saveIndex(file);
+        file.close();
+    }
 
+    // Writes the sections of the index, numbered with the given part in files holding several graphs
+    void saveIndex(IndexFileWriter &file, uint32_t part = 0) {
+        if (exact_vectors_)
+            exact_vectors_->flush();
+
+        std::ostream& output = file.beginSection(IndexSection::Parameters, part);
         writeBinaryPOD(output, offsetLevel0_);
         writeBinaryPOD(output, max_elements_);
         writeBinaryPOD(output, cur_element_count);
         writeBinaryPOD(output, size_data_per_element_);
         writeBinaryPOD(output, label_offset_);
         writeBinaryPOD(output, offsetData_);
+        writeBinaryPOD(output, inline_tag_slots_);
+        writeBinaryPOD(output, offsetTags_);
+        writeBinaryPOD(output, tag_link_lists_);
+        writeBinaryPOD(output, tag_link_size_);
+        writeBinaryPOD(output, offsetTagLinks_);
         writeBinaryPOD(output, maxlevel_);
         writeBinaryPOD(output, enterpoint_node_);
         writeBinaryPOD(output, maxM_);
-
         writeBinaryPOD(output, maxM0_);
         writeBinaryPOD(output, M_);
         writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
         writeBinaryPOD(output, adaptive);
-        writeBinaryPOD(output, enterpoints.size());
+        file.endSection();
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        file.beginSection(IndexSection::Level0, part).write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        file.endSection();
+        file.beginSection(IndexSection::ElementLevels, part).write((char *) element_levels_.data(), cur_element_count * sizeof(int));
+        file.endSection();
 
+        // The link lists of the elements above level 0, packed in the order of their internal IDs
+        file.beginSection(IndexSection::UpperLinks, part);
         for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+            if (element_levels_[i] > 0)
+                output.write(linkLists_[i], size_links_per_element_ * element_levels_[i]);
         }
+        file.endSection();
 
-        for (const auto& pair : enterpoints) {
+        // Tags are written in order, so that saving the same index twice gives the same file
+        file.beginSection(IndexSection::TagEntryPoints, part);
+        std::map<std::string, std::pair<unsigned, tableint>> sorted_enterpoints(enterpoints.begin(), enterpoints.end());
+        writeBinaryPOD(output, sorted_enterpoints.size());
+        for (const auto& pair : sorted_enterpoints) {
             writeBinaryPOD(output, pair.first.length());
             output.write(pair.first.c_str(), pair.first.length());
             writeBinaryPOD(output, pair.second.first);
             writeBinaryPOD(output, pair.second.second);
         }
 
-        tag_index.saveIndex(output);
-        output.close();
+        writeBinaryPOD(output, max_tag_seeds_);
+        std::map<std::string, const std::vector<TagSeeds>*> sorted_seeds;
+        for (const auto& pair : tag_seeds_)
+            sorted_seeds.emplace(pair.first, &pair.second);
+        writeBinaryPOD(output, sorted_seeds.size());
+        for (const auto& pair : sorted_seeds) {
+            writeBinaryPOD(output, pair.first.length());
+            output.write(pair.first.c_str(), pair.first.length());
+            writeBinaryPOD(output, pair.second->size());
+            for (const TagSeeds& seeds : *pair.second) {
+                writeBinaryPOD(output, seeds.ids.size());
+                output.write((char *) seeds.ids.data(), seeds.ids.size() * sizeof(tableint));
+                output.write((char *) seeds.spread.data(), seeds.spread.size() * sizeof(dist_t));
+            }
+        }
+        file.endSection();
+
+        tag_index.saveIndex(file, part);
     }
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+    // Reads the sections of index files on up to num_threads threads (0 uses all hardware threads)
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, size_t num_threads = 0) {
         std::ifstream input(location, std::ios::binary);
 
         if (!input.is_open())
             throw std::runtime_error("Cannot open file");
 
-        clear();
-        // get file size:
-        input.seekg(0, input.end);
-        std::streampos total_filesize = input.tellg();
-        input.seekg(0, input.beg);
+        if (!IndexFileReader::isIndexFile(input)) {
+            loadLegacyIndex(input, s, max_elements_i);
+            return;
+        }
+        input.close();
 
-        readBinaryPOD(input, offsetLevel0_);
-        readBinaryPOD(input, max_elements_);
-        readBinaryPOD(input, cur_element_count);
+        IndexFileReader file(location);
+        file.expectKind(IndexKind::HierarchicalNSW);
+        loadIndex(file, s, max_elements_i, false, true, 0, num_threads);
+    }
 
-        size_t max_elements = max_elements_i, enterpointNodes;
-        if (max_elements < cur_element_count)
-            max_elements = max_elements_;
+    /*
+    * Loads an index read-only, mapping its level-0 block, upper-level link lists and node tags from the file instead of
+    * reading them, so that loading takes no time for these, their pages are read on first access and processes loading
+    * the same file share them. Insertions, deletions and resizing throw. The checksums of the mapped sections are only
+    * verified on request, as that reads all their pages.
+    */
+    void mapIndex(const std::string &location, SpaceInterface<dist_t> *s, bool verify_checksums = false) {
+        IndexFileReader file(location);
+        file.expectKind(IndexKind::HierarchicalNSW);
+        loadIndex(file, s, 0, true, verify_checksums);
+    }
+
+    /*
+    * Reads the sections of the index with the given part, or maps them read-only.
+    * The level-0 block, the upper-level link lists and the node tags are read concurrently, and the label lookup is then
+    * rebuilt from the level-0 block on up to num_threads threads.
+    */
+    void loadIndex(IndexFileReader &file, SpaceInterface<dist_t> *s, size_t max_elements_i, bool mapped = false,
+                   bool verify_checksums = true, uint32_t part = 0, size_t num_threads = 0) {
+        clear();
+        std::istream& input = file.open(IndexSection::Parameters, part);
+
+        readBinaryPOD(input, offsetLevel0_);
+        readBinaryPOD(input, max_elements_);
+        readBinaryPOD(input, cur_element_count);
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < cur_element_count)
+            max_elements = max_elements_;
+        if (mapped)
+            max_elements = cur_element_count;
         max_elements_ = max_elements;
         readBinaryPOD(input, size_data_per_element_);
         readBinaryPOD(input, label_offset_);
         readBinaryPOD(input, offsetData_);
+        readBinaryPOD(input, inline_tag_slots_);
+        readBinaryPOD(input, offsetTags_);
+        readBinaryPOD(input, tag_link_lists_);
+        readBinaryPOD(input, tag_link_size_);
+        readBinaryPOD(input, offsetTagLinks_);
+        size_tag_link_list_ = sizeof(tag_type) + sizeof(linklistsizeint) + tag_link_size_ * sizeof(tableint);
+        readBinaryPOD(input, maxlevel_);
+        readBinaryPOD(input, enterpoint_node_);
+        readBinaryPOD(input, maxM_);
+        readBinaryPOD(input, maxM0_);
+        readBinaryPOD(input, M_);
+        readBinaryPOD(input, mult_);
+        readBinaryPOD(input, ef_construction_);
+        readBinaryPOD(input, adaptive);
+
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        fstbatchdistfunc_ = s->get_batch_dist_func();
+        dist_func_param_ = s->get_dist_func_param();
+        setExactSpace(s);
+        if (label_offset_ != offsetData_ + data_size_)
+            throw std::runtime_error("The index was built for a space with another data size");
+
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        // No insertions lock the link lists of a mapped index, which saves a mutex per element
+        std::vector<std::mutex>(mapped ? 0 : max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+        std::vector<std::mutex>(MAX_TAG_OPERATION_LOCKS).swap(tag_op_locks_);
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+
+        element_levels_ = std::vector<int>(max_elements);
+        file.read(IndexSection::ElementLevels, element_levels_.data(), cur_element_count * sizeof(int), part);
+        size_t upper_links_size = 0;
+        for (size_t i = 0; i < cur_element_count; i++)
+            upper_links_size += size_links_per_element_ * element_levels_[i];
+
+        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
+        if (linkLists_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        link_list_arena_.reset(size_links_per_element_);
+        // Work on all elements is split into blocks of consecutive IDs
+        const size_t element_count = cur_element_count;
+        const size_t block = 65536;
+        const size_t blocks = (element_count + block - 1) / block;
+
+        // The upper-level link lists are one block in ID order, either mapped or read into a single slab of the arena
+        char *upper_links;
+        if (mapped) {
+            char *level0 = (char *) file.map(IndexSection::Level0, cur_element_count * size_data_per_element_, part, verify_checksums);
+            upper_links = (char *) file.map(IndexSection::UpperLinks, upper_links_size, part, verify_checksums);
+            mapped_file_ = file.mapping();
+            data_level0_memory_ = level0;
+            tag_index.loadIndex(file, true, verify_checksums, part);
+        } else {
+            data_level0_memory_ = (char *) allocateMemory(max_elements * size_data_per_element_, memory_policy_);
+            if (data_level0_memory_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+            level0_size_ = max_elements * size_data_per_element_;
+            if (file.size(IndexSection::UpperLinks, part) != upper_links_size)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+            upper_links = link_list_arena_.allocateSlab(upper_links_size);
+            std::vector<std::function<void()>> reads = {
+                [&] { file.read(IndexSection::Level0, data_level0_memory_, cur_element_count * size_data_per_element_, part); },
+                [&] { file.read(IndexSection::UpperLinks, upper_links, upper_links_size, part); },
+                [&] { tag_index.loadIndex(file, false, true, part); }
+            };
+            ParallelFor(0, reads.size(), std::min(resolveThreadCount(num_threads), reads.size()), [&](size_t i, size_t threadId) {
+                reads[i]();
+            });
+        }
+        for (size_t i = 0; i < element_count; i++) {
+            linkLists_[i] = element_levels_[i] > 0 ? upper_links : nullptr;
+            upper_links += size_links_per_element_ * element_levels_[i];
+        }
+
+        // Labels and deletion marks are gathered in parallel, and the label lookup is rebuilt from them in bulk
+        std::vector<labeltype> labels(element_count);
+        std::atomic<size_t> deleted(0);
+        ParallelFor(0, blocks, num_threads, [&](size_t b, size_t threadId) {
+            size_t block_deleted = 0;
+            for (size_t i = b * block; i < std::min(element_count, (b + 1) * block); i++) {
+                labels[i] = getExternalLabel(i);
+                block_deleted += isMarkedDeleted(i);
+            }
+            deleted += block_deleted;
+        });
+        label_lookup_.resize(max_elements);
+        label_lookup_.rebuild(labels.data(), element_count, num_threads);
+        num_deleted_ = deleted.load();
+        for (size_t i = 0; allow_replace_deleted_ && num_deleted_ && i < element_count; i++) {
+            if (isMarkedDeleted(i))
+                deleted_elements.insert(i);
+        }
+
+        file.open(IndexSection::TagEntryPoints, part);
+        size_t enterpointNodes;
+        readBinaryPOD(input, enterpointNodes);
+        for (size_t i = 0; i < enterpointNodes; i++) {
+            size_t tagLength;
+            unsigned level;
+            tableint nodeId;
+            readBinaryPOD(input, tagLength);
+            std::string tag(tagLength, '\0');
+            input.read(&tag[0], tagLength);
+            readBinaryPOD(input, level);
+            readBinaryPOD(input, nodeId);
+            enterpoints.insert({tag, std::make_pair(level, nodeId)});
+        }
+
+        size_t seededTags;
+        readBinaryPOD(input, max_tag_seeds_);
+        readBinaryPOD(input, seededTags);
+        for (size_t i = 0; i < seededTags; i++) {
+            size_t tagLength, levels;
+            readBinaryPOD(input, tagLength);
+            std::string tag(tagLength, '\0');
+            input.read(&tag[0], tagLength);
+            readBinaryPOD(input, levels);
+
+            std::vector<TagSeeds>& tagSeeds = tag_seeds_[tag];
+            tagSeeds.resize(levels);
+            for (TagSeeds& seeds : tagSeeds) {
+                size_t size;
+                readBinaryPOD(input, size);
+                seeds.ids.resize(size);
+                seeds.spread.resize(size);
+                input.read((char *) seeds.ids.data(), size * sizeof(tableint));
+                input.read((char *) seeds.spread.data(), size * sizeof(dist_t));
+            }
+        }
+    }
+
+    // Reads the layout written before index files had sections
+    void loadLegacyIndex(std::ifstream &input, SpaceInterface<dist_t> *s, size_t max_elements_i) {
+        clear();
+        // get file size:
+        input.seekg(0, input.end);
+        std::streampos total_filesize = input.tellg();
+        input.seekg(0, input.beg);
+
+        readBinaryPOD(input, offsetLevel0_);
+        readBinaryPOD(input, max_elements_);
+        readBinaryPOD(input, cur_element_count);
+
+        size_t max_elements = max_elements_i, enterpointNodes;
+        if (max_elements < cur_element_count)
+            max_elements = max_elements_;
+        max_elements_ = max_elements;
+        readBinaryPOD(input, size_data_per_element_);
+        readBinaryPOD(input, label_offset_);
+        readBinaryPOD(input, offsetData_);
+        readBinaryPOD(input, inline_tag_slots_);
+        readBinaryPOD(input, offsetTags_);
+        readBinaryPOD(input, tag_link_lists_);
+        readBinaryPOD(input, tag_link_size_);
+        readBinaryPOD(input, offsetTagLinks_);
+        size_tag_link_list_ = sizeof(tag_type) + sizeof(linklistsizeint) + tag_link_size_ * sizeof(tableint);
         readBinaryPOD(input, maxlevel_);
         readBinaryPOD(input, enterpoint_node_);
 
@@ -889,7 +1714,9 @@ public:
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstbatchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
+        setExactSpace(s);
 
         auto pos = input.tellg();
 
@@ -912,9 +1739,10 @@ public:
 
         input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
+        data_level0_memory_ = (char *) allocateMemory(max_elements * size_data_per_element_, memory_policy_);
         if (data_level0_memory_ == nullptr)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+        level0_size_ = max_elements * size_data_per_element_;
         input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
 
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
@@ -922,6 +1750,7 @@ public:
         size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
         std::vector<std::mutex>(max_elements).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+        std::vector<std::mutex>(MAX_TAG_OPERATION_LOCKS).swap(tag_op_locks_);
 
         visited_list_pool_.reset(new VisitedListPool(1, max_elements));
 
@@ -931,8 +1760,10 @@ public:
         element_levels_ = std::vector<int>(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
+        label_lookup_.resize(max_elements);
+        link_list_arena_.reset(size_links_per_element_);
         for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
+            label_lookup_.set(getExternalLabel(i), i);
             unsigned int linkListSize;
             readBinaryPOD(input, linkListSize);
             if (linkListSize == 0) {
@@ -940,9 +1771,7 @@ public:
                 linkLists_[i] = nullptr;
             } else {
                 element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
+                linkLists_[i] = link_list_arena_.allocate(element_levels_[i]);
                 input.read(linkLists_[i], linkListSize);
             }
         }
@@ -960,36 +1789,50 @@ public:
             tableint nodeId;
             readBinaryPOD(input, tagLength);
 
-            char* cTag = (char*) malloc(tagLength);
-            input.read(cTag, sizeof(char) * tagLength);
+            std::string tag(tagLength, '\0');
+            input.read(&tag[0], tagLength);
             readBinaryPOD(input, level);
             readBinaryPOD(input, nodeId);
-
-            std::string tag = cTag;
-            tag = tag.substr(0, tagLength);
             enterpoints.insert({tag, std::make_pair(level, nodeId)});
         }
 
-        tag_index.loadIndex(input);
-        input.close();
+        size_t seededTags;
+        readBinaryPOD(input, max_tag_seeds_);
+        readBinaryPOD(input, seededTags);
+        tag_seeds_.clear();
+        for (size_t i = 0; i < seededTags; i++) {
+            size_t tagLength, levels;
+            readBinaryPOD(input, tagLength);
+            std::string tag(tagLength, '\0');
+            input.read(&tag[0], tagLength);
+            readBinaryPOD(input, levels);
+
+            std::vector<TagSeeds>& tagSeeds = tag_seeds_[tag];
+            tagSeeds.resize(levels);
+            for (TagSeeds& seeds : tagSeeds) {
+                size_t size;
+                readBinaryPOD(input, size);
+                seeds.ids.resize(size);
+                seeds.spread.resize(size);
+                input.read((char *) seeds.ids.data(), size * sizeof(tableint));
+                input.read((char *) seeds.spread.data(), size * sizeof(dist_t));
+            }
+        }
 
-        return;
+        tag_index.loadIndex(input);
     }
 
     template<typename data_t>
     std::vector<data_t> getDataByLabel(labeltype label) const {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
-        
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
+
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId) || isMarkedDeleted(internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
-        char* data_ptrv = getDataByInternalId(internalId);
+        char* data_ptrv = exact_vectors_ ? exact_vectors_->at(internalId) : getDataByInternalId(internalId);
         size_t dim = *((size_t *) dist_func_param_);
         std::vector<data_t> data;
         data_t* data_ptr = (data_t*) data_ptrv;
@@ -1007,13 +1850,10 @@ public:
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
         markDeletedInternal(internalId);
     }
@@ -1023,6 +1863,7 @@ public:
     * whereas maxM0_ has to be limited to the lower 16 bits, however, still large enough in almost all cases.
     */
     void markDeletedInternal(tableint internalId) {
+        checkWritable();
         assert(internalId < cur_element_count);
         if (!isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
@@ -1047,13 +1888,10 @@ public:
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
         unmarkDeletedInternal(internalId);
     }
@@ -1062,6 +1900,7 @@ public:
     * Remove the deleted mark of the node.
     */
     void unmarkDeletedInternal(tableint internalId) {
+        checkWritable();
         assert(internalId < cur_element_count);
         if (isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
@@ -1094,11 +1933,28 @@ public:
         *((unsigned short int*)(ptr))=*((unsigned short int *)&size);
     }
 
+    /*
+    * Adds n points on num_threads threads (0 uses all hardware threads), where point i starts at data + i * data size.
+    * The tags are either empty or hold the tags of every point.
+    */
+    void addPoints(const void *data, const labeltype *labels, const std::vector<std::vector<std::string>>& tags, size_t n,
+                   size_t num_threads = 0, bool replace_deleted = false) {
+        if (!tags.empty() && tags.size() != n) {
+            throw std::runtime_error("Number of tag lists does not match the number of points");
+        }
+
+        const std::vector<std::string> no_tags;
+        ParallelFor(0, n, num_threads, [&](size_t i, size_t threadId) {
+            addPoint((const char *) data + i * input_size_, labels[i], tags.empty() ? no_tags : tags[i], replace_deleted);
+        });
+    }
+
     /*
     * Adds point. Updates the point if it is already in the index.
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, const std::vector<std::string>& tags, bool replace_deleted = false) {
+        checkWritable();
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
@@ -1128,10 +1984,8 @@ public:
             labeltype label_replaced = getExternalLabel(internal_id_replaced);
             setExternalLabel(internal_id_replaced, label);
 
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
             label_lookup_.erase(label_replaced);
-            label_lookup_[label] = internal_id_replaced;
-            lock_table.unlock();
+            label_lookup_.set(label, internal_id_replaced);
 
             unmarkDeletedInternal(internal_id_replaced);
             updatePoint(data_point, internal_id_replaced, 1.0);
@@ -1139,6 +1993,11 @@ public:
     }
 
     void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
+        if (exact_vectors_)
+            memcpy(exact_vectors_->at(internalId), dataPoint, input_size_);
+        std::vector<char> code;
+        dataPoint = encodeVector(dataPoint, code);
+
         // update the feature vector associated with existing point with new vector
         memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
 
@@ -1284,7 +2143,9 @@ public:
     }
 
     std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        std::unique_lock <std::mutex> lock;
+        if (!mapped_file_)
+            lock = std::unique_lock <std::mutex>(link_list_locks_[internalId]);
         unsigned int *data = get_linklist_at_level(internalId, level);
         int size = getListCount(data);
         std::vector<tableint> result(size);
@@ -1298,16 +2159,14 @@ public:
         {
             // Checking if the element with the same label already exists
             // if so, updating it *instead* of creating a new element.
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            auto search = label_lookup_.find(label);
-            if (search != label_lookup_.end()) {
-                tableint existingInternalId = search->second;
+            // Operations on the label are serialized by its label operation lock, so that it cannot be added twice
+            tableint existingInternalId;
+            if (label_lookup_.find(label, existingInternalId)) {
                 if (allow_replace_deleted_) {
                     if (isMarkedDeleted(existingInternalId)) {
                         throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
                     }
                 }
-                lock_table.unlock();
 
                 if (isMarkedDeleted(existingInternalId)) {
                     unmarkDeletedInternal(existingInternalId);
@@ -1318,42 +2177,29 @@ public:
                 return existingInternalId;
             }
 
-            if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
-            }
+            size_t count = cur_element_count;
+            do {
+                if (count >= max_elements_) {
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                }
+            } while (!cur_element_count.compare_exchange_weak(count, count + 1));
 
-            cur_c = cur_element_count;
-            cur_element_count++;
-            label_lookup_[label] = cur_c;
+            cur_c = count;
+            label_lookup_.set(label, cur_c);
         }
 
+        if (exact_vectors_)
+            memcpy(exact_vectors_->at(cur_c), data_point, input_size_);
+        std::vector<char> code;
+        data_point = encodeVector(data_point, code);
+
         std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
         int curlevel = adaptive ? tagBasedLevel(tags) : getRandomLevel(mult_);
 
         if (level > 0)
             curlevel = level;
 
-        for (const std::string& tag : tags)
-        {
-            if (enterpoints.find(tag) == enterpoints.end())
-            {
-                enterpoints.insert({tag, std::make_pair(curlevel, cur_c)});
-            }
-
-            else
-            {
-                unsigned prevLevel = enterpoints[tag].first;
-
-                if (curlevel > prevLevel)
-                {
-                    enterpoints.erase(tag);
-                    enterpoints.insert({tag, std::make_pair(curlevel, cur_c)});
-                }
-            }
-        }
-
         element_levels_[cur_c] = curlevel;
-        tag_index.insert(cur_c, tags, curlevel);
 
         std::unique_lock <std::mutex> templock(global);
         int maxlevelcopy = maxlevel_;
@@ -1367,13 +2213,11 @@ public:
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+        tag_index.insert(cur_c, tags, curlevel);
+        setInlineTags(cur_c);
 
-        if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
-        }
+        if (curlevel)
+            linkLists_[cur_c] = link_list_arena_.allocate(curlevel);
 
         if ((signed)currObj != -1) {
             if (curlevel < maxlevelcopy) {
@@ -1408,6 +2252,9 @@ public:
                 if (level > maxlevelcopy || level < 0)  // possible?
                     throw std::runtime_error("Level error");
 
+                if (level == 0)
+                    connectTagLinks(data_point, cur_c, tags, currObj);
+
                 std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
                         currObj, data_point, level);
                 if (epDeleted) {
@@ -1421,6 +2268,7 @@ public:
             // Do nothing for the first element
             enterpoint_node_ = 0;
             maxlevel_ = curlevel;
+            connectTagLinks(data_point, cur_c, tags, cur_c);
         }
 
         // Releasing lock for the maximum level
@@ -1429,9 +2277,179 @@ public:
             maxlevel_ = curlevel;
         }
 
+        // The element only becomes an entry point once it is connected
+        updateTagEnterpoints(tags, curlevel, cur_c);
         return cur_c;
     }
 
+    // Fills the tag link lists of a new element, one for each of its most frequent tags, with the closest elements
+    // having that tag, chosen by the neighbor heuristic, and adds the element to their lists for the tag in turn
+    // Runs before the element is linked on level 0, so that the search cannot reach the element, whose lock is held
+    void connectTagLinks(const void *data_point, tableint cur_c, const std::vector<std::string>& tags, tableint entry) {
+        if (!tag_link_lists_ || tags.empty()) return;
+
+        std::vector<std::pair<size_t, std::string>> by_frequency;
+        for (const std::string& tag : tags) {
+            by_frequency.emplace_back(tag_index.frequency(tag_index.resolveTag(tag), 0), tag);
+        }
+        std::sort(by_frequency.begin(), by_frequency.end(), std::greater<std::pair<size_t, std::string>>());
+        by_frequency.erase(std::unique(by_frequency.begin(), by_frequency.end()), by_frequency.end());
+
+        size_t lists = std::min(tag_link_lists_, by_frequency.size());
+        for (size_t i = 0; i < lists; i++) {
+            const std::string& tag = by_frequency[i].second;
+            TagFilter filter = compileTagFilter(TagExpression::of(tag));
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+            if (entry != cur_c)
+                candidates = searchBaseLayer(entry, data_point, 0, &filter);
+            getNeighborsByHeuristic2(candidates, tag_link_size_);
+
+            // The tag is written last, as searches skip lists without one
+            tag_type tag_id = tag_index.resolveTag(tag);
+            tag_type *tag_links = getTagLinkList(cur_c, i);
+            linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+            std::vector<tableint> neighbors;
+            while (!candidates.empty()) {
+                neighbors.push_back(candidates.top().second);
+                candidates.pop();
+            }
+            std::copy(neighbors.begin(), neighbors.end(), (tableint *) (links + 1));
+            setListCount(links, neighbors.size());
+            *tag_links = tag_id;
+
+            for (tableint neighbor : neighbors) {
+                addTagLink(neighbor, tag_id, cur_c);
+            }
+        }
+    }
+
+    // Adds an element to another's link list for a tag, if it has one, pruning the list with the heuristic when full
+    void addTagLink(tableint internal_id, tag_type tag_id, tableint new_id) {
+        std::unique_lock <std::mutex> lock(link_list_locks_[internal_id]);
+        for (size_t i = 0; i < tag_link_lists_; i++) {
+            tag_type *tag_links = getTagLinkList(internal_id, i);
+            if (!*tag_links)
+                return;
+            if (*tag_links != tag_id)
+                continue;
+
+            linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+            tableint *data = (tableint *) (links + 1);
+            size_t size = getListCount(links);
+            if (std::find(data, data + size, new_id) != data + size)
+                return;
+            if (size < tag_link_size_) {
+                data[size] = new_id;
+                setListCount(links, size + 1);
+                return;
+            }
+
+            char *element_data = getDataByInternalId(internal_id);
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+            candidates.emplace(fstdistfunc_(getDataByInternalId(new_id), element_data, dist_func_param_), new_id);
+            for (size_t j = 0; j < size; j++) {
+                candidates.emplace(fstdistfunc_(getDataByInternalId(data[j]), element_data, dist_func_param_), data[j]);
+            }
+            getNeighborsByHeuristic2(candidates, tag_link_size_);
+
+            size_t indx = 0;
+            while (!candidates.empty()) {
+                data[indx++] = candidates.top().second;
+                candidates.pop();
+            }
+            setListCount(links, indx);
+            return;
+        }
+    }
+
+    void updateTagEnterpoints(const std::vector<std::string>& tags, int curlevel, tableint cur_c) {
+        std::shared_lock<std::shared_mutex> tag_lock(tag_lock_);
+        for (const std::string& tag : tags) {
+            if (enterpoints.find(tag) == enterpoints.end()) {
+                tag_lock.unlock();
+                std::unique_lock<std::shared_mutex> exclusive_lock(tag_lock_);
+                enterpoints.insert({tag, std::make_pair(curlevel, cur_c)});
+                tag_seeds_[tag];
+                exclusive_lock.unlock();
+                tag_lock.lock();
+            }
+
+            std::unique_lock <std::mutex> lock_tag(getTagOpMutex(tag));
+            std::pair<unsigned, tableint>& enterpoint = enterpoints.find(tag)->second;
+            if (curlevel > enterpoint.first) {
+                enterpoint = std::make_pair(curlevel, cur_c);
+            }
+
+            std::vector<TagSeeds>& seeds = tag_seeds_.find(tag)->second;
+            if (seeds.size() <= (size_t) curlevel)
+                seeds.resize(curlevel + 1);
+            for (int level = 0; level <= curlevel; level++) {
+                addTagSeed(seeds[level], cur_c);
+            }
+        }
+    }
+
+    // Adds an element to the seeds until they are full, and afterwards only swaps it for the seed with the nearest other seed
+    // if that makes the seeds more spread out, so the seeds stay spread over the regions of the space the tag occurs in
+    void addTagSeed(TagSeeds& seeds, tableint cur_c) const {
+        char *data = getDataByInternalId(cur_c);
+        std::vector<dist_t> distances(seeds.ids.size());
+        for (size_t i = 0; i < seeds.ids.size(); i++) {
+            distances[i] = fstdistfunc_(data, getDataByInternalId(seeds.ids[i]), dist_func_param_);
+        }
+
+        if (seeds.ids.size() < max_tag_seeds_) {
+            dist_t nearest = std::numeric_limits<dist_t>::max();
+            for (size_t i = 0; i < seeds.ids.size(); i++) {
+                seeds.spread[i] = std::min(seeds.spread[i], distances[i]);
+                nearest = std::min(nearest, distances[i]);
+            }
+            seeds.ids.push_back(cur_c);
+            seeds.spread.push_back(nearest);
+            return;
+        }
+
+        size_t crowded = std::min_element(seeds.spread.begin(), seeds.spread.end()) - seeds.spread.begin();
+        dist_t nearest = std::numeric_limits<dist_t>::max();
+        for (size_t i = 0; i < seeds.ids.size(); i++) {
+            if (i != crowded)
+                nearest = std::min(nearest, distances[i]);
+        }
+        if (nearest <= seeds.spread[crowded])
+            return;
+
+        seeds.ids[crowded] = cur_c;
+        for (size_t i = 0; i < seeds.ids.size(); i++) {
+            seeds.spread[i] = std::numeric_limits<dist_t>::max();
+            for (size_t j = 0; j < seeds.ids.size(); j++) {
+                if (i != j) {
+                    dist_t d = fstdistfunc_(getDataByInternalId(seeds.ids[i]), getDataByInternalId(seeds.ids[j]), dist_func_param_);
+                    seeds.spread[i] = std::min(seeds.spread[i], d);
+                }
+            }
+        }
+    }
+
+    // Seeds of all query tags, merged per level
+    std::vector<std::vector<tableint>> collectTagSeeds(const std::vector<std::string>& tags) const {
+        std::vector<std::vector<tableint>> level_seeds;
+        std::shared_lock<std::shared_mutex> tag_lock(tag_lock_);
+        for (const std::string& tag : tags) {
+            auto it = tag_seeds_.find(tag);
+            if (it == tag_seeds_.end())  // Unknown tag, or no element with it is connected yet
+                continue;
+
+            std::unique_lock <std::mutex> lock_tag(getTagOpMutex(tag));
+            if (level_seeds.size() < it->second.size())
+                level_seeds.resize(it->second.size());
+            for (size_t level = 0; level < it->second.size(); level++) {
+                const std::vector<tableint>& ids = it->second[level].ids;
+                level_seeds[level].insert(level_seeds[level].end(), ids.begin(), ids.end());
+            }
+        }
+        return level_seeds;
+    }
+
     void moveUp(tableint id, int newLevel, tableint enterpoint)
     {
         if (newLevel > maxlevel_)
@@ -1456,16 +2474,17 @@ public:
             throw std::runtime_error("New level must be greater than previous level");
         }
 
-        element_levels_[id] = newLevel;
-        char* linkedListsCopy = (char*) realloc(linkLists_[id], size_links_per_element_ * newLevel + 1);
+        // The lists move to a block of the new level, and the old block is left for the next element of the previous level
+        char* block = link_list_arena_.allocate(newLevel);
 
-        if (!linkedListsCopy)
+        if (prevLevel > 0)
         {
-            throw std::runtime_error("Failed allocating node being move up to higher levels");
+            memcpy(block, linkLists_[id], size_links_per_element_ * prevLevel);
+            link_list_arena_.release(linkLists_[id], prevLevel);
         }
 
-        linkLists_[id] = linkedListsCopy;
-        memset(linkLists_[id] + size_links_per_element_ * prevLevel, 0, size_links_per_element_ * (newLevel - prevLevel) + 1);
+        linkLists_[id] = block;
+        element_levels_[id] = newLevel;
 
         void* curData = getDataByInternalId(id);
         tableint curObj = enterpoint, enterpointCopy = enterpoint;
@@ -1503,35 +2522,58 @@ public:
         tag_index.getRelationshipGraph().relate(tagIds);
     }
 
-    void flushTags()
+    // Computes the tag distances on num_threads threads, 0 uses all hardware threads
+    void flushTags(size_t num_threads = 0)
     {
-        tag_index.getRelationshipGraph().computeDistances();
+        tag_index.getRelationshipGraph().computeDistances(num_threads);
+    }
+
+    // Computes tag distances on demand within the given number of hops instead of all pairs when flushing tags,
+    // keeping the distances from the most recently used cache_size source tags
+    void setLazyTagDistances(unsigned radius, size_t cache_size)
+    {
+        tag_index.getRelationshipGraph().setLazyDistances(radius, cache_size);
     }
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, const std::vector<std::string>& tags, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+        QueryStats stats;
+        return searchKnnWithStats(query_data, k, tags, stats, isIdAllowed);
+    }
 
-        tableint currObj = enterpoint_node_;
-        unsigned maxTagFrequency = 0, startLevel = maxlevel_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(currObj), dist_func_param_);
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, const TagExpression& filter, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        QueryStats stats;
+        return searchKnnWithStats(query_data, k, filter, stats, isIdAllowed);
+    }
 
-        for (const std::string& tag : tags) // Choose the most popular tag, as this should provide the best search-quality performance
-        {
-            unsigned tagFrequency = tag_index.frequency(tag, 0);
+    void setQueryPlanner(const QueryPlanner& planner) {
+        query_planner_ = planner;
+    }
 
-            if (tagFrequency > maxTagFrequency)
-            {
-                auto pair = enterpoints.at(tag);
-                startLevel = pair.first;
-                currObj = pair.second;
-                curdist = fstdistfunc_(query_data, getDataByInternalId(currObj), dist_func_param_);
-                maxTagFrequency = tagFrequency;
-            }
-        }
+    // Estimates the number of elements passing the filter from the level 0 tag frequencies
+    size_t estimateMatches(const TagFilter& tag_filter) const {
+        return std::lround(tag_filter.program.selectivity() * cur_element_count);
+    }
+
+    // Greedy search through the upper layers, only moving to nodes passing the filter
+    // On arriving at a level, the search jumps to the closest of the given seeds of that level if it is closer
+    tableint searchUpperLayers(const void *query_data, tableint currObj, int startLevel, const TagFilter* tag_filter,
+                               const std::vector<std::vector<tableint>>* level_seeds = nullptr) const {
+        dist_t curdist = querydistfunc_(query_data, getDataByInternalId(currObj), dist_func_param_);
 
         for (int level = startLevel; level > 0; level--) {
+            if (level_seeds) {
+                for (tableint seed : (*level_seeds)[level]) {
+                    dist_t d = querydistfunc_(query_data, getDataByInternalId(seed), dist_func_param_);
+                    if (d < curdist) {
+                        currObj = seed;
+                        curdist = d;
+                    }
+                }
+                metric_distance_computations += (*level_seeds)[level].size();
+            }
+
             bool changed = true;
             while (changed) {
                 changed = false;
@@ -1547,35 +2589,202 @@ public:
                     tableint cand = datal[i];
                     if (cand < 0 || cand > max_elements_)
                         throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
-                    if (d < curdist) {
-                        std::vector<std::string> nodeTags = tag_index.get(cand);
+                    dist_t d = querydistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
-                        for (const std::string& tag : tags) {
-
-                            if (std::find(nodeTags.begin(), nodeTags.end(), tag) != nodeTags.end()) {
-                                currObj = cand;
-                                curdist = d;
-                                changed = true;
-                                break;
-                            }
-                        }
+                    if (d < curdist && passesTagFilter(cand, tag_filter)) {
+                        currObj = cand;
+                        curdist = d;
+                        changed = true;
                     }
                 }
             }
         }
 
+        return currObj;
+    }
+
+    // Distances from one vector to several others, with the space's batched kernel when it has one
+    inline void batchDistances(const void *data_point, const void *const *others, size_t count, dist_t *distances) const {
+        if (fstbatchdistfunc_) {
+            fstbatchdistfunc_(data_point, others, count, dist_func_param_, distances);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+            distances[i] = fstdistfunc_(data_point, others[i], dist_func_param_);
+    }
+
+    // Distances from an encoded query to several stored vectors
+    inline void queryDistances(const void *query_data, const void *const *others, size_t count, dist_t *distances) const {
+        if (!query_size_) {
+            batchDistances(query_data, others, count, distances);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+            distances[i] = querydistfunc_(query_data, others[i], dist_func_param_);
+    }
+
+    // Distances from several encoded queries to one stored vector
+    inline void distancesToQueries(const void *data_point, const void *const *queries, size_t count, dist_t *distances) const {
+        if (!query_size_) {
+            batchDistances(data_point, queries, count, distances);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+            distances[i] = querydistfunc_(queries[i], data_point, dist_func_param_);
+    }
+
+    // Replaces the distances to the codes of the candidates by the exact distances to their full precision vectors
+    void rerankCandidates(
+        const void *query_vector,
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>& candidates) const {
+        std::vector<std::pair<dist_t, tableint>> exact;
+        exact.reserve(candidates.size());
+        while (!candidates.empty()) {
+            tableint id = candidates.top().second;
+            exact.emplace_back(exact_distfunc_(query_vector, exact_vectors_->at(id), exact_dist_func_param_), id);
+            candidates.pop();
+        }
+        candidates = std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>(
+            CompareByFirst(), std::move(exact));
+    }
+
+    // Exact search over the elements passing the filter, scanning the posting lists of its driving tags when it has them
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchBruteForce(const void *query_data, size_t k, const TagFilter& tag_filter, BaseFilterFunctor* isIdAllowed) const {
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+        bool check_deleted = num_deleted_ > 0;
+        bool single_test = tag_filter.program.size() == 1;
+
+        auto consider = [&](tableint id) {
+            if (id >= cur_element_count || (check_deleted && isMarkedDeleted(id)) ||
+                (isIdAllowed && !(*isIdAllowed)(getExternalLabel(id))) || (!single_test && !tag_filter.matches(id))) {
+                return;
+            }
+
+            dist_t dist = querydistfunc_(query_data, getDataByInternalId(id), dist_func_param_);
+            if (top_candidates.size() < k) {
+                top_candidates.emplace(dist, id);
+            } else if (dist < top_candidates.top().first) {
+                top_candidates.pop();
+                top_candidates.emplace(dist, id);
+            }
+        };
+
+        std::vector<tag_type> driving_tags;
+        if (single_test) {
+            tag_filter.bitmaps[0].forEach(consider);
+        } else if (tag_filter.program.drivingTags(driving_tags)) {
+            tag_index.postingUnion(driving_tags).forEach(consider);
+        } else {
+            for (tableint id = 0; id < cur_element_count; id++) {
+                consider(id);
+            }
+        }
+
+        return top_candidates;
+    }
+
+    // Runs a query with the plan chosen by the query planner and reports the decision in stats
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithStats(
+        const void *query_data,
+        size_t k,
+        const std::vector<std::string>& tags,
+        QueryStats& stats,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (tags.empty()) {
+            return searchKnnWithStats(query_data, k, nullptr, stats, isIdAllowed);
+        }
+        TagFilter filter = compileTagFilter(TagExpression::anyOf(tags));
+        return searchKnnWithStats(query_data, k, &filter, stats, isIdAllowed);
+    }
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithStats(
+        const void *query_data,
+        size_t k,
+        const TagExpression& filter_expression,
+        QueryStats& stats,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        TagFilter filter = compileTagFilter(filter_expression);
+        return searchKnnWithStats(query_data, k, &filter, stats, isIdAllowed);
+    }
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithStats(
+        const void *query_data,
+        size_t k,
+        const TagFilter* tag_filter,
+        QueryStats& stats,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        size_t ef = std::max(ef_, k);
+        std::vector<char> code;
+        const void *query_vector = query_data;
+        query_data = encodeQuery(query_data, code);
+
+        if (!tag_filter) {
+            stats = QueryStats();
+            stats.estimated_matches = cur_element_count;
+            stats.ef = ef;
+        } else {
+            query_planner_.plan(estimateMatches(*tag_filter), cur_element_count, ef, maxM0_, stats);
+        }
+
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
-        if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), tags, isIdAllowed);
+
+        if (tag_filter && stats.plan == QueryPlan::BruteForce) {
+            top_candidates = searchBruteForce(query_data, exact_vectors_ ? ef : k, *tag_filter, isIdAllowed);
+        } else if (tag_filter && stats.plan == QueryPlan::PostFilter) {
+            tableint currObj = searchUpperLayers(query_data, enterpoint_node_, maxlevel_, nullptr);
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+            if (bare_bone_search) {
+                candidates = searchBaseLayerST<true>(currObj, query_data, stats.ef, nullptr, isIdAllowed);
+            } else {
+                candidates = searchBaseLayerST<false>(currObj, query_data, stats.ef, nullptr, isIdAllowed);
+            }
+
+            while (!candidates.empty()) {
+                if (passesTagFilter(candidates.top().second, tag_filter)) {
+                    top_candidates.push(candidates.top());
+                }
+                candidates.pop();
+            }
         } else {
-            top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), tags, isIdAllowed);
+            // Descends from the seeds of the filter's driving tags, and starts the base layer search from the level-0 seeds as well
+            std::vector<tag_type> driving_tags;
+            std::vector<std::vector<tableint>> level_seeds;
+            if (tag_filter && tag_filter->program.drivingTags(driving_tags)) {
+                level_seeds = collectTagSeeds(tag_index.names(driving_tags));
+            }
+            std::vector<tableint> seeds;
+
+            if (level_seeds.empty()) {
+                seeds.push_back(searchUpperLayers(query_data, enterpoint_node_, maxlevel_, tag_filter));
+            } else {
+                int startLevel = level_seeds.size() - 1;
+                seeds = level_seeds[0];
+                seeds.push_back(searchUpperLayers(query_data, level_seeds[startLevel][0], startLevel, tag_filter, &level_seeds));
+            }
+
+            if (stats.plan == QueryPlan::TwoHopGraph && bare_bone_search) {
+                top_candidates = searchBaseLayerTwoHop<true>(seeds, query_data, ef, tag_filter, isIdAllowed);
+            } else if (stats.plan == QueryPlan::TwoHopGraph) {
+                top_candidates = searchBaseLayerTwoHop<false>(seeds, query_data, ef, tag_filter, isIdAllowed);
+            } else if (bare_bone_search) {
+                top_candidates = searchBaseLayerST<true>(
+                        seeds, query_data, ef, tag_filter, isIdAllowed);
+            } else {
+                top_candidates = searchBaseLayerST<false>(
+                        seeds, query_data, ef, tag_filter, isIdAllowed);
+            }
         }
 
+        if (exact_vectors_)
+            rerankCandidates(query_vector, top_candidates);
         while (top_candidates.size() > k) {
             top_candidates.pop();
         }
@@ -1588,47 +2797,431 @@ public:
     }
 
 
-    std::vector<std::pair<dist_t, labeltype >>
-    searchStopConditionClosest(
-        const void *query_data,
-        BaseSearchStopCondition<dist_t>& stop_condition,
-        const std::vector<std::string>& tags = {},
+    // Runs a batch of queries together, with one filter expression per query, or none for all queries if filters is empty
+    std::vector<std::priority_queue<std::pair<dist_t, labeltype >>>
+    searchKnnBatch(
+        const std::vector<const void*>& queries,
+        size_t k,
+        const std::vector<TagExpression>& filters = {},
         BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::vector<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+        if (!filters.empty() && filters.size() != queries.size())
+            throw std::runtime_error("The number of filters does not match the number of queries");
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        std::vector<TagFilter> compiled;
+        compiled.reserve(filters.size());
+        std::vector<const TagFilter*> tag_filters;
+        for (const TagExpression& filter : filters) {
+            compiled.push_back(compileTagFilter(filter));
+            tag_filters.push_back(&compiled.back());
+        }
+        return searchKnnBatch(queries, k, tag_filters, isIdAllowed);
+    }
 
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
+    // An empty tag list leaves its query unfiltered
+    std::vector<std::priority_queue<std::pair<dist_t, labeltype >>>
+    searchKnnBatch(
+        const std::vector<const void*>& queries,
+        size_t k,
+        const std::vector<std::vector<std::string>>& tags,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (tags.size() != queries.size())
+            throw std::runtime_error("The number of tag lists does not match the number of queries");
+
+        std::vector<TagFilter> compiled;
+        compiled.reserve(tags.size());
+        std::vector<const TagFilter*> tag_filters;
+        for (const std::vector<std::string>& query_tags : tags) {
+            if (query_tags.empty()) {
+                tag_filters.push_back(nullptr);
+            } else {
+                compiled.push_back(compileTagFilter(TagExpression::anyOf(query_tags)));
+                tag_filters.push_back(&compiled.back());
+            }
+        }
+        return searchKnnBatch(queries, k, tag_filters, isIdAllowed);
+    }
 
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+    // Queries planned as graph searches share the work of their traversals: the upper layer descent loads the links of a
+    // node once for all queries standing on it, and the base layer search expands the closest candidate of every query
+    // in rounds, computing the distances from each newly reached node to all queries reaching it with one kernel call.
+    // Brute force and two-hop queries run one at a time
+    std::vector<std::priority_queue<std::pair<dist_t, labeltype >>>
+    searchKnnBatch(
+        const std::vector<const void*>& queries,
+        size_t k,
+        const std::vector<const TagFilter*>& tag_filters,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        typedef std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_queue;
 
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+        std::vector<std::priority_queue<std::pair<dist_t, labeltype >>> results(queries.size());
+        if (cur_element_count == 0) return results;
 
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
+        size_t ef = std::max(ef_, k);
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+
+        struct BatchQuery {
+            size_t index;
+            const void *data;
+            const void *vector;            // Query as given, data holds its code when the space stores codes
+            std::vector<char> code;
+            const TagFilter *filter;       // Filter applied during the search
+            const TagFilter *post_filter;  // Filter applied to the results of a post-filtered query
+            size_t ef;
+            std::vector<std::vector<tableint>> level_seeds;
+            int level;
+            tableint node;
+            dist_t dist;
+            candidate_queue top_candidates;
+            candidate_queue candidate_set;
+            dist_t lowerBound;
+        };
+        std::vector<BatchQuery> batch;
+        batch.reserve(queries.size());
+
+        for (size_t q = 0; q < queries.size(); q++) {
+            const TagFilter *tag_filter = tag_filters.empty() ? nullptr : tag_filters[q];
+            QueryStats stats;
+            if (tag_filter) {
+                query_planner_.plan(estimateMatches(*tag_filter), cur_element_count, ef, maxM0_, stats);
+                if (stats.plan == QueryPlan::BruteForce || stats.plan == QueryPlan::TwoHopGraph) {
+                    results[q] = searchKnnWithStats(queries[q], k, tag_filter, stats, isIdAllowed);
+                    continue;
+                }
+            }
+
+            BatchQuery query;
+            query.index = q;
+            query.vector = queries[q];
+            query.data = encodeQuery(queries[q], query.code);
+            if (tag_filter && stats.plan == QueryPlan::PostFilter) {
+                query.filter = nullptr;
+                query.post_filter = tag_filter;
+                query.ef = stats.ef;
+            } else {
+                query.filter = tag_filter;
+                query.post_filter = nullptr;
+                query.ef = ef;
+                std::vector<tag_type> driving_tags;
+                if (tag_filter && tag_filter->program.drivingTags(driving_tags)) {
+                    query.level_seeds = collectTagSeeds(tag_index.names(driving_tags));
+                }
+            }
+            query.level = query.level_seeds.empty() ? maxlevel_ : query.level_seeds.size() - 1;
+            query.node = query.level_seeds.empty() ? enterpoint_node_ : query.level_seeds[query.level][0];
+            query.dist = querydistfunc_(query.data, getDataByInternalId(query.node), dist_func_param_);
+            batch.push_back(std::move(query));
+        }
+        if (batch.empty()) return results;
+
+        std::vector<const void*> query_data;
+        std::vector<dist_t> distances;
+
+        int top_level = 0;
+        for (const BatchQuery& query : batch)
+            top_level = std::max(top_level, query.level);
+
+        std::vector<BatchQuery*> moving;
+        std::vector<char> moved;
+        for (int level = top_level; level > 0; level--) {
+            moving.clear();
+            for (BatchQuery& query : batch) {
+                if (query.level < level)
+                    continue;
+                if (!query.level_seeds.empty()) {
+                    for (tableint seed : query.level_seeds[level]) {
+                        dist_t d = querydistfunc_(query.data, getDataByInternalId(seed), dist_func_param_);
+                        if (d < query.dist) {
+                            query.node = seed;
+                            query.dist = d;
+                        }
+                    }
+                    metric_distance_computations += query.level_seeds[level].size();
+                }
+                moving.push_back(&query);
+            }
+
+            // Greedy steps of all queries still moving on this level, grouped by the node they stand on
+            while (!moving.empty()) {
+                std::sort(moving.begin(), moving.end(), [](const BatchQuery *a, const BatchQuery *b) { return a->node < b->node; });
+                size_t still_moving = 0;
+                size_t end;
+                for (size_t begin = 0; begin < moving.size(); begin = end) {
+                    tableint node = moving[begin]->node;
+                    for (end = begin + 1; end < moving.size() && moving[end]->node == node; end++) {}
+
+                    query_data.clear();
+                    for (size_t i = begin; i < end; i++)
+                        query_data.push_back(moving[i]->data);
+                    distances.resize(query_data.size());
+                    moved.assign(query_data.size(), false);
+
+                    linklistsizeint *data = get_linklist(node, level);
+                    int size = getListCount(data);
+                    metric_hops += query_data.size();
+                    metric_distance_computations += size * query_data.size();
+
+                    tableint *datal = (tableint *) (data + 1);
+                    for (int j = 0; j < size; j++) {
+                        tableint cand = datal[j];
+                        if (cand < 0 || cand > max_elements_)
+                            throw std::runtime_error("cand error");
+                        distancesToQueries(getDataByInternalId(cand), query_data.data(), query_data.size(), distances.data());
+
+                        for (size_t i = 0; i < query_data.size(); i++) {
+                            BatchQuery &query = *moving[begin + i];
+                            if (distances[i] < query.dist && passesTagFilter(cand, query.filter)) {
+                                query.node = cand;
+                                query.dist = distances[i];
+                                moved[i] = true;
+                            }
+                        }
+                    }
+
+                    for (size_t i = 0; i < query_data.size(); i++) {
+                        if (moved[i])
+                            moving[still_moving++] = moving[begin + i];
+                    }
+                }
+                moving.resize(still_moving);
+            }
+        }
+
+        auto consider = [&](BatchQuery& query, tableint candidate_id, dist_t dist) {
+            if (query.top_candidates.size() < query.ef || query.lowerBound > dist) {
+                query.candidate_set.emplace(-dist, candidate_id);
+#ifdef USE_SSE
+                _mm_prefetch((char *) get_linklist0(query.candidate_set.top().second), _MM_HINT_T0);
+#endif
+
+                if ((bare_bone_search ||
+                    (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) &&
+                    passesTagFilter(candidate_id, query.filter)) {
+                    query.top_candidates.emplace(dist, candidate_id);
+                    if (query.top_candidates.size() > query.ef)
+                        query.top_candidates.pop();
+                    query.lowerBound = query.top_candidates.top().first;
+                }
+            }
+        };
+
+        // The base layer searches run in groups small enough for their visited lists and candidate queues to stay in
+        // cache, with queries ending the descent on the same node in the same group. The groups reuse the visited lists
+        std::sort(batch.begin(), batch.end(), [](const BatchQuery& a, const BatchQuery& b) { return a.node < b.node; });
+        size_t group_size = std::min(batch.size(), BATCH_GROUP_SIZE);
+        std::vector<VisitedList*> visited_lists = visited_list_pool_->getFreeVisitedLists(group_size);
+
+        std::vector<size_t> active;
+        std::vector<std::pair<tableint, size_t>> expanding;  // Expanded node and the query expanding it
+        std::vector<size_t> reaching;                        // Queries reaching a neighbor of the expanded node first
+
+        for (size_t group = 0; group < batch.size(); group += group_size) {
+            size_t group_end = std::min(batch.size(), group + group_size);
+            if (group > 0) {
+                for (VisitedList *vl : visited_lists)
+                    vl->reset();
+            }
+
+            active.clear();
+            for (size_t b = group; b < group_end; b++) {
+                BatchQuery& query = batch[b];
+                vl_type *visited_array = visited_lists[b - group]->mass;
+                vl_type visited_array_tag = visited_lists[b - group]->curV;
+                query.lowerBound = std::numeric_limits<dist_t>::max();
+
+                std::vector<tableint> seeds;
+                if (!query.level_seeds.empty())
+                    seeds = query.level_seeds[0];
+                seeds.push_back(query.node);
+                for (tableint ep_id : seeds) {
+                    if (visited_array[ep_id] == visited_array_tag)
+                        continue;
+                    visited_array[ep_id] = visited_array_tag;
+
+                    dist_t dist = ep_id == query.node ? query.dist : querydistfunc_(query.data, getDataByInternalId(ep_id), dist_func_param_);
+                    if ((bare_bone_search ||
+                        (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) &&
+                        passesTagFilter(ep_id, query.filter)) {
+                        query.top_candidates.emplace(dist, ep_id);
+                    }
+                    query.candidate_set.emplace(-dist, ep_id);
+                }
+                while (query.top_candidates.size() > query.ef)
+                    query.top_candidates.pop();
+                if (!query.top_candidates.empty())
+                    query.lowerBound = query.top_candidates.top().first;
+                active.push_back(b);
+            }
+
+            // Each round expands the closest candidate of every active query. Queries expanding the same node reach its
+            // unvisited neighbors together, and the distances from each neighbor to all of them come from one kernel call
+            while (!active.empty()) {
+                expanding.clear();
+                for (size_t b : active) {
+                    BatchQuery& query = batch[b];
+                    if (query.candidate_set.empty())
+                        continue;
+
+                    std::pair<dist_t, tableint> current_node_pair = query.candidate_set.top();
+                    dist_t candidate_dist = -current_node_pair.first;
+                    if (candidate_dist > query.lowerBound && (bare_bone_search || query.top_candidates.size() == query.ef))
+                        continue;
+                    query.candidate_set.pop();
+                    expanding.emplace_back(current_node_pair.second, b);
+                }
+                std::sort(expanding.begin(), expanding.end());
+                active.clear();
+
+                size_t end;
+                for (size_t begin = 0; begin < expanding.size(); begin = end) {
+                    tableint current_node_id = expanding[begin].first;
+                    for (end = begin + 1; end < expanding.size() && expanding[end].first == current_node_id; end++) {}
+
+                    int *data = (int *) get_linklist0(current_node_id);
+                    size_t size = getListCount((linklistsizeint*)data);
+#ifdef USE_SSE
+                    _mm_prefetch(getDataByInternalId(*(data + 1)), _MM_HINT_T0);
+#endif
+                    if (end - begin == 1) {
+                        BatchQuery& query = batch[expanding[begin].second];
+                        VisitedList *vl = visited_lists[expanding[begin].second - group];
+                        for (size_t j = 1; j <= size; j++) {
+                            tableint candidate_id = *(data + j);
+#ifdef USE_SSE
+                            _mm_prefetch((char *) (vl->mass + *(data + j + 1)), _MM_HINT_T0);
+                            _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);
+#endif
+                            if (vl->mass[candidate_id] == vl->curV)
+                                continue;
+                            vl->mass[candidate_id] = vl->curV;
+                            consider(query, candidate_id, querydistfunc_(query.data, getDataByInternalId(candidate_id), dist_func_param_));
+                        }
                     }
+
+                    for (size_t j = 1; j <= size && end - begin > 1; j++) {
+                        tableint candidate_id = *(data + j);
+#ifdef USE_SSE
+                        _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);
+#endif
+                        reaching.clear();
+                        query_data.clear();
+                        for (size_t e = begin; e < end; e++) {
+                            size_t b = expanding[e].second;
+                            VisitedList *vl = visited_lists[b - group];
+#ifdef USE_SSE
+                            _mm_prefetch((char *) (vl->mass + *(data + j + 1)), _MM_HINT_T0);
+#endif
+                            if (vl->mass[candidate_id] == vl->curV)
+                                continue;
+                            vl->mass[candidate_id] = vl->curV;
+                            reaching.push_back(b);
+                            query_data.push_back(batch[b].data);
+                        }
+
+                        if (reaching.size() == 1) {
+                            BatchQuery& query = batch[reaching[0]];
+                            consider(query, candidate_id, querydistfunc_(query.data, getDataByInternalId(candidate_id), dist_func_param_));
+                        } else if (!reaching.empty()) {
+                            distances.resize(reaching.size());
+                            distancesToQueries(getDataByInternalId(candidate_id), query_data.data(), query_data.size(), distances.data());
+                            for (size_t r = 0; r < reaching.size(); r++)
+                                consider(batch[reaching[r]], candidate_id, distances[r]);
+                        }
+                    }
+
+                    for (size_t e = begin; e < end; e++) {
+                        size_t b = expanding[e].second;
+                        BatchQuery& query = batch[b];
+                        active.push_back(b);
+                        if (!tag_link_lists_ || !query.filter || query.filter->link_tags.empty())
+                            continue;
+
+                        VisitedList *vl = visited_lists[b - group];
+                        for (size_t i = 0; i < tag_link_lists_; i++) {
+                            tag_type *tag_links = getTagLinkList(current_node_id, i);
+                            if (!*tag_links)
+                                break;
+                            if (std::find(query.filter->link_tags.begin(), query.filter->link_tags.end(), *tag_links) == query.filter->link_tags.end())
+                                continue;
+
+                            linklistsizeint *links = (linklistsizeint *) (tag_links + 1);
+                            size_t links_size = getListCount(links);
+                            for (size_t l = 1; l <= links_size; l++) {
+                                if (vl->mass[links[l]] == vl->curV)
+                                    continue;
+                                vl->mass[links[l]] = vl->curV;
+                                consider(query, links[l], querydistfunc_(query.data, getDataByInternalId(links[l]), dist_func_param_));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        visited_list_pool_->releaseVisitedLists(visited_lists);
+
+        for (BatchQuery& query : batch) {
+            candidate_queue top_candidates;
+            if (query.post_filter) {
+                while (!query.top_candidates.empty()) {
+                    if (passesTagFilter(query.top_candidates.top().second, query.post_filter))
+                        top_candidates.push(query.top_candidates.top());
+                    query.top_candidates.pop();
                 }
+            } else {
+                top_candidates.swap(query.top_candidates);
+            }
+
+            if (exact_vectors_)
+                rerankCandidates(query.vector, top_candidates);
+            while (top_candidates.size() > k)
+                top_candidates.pop();
+            std::priority_queue<std::pair<dist_t, labeltype >>& result = results[query.index];
+            while (!top_candidates.empty()) {
+                result.emplace(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
+                top_candidates.pop();
             }
         }
+        return results;
+    }
+
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        BaseSearchStopCondition<dist_t>& stop_condition,
+        const std::vector<std::string>& tags = {},
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (tags.empty()) {
+            return searchStopConditionClosest(query_data, stop_condition, nullptr, isIdAllowed);
+        }
+        TagFilter filter = compileTagFilter(TagExpression::anyOf(tags));
+        return searchStopConditionClosest(query_data, stop_condition, &filter, isIdAllowed);
+    }
+
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        BaseSearchStopCondition<dist_t>& stop_condition,
+        const TagExpression& filter_expression,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        TagFilter filter = compileTagFilter(filter_expression);
+        return searchStopConditionClosest(query_data, stop_condition, &filter, isIdAllowed);
+    }
+
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        BaseSearchStopCondition<dist_t>& stop_condition,
+        const TagFilter* tag_filter,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::vector<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::vector<char> code;
+        query_data = encodeQuery(query_data, code);
+        tableint currObj = searchUpperLayers(query_data, enterpoint_node_, maxlevel_, nullptr);
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, tags, isIdAllowed, &stop_condition);
+        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, tag_filter, isIdAllowed, &stop_condition);
 
         size_t sz = top_candidates.size();
         result.resize(sz);
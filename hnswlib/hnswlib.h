@@ -170,6 +170,10 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one vector to count others, written to the output array
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *, const void *const *, size_t, const void *, MTYPE *);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -178,8 +182,35 @@ class SpaceInterface {
 
     virtual DISTFUNC<MTYPE> get_dist_func() = 0;
 
+    // Optional kernel computing several distances from one vector at once, nullptr when the space has none
+    virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() {
+        return nullptr;
+    }
+
     virtual void *get_dist_func_param() = 0;
 
+    // Spaces storing compressed codes return the space of the full precision vectors they encode, others nullptr
+    virtual SpaceInterface<MTYPE> *get_exact_space() {
+        return nullptr;
+    }
+
+    // Encodes a full precision vector into the stored form, for spaces storing compressed codes
+    virtual void encode(const void *vector, void *code) {}
+
+    // Spaces searching with a lookup table per query return the size of an encoded query, others 0 when queries are
+    // encoded like the stored vectors
+    virtual size_t get_query_size() {
+        return 0;
+    }
+
+    // Encodes a full precision query for get_query_dist_func(), once per search
+    virtual void encode_query(const void *vector, void *query) {}
+
+    // Distance from an encoded query to a stored vector, for spaces with a query size
+    virtual DISTFUNC<MTYPE> get_query_dist_func() {
+        return nullptr;
+    }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -223,6 +254,8 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_quantized.h"
+#include "space_pq.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
@@ -0,0 +1,521 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib
+{
+    // Kind of index a file holds, checked on load
+    enum class IndexKind : uint32_t
+    {
+        HierarchicalNSW = 1,
+        Postfilter = 2,
+        MultiIndex = 3
+    };
+
+    // Sections of an index file, each starting at a multiple of INDEX_FILE_ALIGNMENT so that it can be mapped in place
+    // Files holding several graphs number the sections of each graph with a part
+    enum class IndexSection : uint32_t
+    {
+        Parameters = 1,
+        Level0 = 2,
+        ElementLevels = 3,
+        UpperLinks = 4,
+        TagEntryPoints = 5,
+        TagOffsets = 6,
+        NodeTags = 7,
+        TagDictionary = 8,
+        IndexTags = 9
+    };
+
+    static constexpr char INDEX_FILE_MAGIC[8] = {'H', 'N', 'S', 'W', 'T', 'A', 'G', 'S'};
+    static constexpr uint32_t INDEX_FILE_VERSION = 2;
+    static constexpr size_t INDEX_FILE_ALIGNMENT = 4096;
+    // Sections are read and checked in aligned chunks of this size, large enough for full disk throughput and small enough
+    // to be checked while still in cache
+    static constexpr size_t INDEX_FILE_READ_CHUNK = 4 << 20;
+
+    // The header is followed by the sections, and the section table comes last
+    struct IndexFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint64_t table_offset;
+        uint32_t sections;
+        uint32_t table_checksum;
+    };
+
+    struct IndexSectionEntry
+    {
+        uint32_t id;
+        uint32_t part;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    // Slicing-by-8 tables of the CRC-32C polynomial, for compilers not targeting SSE 4.2
+    struct Crc32cTables
+    {
+        uint32_t table[8][256];
+
+        Crc32cTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                for (int slice = 1; slice < 8; slice++)
+                    table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+            }
+        }
+    };
+
+    // CRC-32C of the bytes, continuing from the CRC of the bytes before them
+    inline uint32_t crc32c(uint32_t crc, const void* data, size_t size)
+    {
+        const unsigned char* bytes = (const unsigned char*) data;
+        crc = ~crc;
+#if defined(__SSE4_2__)
+        for (; size >= 8; size -= 8, bytes += 8)
+        {
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            crc = (uint32_t) _mm_crc32_u64(crc, word);
+        }
+        for (; size; size--)
+            crc = _mm_crc32_u8(crc, *bytes++);
+#else
+        static const Crc32cTables tables;
+        const uint32_t (*table)[256] = tables.table;
+        for (; size >= 8; size -= 8, bytes += 8)
+        {
+            uint32_t low, high;
+            memcpy(&low, bytes, sizeof(low));
+            memcpy(&high, bytes + 4, sizeof(high));
+            low ^= crc;
+            crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+                  table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+        }
+        for (; size; size--)
+            crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xff];
+#endif
+        return ~crc;
+    }
+
+    // A whole file mapped read-only, whose pages are read on first access and shared between the processes mapping it
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string& path)
+        {
+#ifdef _WIN32
+            throw std::runtime_error("Memory-mapped index files are not supported on this platform");
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open index file " + path);
+
+            struct stat file_stat;
+            if (fstat(fd, &file_stat) != 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("Cannot read the size of index file " + path);
+            }
+            size_ = (size_t) file_stat.st_size;
+
+            void* data = size_ ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+            ::close(fd);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("Cannot map index file " + path);
+            data_ = (const char*) data;
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+#ifndef _WIN32
+            if (data_)
+                munmap((void*) data_, size_);
+#endif
+        }
+
+        const char* data() const
+        {
+            return data_;
+        }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // Passes the bytes of a section on to the file, keeping their count and checksum
+    class ChecksumBuffer : public std::streambuf
+    {
+    public:
+        explicit ChecksumBuffer(std::streambuf* target)
+            : target_(target)
+        {}
+
+        void reset()
+        {
+            checksum_ = 0;
+            size_ = 0;
+        }
+
+        uint32_t checksum() const
+        {
+            return checksum_;
+        }
+
+        uint64_t size() const
+        {
+            return size_;
+        }
+
+    protected:
+        int overflow(int c) override
+        {
+            if (c == traits_type::eof())
+                return traits_type::not_eof(c);
+            char byte = (char) c;
+            return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+        }
+
+        std::streamsize xsputn(const char* data, std::streamsize count) override
+        {
+            std::streamsize written = target_->sputn(data, count);
+            checksum_ = crc32c(checksum_, data, (size_t) written);
+            size_ += (uint64_t) written;
+            return written;
+        }
+
+    private:
+        std::streambuf* target_;
+        uint32_t checksum_ = 0;
+        uint64_t size_ = 0;
+    };
+
+    // Reads a section from memory
+    class SectionBuffer : public std::streambuf
+    {
+    public:
+        void assign(std::vector<char>& data)
+        {
+            setg(data.data(), data.data(), data.data() + data.size());
+        }
+    };
+
+    // Writes the sections of an index file one after the other, and the section table and header on close()
+    class IndexFileWriter
+    {
+    public:
+        IndexFileWriter(const std::string& path, IndexKind kind)
+            : kind_(kind), output_(path, std::ios::binary), buffer_(output_.rdbuf()), stream_(&buffer_)
+        {
+            if (!output_.is_open())
+                throw std::runtime_error("Cannot open file " + path);
+            IndexFileHeader header = {};
+            output_.write((char*) &header, sizeof(header));
+        }
+
+        // Starts a section at the next aligned offset, its content is then written to the returned stream
+        std::ostream& beginSection(IndexSection id, uint32_t part = 0)
+        {
+            for (const IndexSectionEntry& entry : sections_)
+            {
+                if (entry.id == (uint32_t) id && entry.part == part)
+                    throw std::runtime_error("Index file section written twice");
+            }
+            pad();
+            sections_.push_back({(uint32_t) id, part, (uint64_t) output_.tellp(), 0, 0, 0});
+            buffer_.reset();
+            return stream_;
+        }
+
+        void endSection()
+        {
+            sections_.back().size = buffer_.size();
+            sections_.back().checksum = buffer_.checksum();
+        }
+
+        void close()
+        {
+            pad();
+            IndexFileHeader header = {};
+            memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+            header.version = INDEX_FILE_VERSION;
+            header.kind = (uint32_t) kind_;
+            header.table_offset = (uint64_t) output_.tellp();
+            header.sections = (uint32_t) sections_.size();
+            header.table_checksum = crc32c(0, sections_.data(), sections_.size() * sizeof(IndexSectionEntry));
+
+            output_.write((char*) sections_.data(), sections_.size() * sizeof(IndexSectionEntry));
+            output_.seekp(0, output_.beg);
+            output_.write((char*) &header, sizeof(header));
+            output_.close();
+            if (!output_ || !stream_)
+                throw std::runtime_error("Cannot write the index file");
+        }
+
+    private:
+        void pad()
+        {
+            size_t position = (size_t) output_.tellp();
+            std::vector<char> padding((INDEX_FILE_ALIGNMENT - position % INDEX_FILE_ALIGNMENT) % INDEX_FILE_ALIGNMENT, 0);
+            output_.write(padding.data(), padding.size());
+        }
+
+        IndexKind kind_;
+        std::ofstream output_;
+        ChecksumBuffer buffer_;
+        std::ostream stream_;
+        std::vector<IndexSectionEntry> sections_;
+    };
+
+    // Reads the sections of an index file, checking them against their checksums, either from the file or from a read-only
+    // mapping of the whole file
+    // read() can be called from several threads at once, to read sections concurrently, while open() and map() cannot
+    class IndexFileReader
+    {
+    public:
+        explicit IndexFileReader(const std::string& path)
+            : path_(path), input_(path, std::ios::binary), stream_(&buffer_)
+        {
+            if (!input_.is_open())
+                throw std::runtime_error("Cannot open file " + path);
+#ifndef _WIN32
+            fd_ = ::open(path.c_str(), O_RDONLY);
+            if (fd_ < 0)
+                throw std::runtime_error("Cannot open file " + path);
+#if defined(POSIX_FADV_SEQUENTIAL)
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+            if (!isIndexFile(input_))
+                throw std::runtime_error("Not an index file: " + path);
+
+            IndexFileHeader header;
+            input_.read((char*) &header, sizeof(header));
+            if (header.version != INDEX_FILE_VERSION)
+                throw std::runtime_error("Unsupported index file version " + std::to_string(header.version));
+            kind_ = (IndexKind) header.kind;
+
+            input_.seekg(0, input_.end);
+            uint64_t file_size = (uint64_t) input_.tellg();
+            if (header.table_offset > file_size || header.sections > (file_size - header.table_offset) / sizeof(IndexSectionEntry))
+                throw std::runtime_error("Index file seems to be corrupted or truncated");
+
+            sections_.resize(header.sections);
+            input_.seekg(header.table_offset, input_.beg);
+            input_.read((char*) sections_.data(), sections_.size() * sizeof(IndexSectionEntry));
+            if (!input_ || crc32c(0, sections_.data(), sections_.size() * sizeof(IndexSectionEntry)) != header.table_checksum)
+                throw std::runtime_error("Index file seems to be corrupted: bad section table checksum");
+            for (const IndexSectionEntry& entry : sections_)
+            {
+                if (entry.offset > file_size || entry.size > file_size - entry.offset)
+                    throw std::runtime_error("Index file seems to be corrupted or truncated");
+            }
+        }
+
+        IndexFileReader(const IndexFileReader&) = delete;
+        IndexFileReader& operator=(const IndexFileReader&) = delete;
+
+        ~IndexFileReader()
+        {
+#ifndef _WIN32
+            if (fd_ >= 0)
+                ::close(fd_);
+#endif
+        }
+
+        // Checks the magic at the current position of the stream, which is left where it was
+        static bool isIndexFile(std::istream& input)
+        {
+            char magic[sizeof(INDEX_FILE_MAGIC)] = {};
+            std::streampos position = input.tellg();
+            input.read(magic, sizeof(magic));
+            bool matches = input.gcount() == sizeof(magic) && memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic)) == 0;
+            input.clear();
+            input.seekg(position);
+            return matches;
+        }
+
+        static bool isIndexFile(const std::string& path)
+        {
+            std::ifstream input(path, std::ios::binary);
+            return input.is_open() && isIndexFile(input);
+        }
+
+        IndexKind kind() const
+        {
+            return kind_;
+        }
+
+        void expectKind(IndexKind kind) const
+        {
+            if (kind_ != kind)
+                throw std::runtime_error("Index file " + path_ + " holds another kind of index");
+        }
+
+        bool has(IndexSection id, uint32_t part = 0) const
+        {
+            return find(id, part) != nullptr;
+        }
+
+        uint64_t size(IndexSection id, uint32_t part = 0) const
+        {
+            return entry(id, part).size;
+        }
+
+        // Reads a section into memory, checks it, and returns a stream over it, valid until the next call
+        std::istream& open(IndexSection id, uint32_t part = 0)
+        {
+            const IndexSectionEntry& section = entry(id, part);
+            section_data_.resize(section.size);
+            readChecked(section, section_data_.data());
+            buffer_.assign(section_data_);
+            stream_.clear();
+            return stream_;
+        }
+
+        // Reads a section that must hold exactly size bytes
+        void read(IndexSection id, void* data, uint64_t size, uint32_t part = 0)
+        {
+            readChecked(sized(id, size, part), data);
+        }
+
+        // Maps the whole file on first use and returns the section in the mapping, which stays valid while mapping() is held
+        // The checksum is only verified on request, as it reads every page of the section
+        const char* map(IndexSection id, uint64_t size, uint32_t part = 0, bool verify = false)
+        {
+            const IndexSectionEntry& section = sized(id, size, part);
+            if (!mapping_)
+                mapping_ = std::make_shared<MappedFile>(path_);
+            const char* data = mapping_->data() + section.offset;
+            if (verify)
+                check(section, data);
+            return data;
+        }
+
+        std::shared_ptr<MappedFile> mapping() const
+        {
+            return mapping_;
+        }
+
+    private:
+        const IndexSectionEntry* find(IndexSection id, uint32_t part) const
+        {
+            for (const IndexSectionEntry& entry : sections_)
+            {
+                if (entry.id == (uint32_t) id && entry.part == part)
+                    return &entry;
+            }
+            return nullptr;
+        }
+
+        const IndexSectionEntry& entry(IndexSection id, uint32_t part) const
+        {
+            const IndexSectionEntry* entry = find(id, part);
+            if (!entry)
+                throw std::runtime_error("Index file has no section " + std::to_string((uint32_t) id) + " of part " + std::to_string(part));
+            return *entry;
+        }
+
+        const IndexSectionEntry& sized(IndexSection id, uint64_t size, uint32_t part) const
+        {
+            const IndexSectionEntry& section = entry(id, part);
+            if (section.size != size)
+                throw std::runtime_error("Index file section " + std::to_string((uint32_t) id) + " has an unexpected size");
+            return section;
+        }
+
+        // Reads the section chunk by chunk, checking each chunk right after reading it
+        void readChecked(const IndexSectionEntry& section, void* data)
+        {
+            char* output = (char*) data;
+            uint32_t checksum = 0;
+            for (uint64_t done = 0; done < section.size;)
+            {
+                size_t chunk = (size_t) std::min<uint64_t>(INDEX_FILE_READ_CHUNK, section.size - done);
+                readAt(section.offset + done, output + done, chunk);
+                checksum = crc32c(checksum, output + done, chunk);
+                done += chunk;
+            }
+            if (checksum != section.checksum)
+                throw std::runtime_error("Index file seems to be corrupted: bad checksum of section " + std::to_string(section.id));
+        }
+
+        void readAt(uint64_t offset, char* data, size_t size)
+        {
+#ifdef _WIN32
+            std::unique_lock<std::mutex> lock(input_lock_);
+            input_.clear();
+            input_.seekg(offset, input_.beg);
+            input_.read(data, size);
+            if (!input_)
+                throw std::runtime_error("Cannot read the index file");
+#else
+            while (size > 0)
+            {
+                ssize_t count = pread(fd_, data, size, (off_t) offset);
+                if (count <= 0)
+                    throw std::runtime_error("Cannot read the index file");
+                data += count;
+                offset += (uint64_t) count;
+                size -= (size_t) count;
+            }
+#endif
+        }
+
+        void check(const IndexSectionEntry& section, const void* data) const
+        {
+            if (crc32c(0, data, section.size) != section.checksum)
+                throw std::runtime_error("Index file seems to be corrupted: bad checksum of section " + std::to_string(section.id));
+        }
+
+        std::string path_;
+        std::ifstream input_;
+#ifdef _WIN32
+        std::mutex input_lock_;
+#else
+        int fd_ = -1;
+#endif
+        IndexKind kind_;
+        std::vector<IndexSectionEntry> sections_;
+        std::shared_ptr<MappedFile> mapping_;
+        std::vector<char> section_data_;
+        SectionBuffer buffer_;
+        std::istream stream_;
+    };
+}
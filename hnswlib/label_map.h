@@ -0,0 +1,365 @@
+#pragma once
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace hnswlib
+{
+    // Maps the labels of elements to their internal IDs of type T, from any number of threads at once
+    // Labels below the dense limit, usually the capacity of the index, are looked up in an array of IDs, which takes 4 bytes
+    // per possible label; other labels go to open-addressing tables of cache-line groups, split into shards with a lock
+    // each, which take about 18 bytes per label
+    template<typename T>
+    class LabelMap
+    {
+    public:
+        LabelMap()
+            : shards_(SHARDS)
+        {}
+
+        LabelMap(const LabelMap&) = delete;
+        LabelMap& operator=(const LabelMap&) = delete;
+
+        // Makes labels below limit dense, moving the ones stored in the shards; cannot run concurrently with other calls
+        void resize(size_t limit)
+        {
+            if (limit <= denseLimit_)
+                return;
+
+            std::unique_ptr<std::atomic<T>[]> dense(new std::atomic<T>[limit]);
+            for (size_t label = 0; label < limit; label++)
+                dense[label].store(label < denseLimit_ ? dense_[label].load(std::memory_order_relaxed) : EMPTY, std::memory_order_relaxed);
+            dense_.swap(dense);
+            denseLimit_ = limit;
+
+            for (Shard& shard : shards_)
+            {
+                std::vector<Group> groups;
+                groups.swap(shard.groups);
+                shard.used = 0;
+                shard.filled = 0;
+                for (const Group& group : groups)
+                {
+                    for (size_t j = 0; j < GROUP_SLOTS; j++)
+                    {
+                        if (group.values[j] != EMPTY && group.values[j] != TOMBSTONE)
+                            set(group.keys[j], group.values[j]);
+                    }
+                }
+            }
+        }
+
+        // Makes room in the shards for count labels at or above the dense limit
+        void reserve(size_t count)
+        {
+            for (Shard& shard : shards_)
+            {
+                std::unique_lock<std::mutex> lock(shard.lock);
+                rehash(shard, std::max(shard.used, count / SHARDS + count / SHARDS / 8 + 1));
+            }
+        }
+
+        void clear()
+        {
+            dense_.reset();
+            denseLimit_ = 0;
+            for (Shard& shard : shards_)
+            {
+                std::vector<Group>().swap(shard.groups);
+                shard.used = 0;
+                shard.filled = 0;
+                shard.denseCount = 0;
+            }
+        }
+
+        // Replaces the contents by labels[id] -> id for the count elements, on numThreads threads (0 uses all hardware
+        // threads); the labels must be unique
+        void rebuild(const size_t* labels, size_t count, size_t numThreads = 0)
+        {
+            size_t limit = denseLimit_;
+            clear();
+            resize(limit);
+
+            size_t sparse = 0;
+            for (size_t id = 0; id < count; id++)
+                sparse += labels[id] >= denseLimit_;
+            reserve(sparse);
+
+            const size_t block = 65536;
+            ParallelFor(0, (count + block - 1) / block, numThreads, [&](size_t b, size_t threadId)
+            {
+                std::vector<size_t> denseCounts(SHARDS, 0);
+                for (size_t id = b * block; id < std::min(count, (b + 1) * block); id++)
+                {
+                    if (labels[id] < denseLimit_)
+                    {
+                        dense_[labels[id]].store((T) id, std::memory_order_relaxed);
+                        denseCounts[shardOf(labels[id])]++;
+                    }
+
+                    else
+                    {
+                        set(labels[id], (T) id);
+                    }
+                }
+
+                for (size_t s = 0; s < SHARDS; s++)
+                    shards_[s].denseCount += denseCounts[s];
+            });
+        }
+
+        // Maps the label to the ID, replacing any ID it had
+        void set(size_t label, T id)
+        {
+            if (label < denseLimit_)
+            {
+                if (dense_[label].exchange(id, std::memory_order_acq_rel) == EMPTY)
+                    shards_[shardOf(label)].denseCount++;
+                return;
+            }
+
+            Shard& shard = shards_[shardOf(label)];
+            std::unique_lock<std::mutex> lock(shard.lock);
+            if ((shard.filled + 1) * 8 > shard.groups.size() * GROUP_SLOTS * 7)
+                rehash(shard, shard.used + 1);
+
+            size_t mask = shard.groups.size() - 1;
+            T* free = nullptr;
+            size_t* freeKey = nullptr;
+            for (size_t g = hash(label) & mask;; g = (g + 1) & mask)
+            {
+                Group& group = shard.groups[g];
+                for (size_t j = 0; j < GROUP_SLOTS; j++)
+                {
+                    T value = group.values[j];
+                    if (value == EMPTY)
+                    {
+                        if (!free)
+                        {
+                            free = &group.values[j];
+                            freeKey = &group.keys[j];
+                            shard.filled++;
+                        }
+                        *freeKey = label;
+                        *free = id;
+                        shard.used++;
+                        return;
+                    }
+
+                    if (value == TOMBSTONE)
+                    {
+                        if (!free)
+                        {
+                            free = &group.values[j];
+                            freeKey = &group.keys[j];
+                        }
+                    }
+
+                    else if (group.keys[j] == label)
+                    {
+                        group.values[j] = id;
+                        return;
+                    }
+                }
+            }
+        }
+
+        // Looks up the ID of the label, returning whether it has one
+        bool find(size_t label, T& id) const
+        {
+            if (label < denseLimit_)
+            {
+                id = dense_[label].load(std::memory_order_acquire);
+                return id != EMPTY;
+            }
+
+            const Shard& shard = shards_[shardOf(label)];
+            std::unique_lock<std::mutex> lock(shard.lock);
+            const T* value = locate(shard, label);
+            if (!value)
+                return false;
+            id = *value;
+            return true;
+        }
+
+        bool contains(size_t label) const
+        {
+            T id;
+            return find(label, id);
+        }
+
+        T at(size_t label) const
+        {
+            T id;
+            if (!find(label, id))
+                throw std::out_of_range("Label not found");
+            return id;
+        }
+
+        // Removes the label, returning whether it had an ID
+        bool erase(size_t label)
+        {
+            if (label < denseLimit_)
+            {
+                if (dense_[label].exchange(EMPTY, std::memory_order_acq_rel) == EMPTY)
+                    return false;
+                shards_[shardOf(label)].denseCount--;
+                return true;
+            }
+
+            Shard& shard = shards_[shardOf(label)];
+            std::unique_lock<std::mutex> lock(shard.lock);
+            T* value = const_cast<T*>(locate(shard, label));
+            if (!value)
+                return false;
+            *value = TOMBSTONE;
+            shard.used--;
+            return true;
+        }
+
+        size_t size() const
+        {
+            size_t count = 0;
+            for (const Shard& shard : shards_)
+            {
+                std::unique_lock<std::mutex> lock(shard.lock);
+                count += shard.used + shard.denseCount;
+            }
+            return count;
+        }
+
+        // Calls fn(label, id) for every label, in no particular order
+        template<typename Function>
+        void forEach(Function fn) const
+        {
+            for (size_t label = 0; label < denseLimit_; label++)
+            {
+                T id = dense_[label].load(std::memory_order_acquire);
+                if (id != EMPTY)
+                    fn((size_t) label, id);
+            }
+
+            for (const Shard& shard : shards_)
+            {
+                std::unique_lock<std::mutex> lock(shard.lock);
+                for (const Group& group : shard.groups)
+                {
+                    for (size_t j = 0; j < GROUP_SLOTS; j++)
+                    {
+                        if (group.values[j] != EMPTY && group.values[j] != TOMBSTONE)
+                            fn(group.keys[j], group.values[j]);
+                    }
+                }
+            }
+        }
+
+        size_t memoryUsage() const
+        {
+            size_t bytes = denseLimit_ * sizeof(T) + shards_.size() * sizeof(Shard);
+            for (const Shard& shard : shards_)
+                bytes += shard.groups.size() * sizeof(Group);
+            return bytes;
+        }
+
+    private:
+        static constexpr size_t SHARDS = 64;
+        static constexpr size_t GROUP_SLOTS = 5;
+        static constexpr T EMPTY = (T) -1;
+        static constexpr T TOMBSTONE = (T) -2;
+
+        // The keys and values of a group fill one cache line, so that probing reads one line per group
+        struct alignas(64) Group
+        {
+            size_t keys[GROUP_SLOTS];
+            T values[GROUP_SLOTS];
+        };
+
+        struct alignas(64) Shard
+        {
+            mutable std::mutex lock;
+            std::vector<Group> groups;
+            size_t used = 0;    // labels
+            size_t filled = 0;  // labels and removed labels
+            std::atomic<size_t> denseCount{0};  // dense labels of this shard, counted here to spread the counter updates
+        };
+
+        static uint64_t hash(size_t label)
+        {
+            uint64_t x = (uint64_t) label;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        static size_t shardOf(size_t label)
+        {
+            return (size_t) (hash(label) >> 58);
+        }
+
+        const T* locate(const Shard& shard, size_t label) const
+        {
+            if (shard.groups.empty())
+                return nullptr;
+
+            size_t mask = shard.groups.size() - 1;
+            for (size_t g = (size_t) hash(label) & mask;; g = (g + 1) & mask)
+            {
+                const Group& group = shard.groups[g];
+                for (size_t j = 0; j < GROUP_SLOTS; j++)
+                {
+                    if (group.values[j] == EMPTY)
+                        return nullptr;
+                    if (group.values[j] != TOMBSTONE && group.keys[j] == label)
+                        return &group.values[j];
+                }
+            }
+        }
+
+        // Rebuilds the table of a locked shard with room for twice the given number of labels, dropping removed labels
+        void rehash(Shard& shard, size_t labels)
+        {
+            size_t groups = 1;
+            while (groups * GROUP_SLOTS < 2 * labels)
+                groups *= 2;
+            if (groups <= shard.groups.size() && shard.filled == shard.used)
+                return;
+
+            std::vector<Group> old(groups);
+            old.swap(shard.groups);
+            for (Group& group : shard.groups)
+                std::fill(group.values, group.values + GROUP_SLOTS, EMPTY);
+
+            size_t mask = groups - 1;
+            for (const Group& group : old)
+            {
+                for (size_t j = 0; j < GROUP_SLOTS; j++)
+                {
+                    if (group.values[j] == EMPTY || group.values[j] == TOMBSTONE)
+                        continue;
+                    for (size_t g = (size_t) hash(group.keys[j]) & mask;; g = (g + 1) & mask)
+                    {
+                        T* end = shard.groups[g].values + GROUP_SLOTS;
+                        T* free = std::find(shard.groups[g].values, end, EMPTY);
+                        if (free != end)
+                        {
+                            shard.groups[g].keys[free - shard.groups[g].values] = group.keys[j];
+                            *free = group.values[j];
+                            break;
+                        }
+                    }
+                }
+            }
+            shard.filled = shard.used;
+        }
+
+        std::vector<Shard> shards_;
+        std::unique_ptr<std::atomic<T>[]> dense_;
+        size_t denseLimit_ = 0;
+    };
+}
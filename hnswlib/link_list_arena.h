@@ -0,0 +1,123 @@
+#pragma once
+
+#include "memory_policy.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Storage of the upper-level link lists of the elements. The lists of an element of level l are one block of l lists,
+// cut from slabs that only hold blocks of level l, so that the elements of a level lie together and no element has
+// an allocation of its own. Blocks left by elements moving up are reused by the next elements of their level.
+// The slabs are allocated with the memory policy of the index.
+//
+/////////////////////////////////////////////////////////
+
+class LinkListArena {
+    struct LevelSlabs {
+        char *next = nullptr;  // next unused block of the current slab
+        size_t left = 0;       // unused blocks in the current slab
+        std::vector<char *> free_blocks;
+    };
+
+    size_t list_size_{0};
+    std::vector<LevelSlabs> levels_;
+    std::vector<std::pair<char *, size_t>> slabs_;
+    size_t bytes_{0};
+    MemoryPolicy policy_;
+    std::mutex lock_;
+
+    char *newSlab(size_t size) {
+        char *slab = (char *) allocateMemory(size, policy_);
+        if (slab == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate link lists");
+        slabs_.emplace_back(slab, size);
+        bytes_ += size;
+        return slab;
+    }
+
+ public:
+    static constexpr size_t SLAB_SIZE = 1 << 20;
+
+    LinkListArena() = default;
+    LinkListArena(const LinkListArena &) = delete;
+    LinkListArena &operator=(const LinkListArena &) = delete;
+
+    ~LinkListArena() {
+        clear();
+    }
+
+    // Sets the memory policy of the slabs allocated from now on; the slabs already allocated keep theirs until clear()
+    void setMemoryPolicy(const MemoryPolicy &policy) {
+        clear();
+        policy_ = policy;
+    }
+
+    // Drops all blocks and sets the size of a single link list
+    void reset(size_t list_size) {
+        clear();
+        list_size_ = list_size;
+    }
+
+    // Returns a zeroed block for the link lists of an element of the level
+    char *allocate(int level) {
+        size_t block_size = list_size_ * level;
+        std::unique_lock <std::mutex> lock(lock_);
+        if (levels_.size() <= (size_t) level)
+            levels_.resize(level + 1);
+        LevelSlabs &slabs = levels_[level];
+
+        char *block;
+        if (!slabs.free_blocks.empty()) {
+            block = slabs.free_blocks.back();
+            slabs.free_blocks.pop_back();
+        } else {
+            if (slabs.left == 0) {
+                size_t blocks = std::max<size_t>(1, std::max(SLAB_SIZE, policy_.pageSize()) / block_size);
+                slabs.next = newSlab(blocks * block_size);
+                slabs.left = blocks;
+            }
+            block = slabs.next;
+            slabs.next += block_size;
+            slabs.left--;
+        }
+        lock.unlock();
+
+        memset(block, 0, block_size);
+        return block;
+    }
+
+    // Takes back the block of an element of the level, once the element has moved to another block
+    void release(char *block, int level) {
+        std::unique_lock <std::mutex> lock(lock_);
+        levels_[level].free_blocks.push_back(block);
+    }
+
+    // Returns one uninitialized slab of the given size, to be split into the blocks of many elements, such as the
+    // packed link lists read from an index file
+    char *allocateSlab(size_t size) {
+        std::unique_lock <std::mutex> lock(lock_);
+        return newSlab(size);
+    }
+
+    void clear() {
+        std::vector<LevelSlabs>().swap(levels_);
+        for (const auto &slab : slabs_)
+            freeMemory(slab.first, slab.second, policy_);
+        std::vector<std::pair<char *, size_t>>().swap(slabs_);
+        bytes_ = 0;
+    }
+
+    size_t memoryUsage() const {
+        return bytes_;
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+
+///////////////////////////////////////////////////////////
+//
+// Placement of the large blocks of an index, the level-0 records and the slabs of upper-level link lists. Graph
+// searches read these blocks at random, so with 4 KB pages most reads miss the TLB, and on machines with several
+// NUMA nodes a block allocated by one thread lies on a single node, remote to the threads of the other nodes.
+// The default policy takes the blocks from malloc; the others map them with mmap and place them with mbind, without
+// depending on libnuma, which makes them Linux only.
+//
+/////////////////////////////////////////////////////////
+
+enum class HugePages {
+    None,
+    Transparent,  // 2 MB aligned blocks advised to the kernel for transparent huge pages
+    Explicit      // blocks of reserved huge pages (vm.nr_hugepages), failing when too few are free
+};
+
+enum class NumaPlacement {
+    Default,     // pages go to the node of the thread first touching them
+    Interleave,  // pages are spread round-robin over all nodes, evening out the remote reads of all threads
+    Node         // pages go to the given node while it has free memory, for a replica of the index per node
+};
+
+struct MemoryPolicy {
+    HugePages huge_pages = HugePages::None;
+    NumaPlacement placement = NumaPlacement::Default;
+    int node = 0;  // node of NumaPlacement::Node
+
+    static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+    static constexpr size_t BASE_PAGE_SIZE = 4096;
+
+    bool isDefault() const {
+        return huge_pages == HugePages::None && placement == NumaPlacement::Default;
+    }
+
+    size_t pageSize() const {
+        return huge_pages == HugePages::None ? BASE_PAGE_SIZE : HUGE_PAGE_SIZE;
+    }
+
+    // Size of the mapping of a block, whole pages of at least one byte
+    size_t mappedSize(size_t size) const {
+        size = std::max<size_t>(size, 1);
+        return (size + pageSize() - 1) / pageSize() * pageSize();
+    }
+};
+
+// Parses a list of ranges such as "0-3,8-11" in the format of the files of /sys/devices/system
+inline std::vector<int> parseRangeList(const std::string &list) {
+    std::vector<int> values;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && range[0] >= '0' && range[0] <= '9') {
+            int first = std::stoi(range);
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int value = first; value <= last; value++)
+                values.push_back(value);
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+inline std::vector<int> readRangeList(const std::string &path) {
+    std::ifstream input(path);
+    std::string list;
+    std::getline(input, list);
+    return parseRangeList(list);
+}
+
+// The online NUMA nodes, a single node 0 on machines or platforms without NUMA
+inline std::vector<int> numaNodes() {
+    std::vector<int> nodes = readRangeList("/sys/devices/system/node/online");
+    if (nodes.empty())
+        nodes.push_back(0);
+    return nodes;
+}
+
+// The CPUs of a NUMA node, all hardware threads on machines or platforms without NUMA
+inline std::vector<int> numaNodeCpus(int node) {
+    std::vector<int> cpus = readRangeList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (cpus.empty()) {
+        size_t count = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t cpu = 0; cpu < count; cpu++)
+            cpus.push_back((int) cpu);
+    }
+    return cpus;
+}
+
+// Pins the calling thread to the CPUs of a NUMA node, returning whether it could
+inline bool pinThreadToNode(int node) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : numaNodeCpus(node)) {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Allocates a block of memory with the policy, returning nullptr when there is not enough memory; mapped blocks are
+// zeroed, and pages are only backed on first touch, on the nodes of the policy
+inline void *allocateMemory(size_t size, const MemoryPolicy &policy) {
+    if (policy.isDefault())
+        return malloc(size);
+#ifdef __linux__
+    std::vector<int> nodes = numaNodes();
+    if (policy.placement == NumaPlacement::Node && std::find(nodes.begin(), nodes.end(), policy.node) == nodes.end())
+        throw std::runtime_error("NUMA node " + std::to_string(policy.node) + " is not online");
+
+    size_t mapped_size = policy.mappedSize(size);
+    char *memory;
+    if (policy.huge_pages == HugePages::Explicit) {
+        void *mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+        memory = (char *) mapping;
+    } else if (policy.huge_pages == HugePages::Transparent) {
+        // The mapping is cut down to the 2 MB aligned part, which the kernel can back with whole huge pages
+        size_t alignment = MemoryPolicy::HUGE_PAGE_SIZE;
+        void *mapping = mmap(nullptr, mapped_size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+        char *begin = (char *) mapping;
+        memory = (char *) (((uintptr_t) begin + alignment - 1) / alignment * alignment);
+        if (memory > begin)
+            munmap(begin, memory - begin);
+        munmap(memory + mapped_size, begin + alignment - memory);
+        madvise(memory, mapped_size, MADV_HUGEPAGE);
+    } else {
+        void *mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+        memory = (char *) mapping;
+    }
+
+    // The memory policy of the mapping, which the kernel follows when the pages are first touched
+    if (policy.placement != NumaPlacement::Default && nodes.size() > 1) {
+        const int MPOL_PREFERRED_MODE = 1, MPOL_INTERLEAVE_MODE = 3;
+        std::vector<unsigned long> mask(nodes.back() / (8 * sizeof(unsigned long)) + 1, 0);
+        for (int node : nodes) {
+            if (policy.placement == NumaPlacement::Interleave || node == policy.node)
+                mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        }
+        int mode = policy.placement == NumaPlacement::Interleave ? MPOL_INTERLEAVE_MODE : MPOL_PREFERRED_MODE;
+        if (syscall(SYS_mbind, memory, mapped_size, mode, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, 0) != 0) {
+            munmap(memory, mapped_size);
+            throw std::runtime_error("Cannot set the NUMA placement of the index memory");
+        }
+    }
+    return memory;
+#else
+    throw std::runtime_error("Huge pages and NUMA placement are not supported on this platform");
+#endif
+}
+
+// Frees a block of the given size allocated with the policy
+inline void freeMemory(void *memory, size_t size, const MemoryPolicy &policy) {
+    if (policy.isDefault()) {
+        free(memory);
+        return;
+    }
+#ifdef __linux__
+    if (memory)
+        munmap(memory, policy.mappedSize(size));
+#endif
+}
+
+// Moves the first used bytes of a block to a block of new_size, like realloc, returning nullptr and keeping the block
+// when there is not enough memory
+inline void *reallocateMemory(void *memory, size_t size, size_t new_size, size_t used, const MemoryPolicy &policy) {
+    if (policy.isDefault())
+        return realloc(memory, new_size);
+    void *new_memory = allocateMemory(new_size, policy);
+    if (new_memory == nullptr)
+        return nullptr;
+    if (memory)
+        memcpy(new_memory, memory, std::min(used, new_size));
+    freeMemory(memory, size, policy);
+    return new_memory;
+}
+
+}  // namespace hnswlib
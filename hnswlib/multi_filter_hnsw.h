@@ -3,6 +3,8 @@
 #include "hnswlib.h"
 #include "hnswalg.h"
 #include <unordered_map>
+#include <algorithm>
+#include <cmath>
 #include <unordered_set>
 #include <string>
 #include <fstream>
@@ -22,6 +24,26 @@ namespace hnswlib
 		std::vector<HierarchicalNSW<dist_t>*> indexes;
 		std::unordered_set<std::string> allowedTags;
 
+		bool matches(const TagFilterProgram& program, labeltype label) const
+		{
+			return program.evaluate([this, label](size_t, const tag_type* begin, const tag_type* end) {
+				for (const tag_type* tagId = begin; tagId != end; tagId++)
+				{
+					if (*tagId && contains(indexes[*tagId - 1], label))
+					{
+						return true;
+					}
+				}
+
+				return false;
+			});
+		}
+
+		static bool contains(const HierarchicalNSW<dist_t>* index, labeltype label)
+		{
+			return index->label_lookup_.contains(label);
+		}
+
 	public:
 		MultiIndexHNSW(SpaceInterface<dist_t> *s, const std::unordered_set<std::string>& allowedTags)
 			: s(s), nmslib(false), max_elements(max_elements), allow_replace_deleted(false),
@@ -80,58 +102,157 @@ namespace hnswlib
 
 		std::priority_queue<std::pair<dist_t, labeltype>> searchKnn(const void *query_data, size_t k, const std::vector<std::string>& tags, BaseFilterFunctor* isIdAllowed = nullptr) const
 		{
-			std::priority_queue<std::pair<dist_t, labeltype>> allResults, results;
-			std::unordered_set<labeltype> exists;
-			exists.reserve(k);
+			return searchKnn(query_data, k, TagExpression::anyOf(tags), isIdAllowed);
+		}
+
+		// Searches the indexes of the tags that drive the filter, or all indexes if there are none, and checks every candidate
+		// against the filter, where an element has a tag if it is in the index of the tag
+		std::priority_queue<std::pair<dist_t, labeltype>> searchKnn(const void *query_data, size_t k, const TagExpression& filter, BaseFilterFunctor* isIdAllowed = nullptr) const
+		{
+			size_t elements = 0;
 
-			for (const std::string& tag : tags)
+			for (HierarchicalNSW<dist_t>* index : indexes)
 			{
-				if (lookup.find(tag) != lookup.end())
+				elements += index->getCurrentElementCount();
+			}
+
+			// Tag i + 1 is the tag of index i, so that unknown tags resolve to 0
+			TagFilterProgram program = TagFilterProgram::compile(filter, elements,
+				[this](const std::string& tag) { auto it = lookup.find(tag); return it != lookup.end() ? tag_type(it->second + 1) : tag_type(0); },
+				[this](tag_type tagId) { return tagId ? indexes[tagId - 1]->getCurrentElementCount() : 0; });
+			std::vector<tag_type> driving;
+
+			if (!program.drivingTags(driving))
+			{
+				driving.clear();
+
+				for (unsigned index = 0; index < indexes.size(); index++)
+				{
+					driving.push_back(index + 1);
+				}
+			}
+
+			// Starts with more candidates the fewer of the driving elements are expected to match, and doubles them until
+			// k matches are found or the driving indexes are exhausted
+			size_t drivingElements = 0;
+
+			for (tag_type tagId : driving)
+			{
+				drivingElements = std::max(drivingElements, tagId ? indexes[tagId - 1]->getCurrentElementCount() : 0);
+			}
+
+			double expected = std::max(1.0, program.selectivity() * elements);
+			size_t fetch = std::max(k, size_t(std::ceil(k * std::min(double(drivingElements) / expected, double(elements)))));
+			std::priority_queue<std::pair<dist_t, labeltype>> results;
+
+			while (true)
+			{
+				std::unordered_set<labeltype> exists;
+
+				for (tag_type tagId : driving)
 				{
-					unsigned index = lookup.at(tag);
-					std::priority_queue<std::pair<dist_t, labeltype>> tagResults = indexes[index]->searchKnn(query_data, k, {}, isIdAllowed);
+					if (!tagId)
+					{
+						continue;
+					}
+
+					std::priority_queue<std::pair<dist_t, labeltype>> tagResults = indexes[tagId - 1]->searchKnn(query_data, fetch, {}, isIdAllowed);
 
 					while (!tagResults.empty())
 					{
 						std::pair<dist_t, labeltype> result = tagResults.top();
 						tagResults.pop();
 
-						if (exists.find(result.second) == exists.end())
+						if (!exists.insert(result.second).second || !matches(program, result.second))
+						{
+							continue;
+						}
+
+						results.push(result);
+
+						if (results.size() > k)
 						{
-							allResults.push(result);
-							exists.insert(result.second);
+							results.pop();
 						}
 					}
 				}
-			}
 
-			while (results.size() < k)
-			{
-				results.push(allResults.top());
-				allResults.pop();
+				if (results.size() == k || fetch >= drivingElements)
+				{
+					break;
+				}
+
+				results = std::priority_queue<std::pair<dist_t, labeltype>>();
+				fetch *= 2;
 			}
 
 			return results;
 		}
 
+		// Writes all indexes into one file, as the parts of its sections, after the tag of each index
 		void saveIndex(const std::string& location)
 		{
-			std::ofstream metaStream(location + ".meta");
-			std::unordered_map<unsigned, std::string> inverted;
+			std::vector<std::string> tags(indexes.size());
 
 			for (const auto& pair : lookup)
 			{
-				inverted.insert({pair.second, pair.first});
+				tags[pair.second] = pair.first;
 			}
 
+			IndexFileWriter file(location, IndexKind::MultiIndex);
+			std::ostream& output = file.beginSection(IndexSection::IndexTags);
+			writeBinaryPOD(output, tags.size());
+
+			for (const std::string& tag : tags)
+			{
+				writeBinaryPOD(output, tag.length());
+				output.write(tag.c_str(), tag.length());
+			}
+
+			file.endSection();
+
 			for (unsigned index = 0; index < indexes.size(); index++)
 			{
-				metaStream << inverted[index] << "\n";
-				indexes[index]->saveIndex(location + "." + std::to_string(index));
+				indexes[index]->saveIndex(file, index);
 			}
+
+			file.close();
 		}
 
+		// Reads files written by saveIndex(), or the per-index files and tag list written before index files had sections
 		void loadIndex(const std::string& location, SpaceInterface<dist_t>* s, size_t max_elements_i = 0)
+		{
+			if (!IndexFileReader::isIndexFile(location))
+			{
+				loadLegacyIndex(location, s, max_elements_i);
+				return;
+			}
+
+			IndexFileReader file(location);
+			file.expectKind(IndexKind::MultiIndex);
+			std::istream& input = file.open(IndexSection::IndexTags);
+			size_t count;
+			readBinaryPOD(input, count);
+			std::vector<std::string> tags(count);
+
+			for (std::string& tag : tags)
+			{
+				size_t length;
+				readBinaryPOD(input, length);
+				tag.resize(length);
+				input.read(&tag[0], length);
+			}
+
+			for (unsigned index = 0; index < count; index++)
+			{
+				indexes.push_back(new HierarchicalNSW<dist_t>(s));
+				indexes[index]->loadIndex(file, s, max_elements_i, false, true, index);
+				lookup.insert({tags[index], index});
+				allowedTags.insert(tags[index]);
+			}
+		}
+
+		void loadLegacyIndex(const std::string& location, SpaceInterface<dist_t>* s, size_t max_elements_i)
 		{
 			std::ifstream metaStream(location + ".meta");
 			std::string tag;
@@ -139,8 +260,8 @@ namespace hnswlib
 
 			while (std::getline(metaStream, tag))
 			{
-                indexes.push_back(new HierarchicalNSW<dist_t>(s));
-                indexes[index]->loadIndex(location + "." + std::to_string(index), s, max_elements_i);
+				indexes.push_back(new HierarchicalNSW<dist_t>(s));
+				indexes[index]->loadIndex(location + "." + std::to_string(index), s, max_elements_i);
 				lookup.insert({tag, index++});
 			}
 		}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hnswlib
+{
+    // Resolves a requested thread count, where 0 means one thread per hardware thread
+    inline size_t resolveThreadCount(size_t numThreads)
+    {
+        if (numThreads == 0)
+        {
+            numThreads = std::thread::hardware_concurrency();
+        }
+
+        return numThreads > 0 ? numThreads : 1;
+    }
+
+    // Calls fn(id, threadId) for every ID in [start, end) on numThreads threads, rethrowing the last exception of any call
+    // Same executor as the one of the Python bindings, which is itself copied from nmslib
+    template<class Function>
+    inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn)
+    {
+        numThreads = resolveThreadCount(numThreads);
+
+        if (numThreads == 1)
+        {
+            for (size_t id = start; id < end; id++)
+            {
+                fn(id, 0);
+            }
+
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        std::atomic<size_t> current(start);
+        std::exception_ptr lastException = nullptr;
+        std::mutex lastExceptMutex;
+
+        for (size_t threadId = 0; threadId < numThreads; ++threadId)
+        {
+            threads.push_back(std::thread([&, threadId]
+            {
+                while (true)
+                {
+                    size_t id = current.fetch_add(1);
+
+                    if (id >= end)
+                    {
+                        break;
+                    }
+
+                    try
+                    {
+                        fn(id, threadId);
+                    }
+
+                    catch (...)
+                    {
+                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
+                        lastException = std::current_exception();
+                        current = end;  // Stops the other threads after their current call
+                        break;
+                    }
+                }
+            }));
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (lastException)
+        {
+            std::rethrow_exception(lastException);
+        }
+    }
+}
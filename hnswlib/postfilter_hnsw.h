@@ -23,8 +23,11 @@ namespace hnswlib
             bool nmslib = false,
             size_t max_elements = 0,
             bool allow_replace_deleted = false)
-            : hnsw(s, location, nmslib, max_elements, allow_replace_deleted)
-        {}
+            : hnsw(s)
+        {
+            hnsw.allow_replace_deleted_ = allow_replace_deleted;
+            loadIndex(location, s, max_elements);
+        }
 
         PostfilterHNSW(
             SpaceInterface<dist_t> *s,
@@ -42,24 +45,34 @@ namespace hnswlib
         }
 
         std::priority_queue<std::pair<dist_t, labeltype>> searchKnn(const void *query_data, size_t k, const std::vector<std::string>& tags, BaseFilterFunctor* isIdAllowed = nullptr) const
+        {
+            return searchKnn(query_data, k, TagExpression::anyOf(tags), isIdAllowed);
+        }
+
+        // Keeps the k closest of the unfiltered results that match the filter
+        std::priority_queue<std::pair<dist_t, labeltype>> searchKnn(const void *query_data, size_t k, const TagExpression& filter, BaseFilterFunctor* isIdAllowed = nullptr) const
         {
             size_t initialK = k * 100;
             std::priority_queue<std::pair<dist_t, labeltype>> initialResults = hnsw.searchKnn(query_data, initialK, {}, isIdAllowed);
             std::priority_queue<std::pair<dist_t, labeltype>> processedResults;
+            TagFilterProgram program = TagFilterProgram::compile(filter, hnsw.cur_element_count,
+                [this](const std::string& tag) { return hnsw.tag_index.resolveTag(tag); },
+                [this](tag_type tagId) { return hnsw.tag_index.frequency(tagId, 0); });
 
-            while (!initialResults.empty() && processedResults.size() < k)
+            while (!initialResults.empty())
             {
                 std::pair<dist_t, labeltype> top = initialResults.top();
                 tableint internalId = hnsw.label_lookup_.at(top.second);
-                std::vector<std::string> nodeTags = hnsw.tag_index.get(internalId);
+                std::vector<tag_type> nodeTags = hnsw.tag_index.tagIds(internalId);
                 initialResults.pop();
 
-                for (const std::string& nodeTag : nodeTags)
+                if (program.matches(nodeTags.data(), nodeTags.data() + nodeTags.size()))
                 {
-                    if (std::find(tags.begin(), tags.end(), nodeTag) != tags.end())
+                    processedResults.push(top);
+
+                    if (processedResults.size() > k)
                     {
-                        processedResults.push(top);
-                        break;
+                        processedResults.pop();
                     }
                 }
             }
@@ -69,12 +82,23 @@ namespace hnswlib
 
         void saveIndex(const std::string &location)
         {
-            hnsw.saveIndex(location);
+            IndexFileWriter file(location, IndexKind::Postfilter);
+            hnsw.saveIndex(file);
+            file.close();
         }
 
+        // Reads files written by saveIndex(), or the plain graph files written before index files had sections
         void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0)
         {
-            hnsw.loadIndex(location, s, max_elements_i);
+            if (!IndexFileReader::isIndexFile(location))
+            {
+                hnsw.loadIndex(location, s, max_elements_i);
+                return;
+            }
+
+            IndexFileReader file(location);
+            file.expectKind(IndexKind::Postfilter);
+            hnsw.loadIndex(file, s, max_elements_i);
         }
     };
 }
\ No newline at end of file
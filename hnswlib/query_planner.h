@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+namespace hnswlib
+{
+    enum class QueryPlan
+    {
+        BruteForce,     // Exact scan over the posting lists of the query tags
+        FilteredGraph,  // Graph search that only admits nodes passing the filter
+        TwoHopGraph,    // Filtered graph search that also reaches passing nodes through neighbors failing the filter
+        PostFilter      // Unfiltered graph search with over-fetching, filtered afterwards
+    };
+
+    struct QueryStats
+    {
+        QueryPlan plan = QueryPlan::FilteredGraph;
+        double selectivity = 1.0;           // Estimated fraction of the elements passing the filter
+        size_t estimated_matches = 0;
+        double estimated_cost = 0.0;        // Estimated number of distance computations of the chosen plan
+        size_t ef = 0;                      // Search breadth used by the graph-based plans
+    };
+
+    // Chooses how to execute a filtered query from the estimated filter selectivity
+    // Costs are measured in distance computations: a brute-force scan computes one per match, while a graph search
+    // visits about ef / selectivity nodes before it has collected ef matches, each costing up to maxM0 distances, and
+    // the two-hop graph search visits about ef nodes as it skips the nodes failing the filter
+    struct QueryPlanner
+    {
+        bool enabled = true;
+        double postfilter_selectivity = 0.5;    // Filters at least this permissive are cheaper to apply after an unfiltered search
+        double two_hop_selectivity = 0.05;      // Below this, too few neighbors pass the filter to keep the filtered graph connected
+
+        void plan(size_t matches, size_t elements, size_t ef, size_t maxM0, QueryStats& stats) const
+        {
+            stats.estimated_matches = std::min(matches, elements);
+            stats.selectivity = elements > 0 ? static_cast<double>(stats.estimated_matches) / elements : 0.0;
+            stats.ef = ef;
+
+            if (stats.estimated_matches == 0)
+            {
+                stats.plan = QueryPlan::BruteForce;
+                stats.estimated_cost = 0.0;
+                return;
+            }
+
+            // The two-hop search only expands passing nodes, each with at most maxM0 distance computations
+            bool twoHop = enabled && stats.selectivity < two_hop_selectivity;
+            double bruteForceCost = static_cast<double>(stats.estimated_matches);
+            double graphCost = std::min(static_cast<double>(elements), ef * maxM0 / (twoHop ? 1.0 : stats.selectivity));
+
+            if (!enabled)
+            {
+                stats.plan = QueryPlan::FilteredGraph;
+                stats.estimated_cost = graphCost;
+            }
+
+            else if (bruteForceCost <= graphCost)
+            {
+                stats.plan = QueryPlan::BruteForce;
+                stats.estimated_cost = bruteForceCost;
+            }
+
+            else if (stats.selectivity >= postfilter_selectivity)
+            {
+                stats.plan = QueryPlan::PostFilter;
+                stats.ef = std::min(elements, static_cast<size_t>(ef / stats.selectivity) + 1);
+                stats.estimated_cost = std::min(static_cast<double>(elements), static_cast<double>(stats.ef) * maxM0);
+            }
+
+            else if (twoHop)
+            {
+                stats.plan = QueryPlan::TwoHopGraph;
+                stats.estimated_cost = graphCost;
+            }
+
+            else
+            {
+                stats.plan = QueryPlan::FilteredGraph;
+                stats.estimated_cost = graphCost;
+            }
+        }
+    };
+}
@@ -6,179 +6,291 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <cstdint>
 #include "shortest_path.h"
+#include "parallel.h"
 
 namespace hnswlib
 {
-    // This implementation assumes that IDs er continuous integers starting from 1
-    template<typename tag_type>
-    class RelationshipGraph
+    // Symmetric table of distances between the nodes 0 to n - 1, storing only the strict lower triangle at one byte per pair
+    // Distances below EXACT_LIMIT are exact, larger ones fall into logarithmic buckets with a relative error of at most 5%
+    template<typename distance_type>
+    class TriangularDistances
     {
     private:
-        using distance_type = int32_t;
+        static constexpr unsigned EXACT_LIMIT = 64;
+        static constexpr unsigned BUCKETS_PER_DOUBLING = 8;
+        static constexpr uint8_t UNREACHABLE = 255;
 
-        std::unordered_map<tag_type, std::string>& lookup;
-        std::unordered_map<std::string, tag_type>& inverted;
-        std::unordered_map<tag_type, std::unordered_set<tag_type>> adjMatrix;
-        distance_type** distances = nullptr;
-        uint32_t** frequencies = nullptr;
-        size_t distancesCapacity, distancesCount = 0, syncCount = 0;
-        static constexpr size_t SYNC_LIMIT = 1000;
+        size_t count = 0;
+        std::vector<uint8_t> buckets;
 
-    public:
-        RelationshipGraph(std::unordered_map<tag_type, std::string>& lookup,
-            std::unordered_map<std::string, tag_type>& inverted)
-            : lookup(lookup), inverted(inverted), distancesCapacity(10)
+        [[nodiscard]] static size_t index(size_t i, size_t j) noexcept  // Requires i > j
         {
-            resizeDistances(10);
+            return i * (i - 1) / 2 + j;
         }
 
-        ~RelationshipGraph()
+    public:
+        [[nodiscard]] static uint8_t encode(distance_type distance) noexcept
         {
-            freeAll();
+            if (distance < 0 || distance == std::numeric_limits<distance_type>::max())
+            {
+                return UNREACHABLE;
+            }
+
+            if (distance < static_cast<distance_type>(EXACT_LIMIT))
+            {
+                return static_cast<uint8_t>(distance);
+            }
+
+            double bucket = EXACT_LIMIT + std::floor(BUCKETS_PER_DOUBLING * std::log2(static_cast<double>(distance) / EXACT_LIMIT));
+            return static_cast<uint8_t>(std::min(bucket, UNREACHABLE - 1.0));
         }
 
-        void freeAll()
+        // Large distances decode to the geometric middle of their bucket
+        [[nodiscard]] static distance_type decode(uint8_t bucket) noexcept
         {
-            for (int i = 0; i < distancesCapacity; i++)
+            if (bucket == UNREACHABLE)
+            {
+                return std::numeric_limits<distance_type>::max();
+            }
+
+            if (bucket < EXACT_LIMIT)
             {
-                free(distances[i]);
-                free(frequencies[i]);
+                return bucket;
             }
 
-            free(distances);
-            free(frequencies);
+            return static_cast<distance_type>(std::lround(EXACT_LIMIT * std::exp2((bucket - EXACT_LIMIT + 0.5) / BUCKETS_PER_DOUBLING)));
+        }
+
+        // Resizes the table to n nodes with all pairs unreachable
+        void reset(size_t n)
+        {
+            count = n;
+            buckets.assign(index(n, 0), UNREACHABLE);
+        }
+
+        void clear() noexcept
+        {
+            count = 0;
+            std::vector<uint8_t>().swap(buckets);
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return count;
         }
 
-        void initDistances(distance_type* array, size_t n)
+        // Stores the distances from node i to the nodes 0 to i - 1, rows of different nodes can be written concurrently
+        void setRow(size_t i, const distance_type* distances) noexcept
         {
-            for (int i = 0; i < n; i++)
+            uint8_t* row = buckets.data() + index(i, 0);
+
+            for (size_t j = 0; j < i; j++)
             {
-                array[i] = 0.0;
+                row[j] = encode(distances[j]);
             }
         }
 
-        void initFrequencies(uint32_t* array, size_t n)
+        [[nodiscard]] distance_type get(size_t i, size_t j) const noexcept
         {
-            for (int i = 0; i < n; i++)
+            if (i == j)
             {
-                array[i] = 0;
+                return 0;
             }
+
+            return decode(buckets[i > j ? index(i, j) : index(j, i)]);
         }
 
-        // Synchronizes the index of weighted tag distances by expanding capacity when needed and inserted new tags in the tag index
-        void computeDistances()
+        void saveIndex(std::ostream& output) const
         {
-            tag_type maxTagId = 0;
+            output.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            output.write(reinterpret_cast<const char*>(buckets.data()), buckets.size());
+        }
 
-            for (const auto& pair : inverted)
-            {
-                if (pair.second > maxTagId)
-                {
-                    maxTagId = pair.second;
-                }
-            }
+        void loadIndex(std::istream& input)
+        {
+            size_t n;
+            input.read(reinterpret_cast<char*>(&n), sizeof(n));
+            reset(n);
+            input.read(reinterpret_cast<char*>(buckets.data()), buckets.size());
+        }
+    };
 
-            Dijkstra<tag_type, distance_type> dijkstra(adjMatrix, frequencies);
-            std::unordered_set<tag_type> allTags;
+    // This implementation assumes that IDs er continuous integers starting from 1
+    template<typename tag_type>
+    class RelationshipGraph
+    {
+    private:
+        using distance_type = int32_t;
 
-            for (const auto& pair : adjMatrix)
+        std::unordered_map<tag_type, std::string>& lookup;
+        std::unordered_map<std::string, tag_type>& inverted;
+        std::unordered_map<tag_type, std::unordered_set<tag_type>> adjMatrix;
+        TriangularDistances<distance_type> distances;
+        std::unordered_map<uint64_t, uint32_t> frequencies;     // Co-occurrence counts of related tag pairs, see pairKey
+        size_t distancesCount = 0;
+        uint32_t maxFrequency = 0;
+
+        // Lazy mode computes the distances from a source tag on first use, up to a number of hops, and keeps the most
+        // recently used sources in an LRU cache instead of the dense distance matrix
+        bool lazy = false;
+        unsigned lazyRadius = 0;
+        size_t cacheCapacity = 0;
+        mutable std::list<tag_type> cacheOrder;     // Most recently used source first
+        mutable std::unordered_map<tag_type, std::pair<std::unordered_map<tag_type, distance_type>, typename std::list<tag_type>::iterator>> cache;
+        mutable std::mutex cacheLock;
+
+        [[nodiscard]] static uint64_t pairKey(const tag_type& tag1, const tag_type& tag2) noexcept
+        {
+            return tag1 < tag2 ? (static_cast<uint64_t>(tag1) << 32) | tag2 : (static_cast<uint64_t>(tag2) << 32) | tag1;
+        }
+
+        [[nodiscard]] uint32_t frequency(const tag_type& fromTag, const tag_type& toTag) const noexcept
+        {
+            auto it = frequencies.find(pairKey(fromTag, toTag));
+            return it != frequencies.end() ? it->second : 0;
+        }
+
+        distance_type weight(const tag_type& fromTag, const tag_type& toTag) const noexcept
+        {
+            return static_cast<distance_type>(maxFrequency - frequency(fromTag, toTag)) + 1;
+        }
+
+        // Returns the cached distances from a source tag, computing them if needed, while holding the cache lock
+        const std::unordered_map<tag_type, distance_type>& sourceDistances(const tag_type& source) const
+        {
+            auto it = cache.find(source);
+
+            if (it != cache.end())
             {
-                allTags.insert(pair.first);
+                cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.second);
+                return it->second.first;
             }
 
-            for (const tag_type& tag1 : allTags)
+            if (cache.size() >= cacheCapacity && !cacheOrder.empty())
             {
-                for (const tag_type& tag2 : allTags)
-                {
-                    distancesCount = std::max(static_cast<unsigned>(distancesCount), std::max(tag1, tag2));
-
-                    if (tag1 == tag2)
-                    {
-                        distances[tag1 - 1][tag2 - 1] = 0;
-                        distances[tag2 - 1][tag1 - 1] = 0;
-                        continue;
-                    }
-
-                    distance_type distance = dijkstra.distance(tag1, tag2);
-                    distances[tag1 - 1][tag2 - 1] = distance;   // -1 because node IDs start at 1
-                    distances[tag2 - 1][tag1 - 1] = distance;
-                }
+                cache.erase(cacheOrder.back());
+                cacheOrder.pop_back();
             }
+
+            BoundedDijkstra<tag_type, distance_type> dijkstra(adjMatrix, lazyRadius);
+            cacheOrder.push_front(source);
+            auto distancesFrom = dijkstra.distances(source, [this](const tag_type& u, const tag_type& v) { return weight(u, v); });
+            return cache.emplace(source, std::make_pair(std::move(distancesFrom), cacheOrder.begin())).first->second.first;
         }
 
-        void resizeDistances(size_t newCapacity)
+        distance_type lazyDistance(const tag_type& fromTag, const tag_type& toTag) const
         {
-            if (!distances)
-            {
-                distances = (distance_type**) malloc(sizeof(distance_type*) * newCapacity);
-                frequencies = (uint32_t**) malloc(sizeof(uint32_t*) * newCapacity);
+            std::lock_guard<std::mutex> lock(cacheLock);
+            const tag_type& source = cache.find(fromTag) == cache.end() && cache.find(toTag) != cache.end() ? toTag : fromTag;
+            const tag_type& target = source == fromTag ? toTag : fromTag;
+            const std::unordered_map<tag_type, distance_type>& distancesFrom = sourceDistances(source);
+            auto it = distancesFrom.find(target);
+            return it != distancesFrom.end() ? it->second : std::numeric_limits<distance_type>::max();
+        }
 
-                if (!distances || !frequencies)
-                {
-                    throw std::runtime_error("Not enough memory");
-                }
+        void clearCache()
+        {
+            std::lock_guard<std::mutex> lock(cacheLock);
+            cache.clear();
+            cacheOrder.clear();
+        }
 
-                for (int i = 0; i < newCapacity; i++)
-                {
-                    distances[i] = (distance_type*) malloc(sizeof(distance_type) * newCapacity);
-                    frequencies[i] = (uint32_t*) malloc(sizeof(uint32_t) * newCapacity);
+    public:
+        RelationshipGraph(std::unordered_map<tag_type, std::string>& lookup,
+            std::unordered_map<std::string, tag_type>& inverted)
+            : lookup(lookup), inverted(inverted)
+        {}
+
+        // Switches to lazily computed distances, bounded to the given number of hops and cached for the given number of source tags
+        // This drops the distance table, so flushing tags no longer runs all-pairs shortest paths
+        void setLazyDistances(unsigned radius, size_t capacity)
+        {
+            distances.clear();
+            lazy = true;
+            lazyRadius = radius;
+            cacheCapacity = std::max<size_t>(capacity, 1);
+            clearCache();
+        }
 
-                    if (!distances[i] || !frequencies[i])
-                    {
-                        throw std::runtime_error("Not enough memory");
-                    }
+        // Adjacency of the tag graph in CSR layout, where node i is tag i + 1
+        [[nodiscard]] CsrGraph<distance_type> csrAdjacency() const
+        {
+            CsrGraph<distance_type> graph;
+            graph.offsets.assign(distancesCount + 1, 0);
 
-                    initDistances(distances[i], newCapacity);
-                    initFrequencies(frequencies[i], newCapacity);
-                }
+            for (const auto& pair : adjMatrix)
+            {
+                graph.offsets[pair.first] = pair.second.size();
             }
 
-            else
+            for (size_t i = 0; i < distancesCount; i++)
             {
-                if (newCapacity <= distancesCapacity)
-                {
-                    throw std::runtime_error("New distance capacity most be greater than the previous");
-                }
+                graph.offsets[i + 1] += graph.offsets[i];
+            }
+
+            graph.targets.resize(graph.offsets.back());
+            graph.weights.resize(graph.offsets.back());
 
-                distances = (distance_type**) realloc(distances, sizeof(distance_type*) * newCapacity);
-                frequencies = (uint32_t**) realloc(frequencies, sizeof(uint32_t*) * newCapacity);
+            for (const auto& pair : adjMatrix)
+            {
+                size_t edge = graph.offsets[pair.first - 1];
 
-                if (!distances || !frequencies)
+                for (const tag_type& related : pair.second)
                 {
-                    throw std::runtime_error("Not enough memory");
+                    graph.targets[edge] = related - 1;
+                    graph.weights[edge] = weight(pair.first, related);
+                    edge++;
                 }
+            }
 
-                for (int i = 0; i < distancesCapacity; i++)
-                {
-                    distances[i] = (distance_type*) realloc(distances[i], sizeof(distance_type) * newCapacity);
-                    frequencies[i] = (uint32_t*) realloc(frequencies[i], sizeof(uint32_t) * newCapacity);
+            return graph;
+        }
 
-                    if (!distances[i] || !frequencies[i])
-                    {
-                        throw std::runtime_error("Not enough memory");
-                    }
+        // Synchronizes the index of weighted tag distances with the tags related so far
+        // Runs one single-source shortest path computation per tag on numThreads threads, each writing its own row of the distances
+        void computeDistances(size_t numThreads = 0)
+        {
+            distancesCount = 0;
 
-                    initDistances(distances[i] + distancesCapacity, newCapacity - distancesCapacity);
-                    initFrequencies(frequencies[i] + distancesCapacity, newCapacity - distancesCapacity);
-                }
+            for (const auto& pair : adjMatrix)
+            {
+                distancesCount = std::max(distancesCount, static_cast<size_t>(pair.first));
+            }
 
-                for (int i = distancesCapacity; i < newCapacity; i++)
-                {
-                    distances[i] = (distance_type*) malloc(sizeof(distance_type) * newCapacity);
-                    frequencies[i] = (uint32_t*) malloc(sizeof(uint32_t) * newCapacity);
+            if (lazy)
+            {
+                clearCache();
+                return;
+            }
 
-                    if (!distances[i] || !frequencies[i])
-                    {
-                        throw std::runtime_error("Not enough memory");
-                    }
+            CsrGraph<distance_type> graph = csrAdjacency();
+            std::vector<tag_type> sources;
+            sources.reserve(adjMatrix.size());
 
-                    initDistances(distances[i], newCapacity);
-                    initFrequencies(frequencies[i], newCapacity);
-                }
+            for (const auto& pair : adjMatrix)
+            {
+                sources.push_back(pair.first);
             }
 
-            distancesCapacity = newCapacity;
+            numThreads = resolveThreadCount(numThreads);
+            std::vector<Dijkstra<distance_type>> dijkstras(numThreads, Dijkstra<distance_type>(graph));
+            std::vector<std::vector<distance_type>> rows(numThreads, std::vector<distance_type>(distancesCount));
+            distances.reset(distancesCount);
+
+            // The graph is undirected, so the run from a source only has to fill the source's row of the lower triangle
+            ParallelFor(0, sources.size(), numThreads, [&](size_t i, size_t threadId)
+            {
+                tag_type source = sources[i] - 1;   // -1 because tag IDs start at 1
+                dijkstras[threadId].distances(source, rows[threadId].data());
+                distances.setRow(source, rows[threadId].data());
+            });
         }
 
         RelationshipGraph& operator=(const RelationshipGraph& other)
@@ -192,6 +304,11 @@ namespace hnswlib
 
         void relate(const std::unordered_set<tag_type>& tagIds) noexcept
         {
+            if (lazy)
+            {
+                clearCache();
+            }
+
             std::unordered_set<tag_type> newTags;
 
             for (const tag_type& tagId : tagIds)
@@ -209,11 +326,6 @@ namespace hnswlib
                     adjMatrix.insert({tagId, related});
                     newTags.insert(tagId);
                 }
-
-                if (tagId >= distancesCapacity)
-                {
-                    resizeDistances(distancesCapacity * 2);
-                }
             }
 
             for (const tag_type& tagId : tagIds)
@@ -223,8 +335,9 @@ namespace hnswlib
 
                 for (const tag_type& relatedTag : related)  // Increments frequencies for existing tag edges
                 {
-                    frequencies[tagId - 1][relatedTag - 1]++;
-                    frequencies[relatedTag - 1][tagId - 1]++;
+                    uint32_t& pairFrequency = frequencies[pairKey(tagId, relatedTag)];
+                    pairFrequency++;
+                    maxFrequency = std::max(maxFrequency, pairFrequency);
                 }
             }
         }
@@ -235,6 +348,7 @@ namespace hnswlib
             return bfs.distance(fromTag, toTag);
         }
 
+        // Distances are computed by flushing tags, or on first use in lazy mode
         [[nodiscard]] distance_type distance(const tag_type& fromTag, const tag_type& toTag) const
         {
             if (fromTag > distancesCount || toTag > distancesCount || fromTag <= 0 || toTag <= 0)
@@ -243,57 +357,80 @@ namespace hnswlib
                     ") and toTag (" + std::to_string(toTag) + ") must be greater than 0 and smaller than " + std::to_string(distancesCount));
             }
 
-            return distances[fromTag - 1][toTag - 1];
+            if (lazy)
+            {
+                return lazyDistance(fromTag, toTag);
+            }
+
+            return distances.get(fromTag - 1, toTag - 1);
         }
 
         void clear() noexcept
         {
             adjMatrix.clear();
-
-            for (int i = 0; i < distancesCapacity; i++)
-            {
-                initDistances(distances[i], distancesCapacity);
-                initFrequencies(frequencies[i], distancesCapacity);
-            }
+            maxFrequency = 0;
+            cache.clear();
+            cacheOrder.clear();
+            frequencies.clear();
+            distances.clear();
+            distancesCount = 0;
         }
 
-        void saveIndex(std::ofstream& output) const
+        void saveIndex(std::ostream& output) const
         {
             std::size_t size = adjMatrix.size();
             output.write(reinterpret_cast<const char*>(&size), sizeof(size));
-            output.write(reinterpret_cast<const char*>(&distancesCapacity), sizeof(distancesCapacity));
             output.write(reinterpret_cast<const char*>(&distancesCount), sizeof(distancesCount));
+            output.write(reinterpret_cast<const char*>(&lazy), sizeof(lazy));
+            output.write(reinterpret_cast<const char*>(&lazyRadius), sizeof(lazyRadius));
+            output.write(reinterpret_cast<const char*>(&cacheCapacity), sizeof(cacheCapacity));
+
+            // Tags and pairs are written in order, so that saving the same graph twice gives the same bytes
+            std::map<tag_type, const std::unordered_set<tag_type>*> sortedTags;
 
             for (const auto& pair : adjMatrix)
             {
-                std::size_t related = pair.second.size();
+                sortedTags.emplace(pair.first, &pair.second);
+            }
+
+            for (const auto& pair : sortedTags)
+            {
+                std::vector<tag_type> relatedTags(pair.second->begin(), pair.second->end());
+                std::sort(relatedTags.begin(), relatedTags.end());
+                std::size_t related = relatedTags.size();
                 output.write((char*) &related, sizeof(std::size_t));
                 output.write((char*) &pair.first, sizeof(tag_type));
 
-                for (const tag_type& relatedTag : pair.second)
+                for (const tag_type& relatedTag : relatedTags)
                 {
                     output.write((char*) &relatedTag, sizeof(tag_type));
                 }
             }
 
-            for (int i = 0; i < distancesCapacity; i++)
+            std::map<uint64_t, uint32_t> sortedFrequencies(frequencies.begin(), frequencies.end());
+            size = sortedFrequencies.size();
+            output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+
+            for (const auto& pair : sortedFrequencies)
             {
-                output.write(reinterpret_cast<const char*>(distances[i]), sizeof(distance_type) * distancesCapacity);
-                output.write(reinterpret_cast<const char*>(frequencies[i]), sizeof(double) * distancesCapacity);
+                output.write(reinterpret_cast<const char*>(&pair.first), sizeof(uint64_t));
+                output.write(reinterpret_cast<const char*>(&pair.second), sizeof(uint32_t));
             }
+
+            distances.saveIndex(output);
         }
 
-        void loadIndex(std::ifstream& input, const std::unordered_map<tag_type, std::string>& lookup,
+        void loadIndex(std::istream& input, const std::unordered_map<tag_type, std::string>& lookup,
             const std::unordered_map<std::string, tag_type>& inverted)
         {
-            freeAll();
-            distances = nullptr;
+            clear();
 
             std::size_t size;
             input.read(reinterpret_cast<char*>(&size), sizeof(size));
-            input.read(reinterpret_cast<char*>(&distancesCapacity), sizeof(distancesCapacity));
             input.read(reinterpret_cast<char*>(&distancesCount), sizeof(distancesCount));
-            resizeDistances(distancesCapacity);
+            input.read(reinterpret_cast<char*>(&lazy), sizeof(lazy));
+            input.read(reinterpret_cast<char*>(&lazyRadius), sizeof(lazyRadius));
+            input.read(reinterpret_cast<char*>(&cacheCapacity), sizeof(cacheCapacity));
 
             for (std::size_t i = 0; i < size; i++)
             {
@@ -313,12 +450,21 @@ namespace hnswlib
                 adjMatrix.insert({tag, relatedTags});
             }
 
-            for (int i = 0; i < distancesCapacity; i++)
+            input.read(reinterpret_cast<char*>(&size), sizeof(size));
+            frequencies.reserve(size);
+
+            for (std::size_t i = 0; i < size; i++)
             {
-                input.read(reinterpret_cast<char*>(distances[i]), sizeof(distance_type) * distancesCapacity);
-                input.read(reinterpret_cast<char*>(frequencies[i]), sizeof(uint32_t) * distancesCapacity);
+                uint64_t key;
+                uint32_t pairFrequency;
+                input.read(reinterpret_cast<char*>(&key), sizeof(uint64_t));
+                input.read(reinterpret_cast<char*>(&pairFrequency), sizeof(uint32_t));
+                frequencies.emplace(key, pairFrequency);
+                maxFrequency = std::max(maxFrequency, pairFrequency);
             }
 
+            distances.loadIndex(input);
+
             this->lookup = lookup;
             this->inverted = inverted;
         }
@@ -7,6 +7,10 @@
 #include <vector>
 #include <stdexcept>
 #include <limits>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
 
 namespace hnswlib
 {
@@ -70,91 +74,121 @@ namespace hnswlib
         }
     };
 
-    template<typename node_type, typename distance_type>
-    class Dijkstra: public ShortestPath<node_type, distance_type>
+    // Weighted graph over the nodes 0 to n - 1 in compressed sparse row layout
+    template<typename distance_type>
+    struct CsrGraph
+    {
+        std::vector<size_t> offsets{0};     // The edges of node i are edges offsets[i] to offsets[i + 1] - 1
+        std::vector<uint32_t> targets;
+        std::vector<distance_type> weights;
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return offsets.size() - 1;
+        }
+    };
+
+    // Single-source Dijkstra over a CSR graph with a binary heap, whose storage is reused across sources
+    template<typename distance_type>
+    class Dijkstra
     {
     private:
-        std::unordered_map<node_type, std::unordered_set<node_type>> matrix;
-        uint32_t** edgeWeights;
-        uint32_t maxWeight = 0;
-        std::unordered_map<node_type, std::vector<distance_type>> distances;
+        using entry = std::pair<distance_type, uint32_t>;
+
+        const CsrGraph<distance_type>& graph;
+        std::vector<entry> heap;
 
     public:
-        Dijkstra(const std::unordered_map<node_type, std::unordered_set<node_type>>& matrix, uint32_t** edgeWeights)
-            : matrix(matrix), edgeWeights(edgeWeights)
+        explicit Dijkstra(const CsrGraph<distance_type>& graph)
+            : graph(graph)
+        {}
+
+        // Writes the distances from the source to all nodes into a row of graph.size() entries, unreachable nodes get the maximum
+        void distances(uint32_t source, distance_type* row)
         {
-            for (const auto& pair : matrix)
+            std::fill(row, row + graph.size(), std::numeric_limits<distance_type>::max());
+            row[source] = 0;
+            heap.clear();
+            heap.emplace_back(0, source);
+
+            while (!heap.empty())
             {
-                std::vector<distance_type> nodeDistances(matrix.size(), -1);
-                size_t n = nodeDistances.size();
-                distances.insert({pair.first, nodeDistances});
+                std::pop_heap(heap.begin(), heap.end(), std::greater<entry>());
+                entry top = heap.back();
+                heap.pop_back();
+
+                if (top.first > row[top.second])    // Stale entry of a node that has been reached by a shorter path since
+                {
+                    continue;
+                }
 
-                for (int i = 0; i < n; i++)
+                for (size_t edge = graph.offsets[top.second]; edge < graph.offsets[top.second + 1]; edge++)
                 {
-                    if (edgeWeights[pair.first][i] > maxWeight)
+                    uint32_t next = graph.targets[edge];
+                    distance_type alt = top.first + graph.weights[edge];
+
+                    if (alt < row[next])
                     {
-                        maxWeight = edgeWeights[pair.first][i];
+                        row[next] = alt;
+                        heap.emplace_back(alt, next);
+                        std::push_heap(heap.begin(), heap.end(), std::greater<entry>());
                     }
                 }
             }
         }
+    };
 
-        // This function stores the intermediate results, which can be reused when calling this function again
-        distance_type distance(const node_type& source, const node_type& target) override
-        {
-            if (source < 0 || source > matrix.size() || target < 0 || target > matrix.size())
-            {
-                throw std::runtime_error("Invalid node ID");
-            }
-
-            distance_type existingDistance = distances[source][target - 1];
+    // Dijkstra from a single source that stops extending paths after a maximum number of hops
+    // One run yields the distances to every node within the radius, so it answers all queries from the same source
+    template<typename node_type, typename distance_type>
+    class BoundedDijkstra
+    {
+    private:
+        const std::unordered_map<node_type, std::unordered_set<node_type>>& matrix;
+        unsigned radius;
 
-            if (existingDistance != -1)
-            {
-                return existingDistance;
-            }
+    public:
+        BoundedDijkstra(const std::unordered_map<node_type, std::unordered_set<node_type>>& matrix, unsigned radius)
+            : matrix(matrix), radius(radius)
+        {}
 
-            std::multiset<std::pair<distance_type, node_type>> q;
-            std::vector<distance_type> dist;
-            std::vector<node_type> prev;
-            dist.assign(matrix.size(), std::numeric_limits<distance_type>::max());
-            prev.assign(matrix.size(), -1);
-            dist[source - 1] = 0;
-            q.insert(std::make_pair(0, source));
+        // Nodes missing from the result are unreachable within the radius
+        template<typename WeightFunction>
+        std::unordered_map<node_type, distance_type> distances(const node_type& source, WeightFunction weight) const
+        {
+            using entry = std::tuple<distance_type, unsigned, node_type>;  // Distance, hops and node
+            std::priority_queue<entry, std::vector<entry>, std::greater<entry>> queue;
+            std::unordered_map<node_type, distance_type> settled;
+            queue.emplace(0, 0, source);
 
-            for (const auto& pair : matrix)
+            while (!queue.empty())
             {
-                auto& v = pair.first;
+                entry top = queue.top();
+                queue.pop();
+                const node_type& node = std::get<2>(top);
 
-                if (v != source)
+                if (!settled.emplace(node, std::get<0>(top)).second || std::get<1>(top) == radius)
                 {
-                    prev[v - 1] = -1;
-                    dist[v - 1] = std::numeric_limits<distance_type>::max();
-                    q.insert(std::make_pair(std::numeric_limits<distance_type>::max(), v));
+                    continue;
                 }
-            }
 
-            while (!q.empty())
-            {
-                auto& u = *q.begin();
-                q.erase(q.begin());
+                auto it = matrix.find(node);
 
-                for (const auto& v : matrix.at(u.second))
+                if (it == matrix.end())
                 {
-                    double weight = (maxWeight - edgeWeights[u.second - 1][v - 1]) + 1;
-                    distance_type alt = dist[u.second - 1] + weight;
+                    continue;
+                }
 
-                    if (alt < dist[v - 1])
+                for (const node_type& next : it->second)
+                {
+                    if (settled.find(next) == settled.end())
                     {
-                        prev[v - 1] = u.second;
-                        dist[v - 1] = alt;
-                        q.insert(std::make_pair(alt, v));
+                        queue.emplace(std::get<0>(top) + weight(node, next), std::get<1>(top) + 1, next);
                     }
                 }
             }
 
-            distances[source] = dist;
-            return dist[target - 1];
+            return settled;
         }
     };
-}
\ No newline at end of file
+}
@@ -73,6 +73,45 @@ InnerProductDistanceSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const
     return 1.0f - InnerProductSIMD4ExtAVX(pVect1v, pVect2v, qty_ptr);
 }
 
+static void
+InnerProductSIMD4ExtAVXBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+    size_t qty4 = qty / 4 * 4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256 sum256[4];
+        for (int t = 0; t < 4; t++)
+            sum256[t] = _mm256_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 8) {
+            __m256 v1 = _mm256_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum256[t] = _mm256_add_ps(sum256[t], _mm256_mul_ps(v1, _mm256_loadu_ps((float *) pVect2v[i + t] + j)));
+        }
+
+        __m128 sum_prod[4];
+        for (int t = 0; t < 4; t++)
+            sum_prod[t] = _mm_add_ps(_mm256_extractf128_ps(sum256[t], 0), _mm256_extractf128_ps(sum256[t], 1));
+
+        for (size_t j = qty16; j < qty4; j += 4) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum_prod[t] = _mm_add_ps(sum_prod[t], _mm_mul_ps(v1, _mm_loadu_ps((float *) pVect2v[i + t] + j)));
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm_store_ps(TmpRes, sum_prod[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = InnerProductSIMD4ExtAVX(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 #if defined(USE_SSE)
@@ -138,6 +177,34 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
     return 1.0f - InnerProductSIMD4ExtSSE(pVect1v, pVect2v, qty_ptr);
 }
 
+static void
+InnerProductSIMD4ExtSSEBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty / 4 * 4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum_prod[4];
+        for (int t = 0; t < 4; t++)
+            sum_prod[t] = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum_prod[t] = _mm_add_ps(sum_prod[t], _mm_mul_ps(v1, _mm_loadu_ps((float *) pVect2v[i + t] + j)));
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm_store_ps(TmpRes, sum_prod[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = InnerProductSIMD4ExtSSE(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 
@@ -203,6 +270,32 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
     return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
 }
 
+// Four inner products at a time, loading each block of the first vector once for all four
+static void
+InnerProductSIMD16ExtAVX512Batch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m512 sum512[4];
+        for (int t = 0; t < 4; t++)
+            sum512[t] = _mm512_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 16) {
+            __m512 v1 = _mm512_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum512[t] = _mm512_fmadd_ps(v1, _mm512_loadu_ps((float *) pVect2v[i + t] + j), sum512[t]);
+        }
+
+        for (int t = 0; t < 4; t++)
+            res[i + t] = _mm512_reduce_add_ps(sum512[t]);
+    }
+    for (; i < count; i++)
+        res[i] = InnerProductSIMD16ExtAVX512(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 #if defined(USE_AVX)
@@ -248,6 +341,34 @@ InnerProductDistanceSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const
     return 1.0f - InnerProductSIMD16ExtAVX(pVect1v, pVect2v, qty_ptr);
 }
 
+static void
+InnerProductSIMD16ExtAVXBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256 sum256[4];
+        for (int t = 0; t < 4; t++)
+            sum256[t] = _mm256_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 8) {
+            __m256 v1 = _mm256_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum256[t] = _mm256_add_ps(sum256[t], _mm256_mul_ps(v1, _mm256_loadu_ps((float *) pVect2v[i + t] + j)));
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm256_store_ps(TmpRes, sum256[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = InnerProductSIMD16ExtAVX(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 #if defined(USE_SSE)
@@ -302,6 +423,34 @@ InnerProductDistanceSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const
     return 1.0f - InnerProductSIMD16ExtSSE(pVect1v, pVect2v, qty_ptr);
 }
 
+static void
+InnerProductSIMD16ExtSSEBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum_prod[4];
+        for (int t = 0; t < 4; t++)
+            sum_prod[t] = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 4) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++)
+                sum_prod[t] = _mm_add_ps(sum_prod[t], _mm_mul_ps(v1, _mm_loadu_ps((float *) pVect2v[i + t] + j)));
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm_store_ps(TmpRes, sum_prod[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = InnerProductSIMD16ExtSSE(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
@@ -309,6 +458,8 @@ static DISTFUNC<float> InnerProductSIMD16Ext = InnerProductSIMD16ExtSSE;
 static DISTFUNC<float> InnerProductSIMD4Ext = InnerProductSIMD4ExtSSE;
 static DISTFUNC<float> InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtSSE;
 static DISTFUNC<float> InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtSSE;
+static BATCHDISTFUNC<float> InnerProductSIMD16ExtBatch = InnerProductSIMD16ExtSSEBatch;
+static BATCHDISTFUNC<float> InnerProductSIMD4ExtBatch = InnerProductSIMD4ExtSSEBatch;
 
 static float
 InnerProductDistanceSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
@@ -337,10 +488,50 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 
     return 1.0f - (res + res_tail);
 }
+
+// The batched kernels compute inner products, turned into distances as by the single kernels
+static void
+InnerProductDistanceSIMD16ExtBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    InnerProductSIMD16ExtBatch(pVect1v, pVect2v, count, qty_ptr, res);
+    for (size_t i = 0; i < count; i++)
+        res[i] = 1.0f - res[i];
+}
+
+static void
+InnerProductDistanceSIMD4ExtBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    InnerProductSIMD4ExtBatch(pVect1v, pVect2v, count, qty_ptr, res);
+    for (size_t i = 0; i < count; i++)
+        res[i] = 1.0f - res[i];
+}
+
+static void
+InnerProductDistanceSIMD16ExtResidualsBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    InnerProductSIMD16ExtBatch(pVect1v, pVect2v, count, &qty16, res);
+    float *pVect1 = (float *) pVect1v + qty16;
+
+    size_t qty_left = qty - qty16;
+    for (size_t i = 0; i < count; i++)
+        res[i] = 1.0f - (res[i] + InnerProduct(pVect1, (float *) pVect2v[i] + qty16, &qty_left));
+}
+
+static void
+InnerProductDistanceSIMD4ExtResidualsBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    InnerProductSIMD4ExtBatch(pVect1v, pVect2v, count, &qty4, res);
+    float *pVect1 = (float *) pVect1v + qty4;
+
+    size_t qty_left = qty - qty4;
+    for (size_t i = 0; i < count; i++)
+        res[i] = 1.0f - (res[i] + InnerProduct(pVect1, (float *) pVect2v[i] + qty4, &qty_left));
+}
 #endif
 
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> fstbatchdistfunc_{nullptr};
     size_t data_size_;
     size_t dim_;
 
@@ -352,31 +543,40 @@ class InnerProductSpace : public SpaceInterface<float> {
         if (AVX512Capable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
+            InnerProductSIMD16ExtBatch = InnerProductSIMD16ExtAVX512Batch;
         } else if (AVXCapable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
+            InnerProductSIMD16ExtBatch = InnerProductSIMD16ExtAVXBatch;
         }
     #elif defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
+            InnerProductSIMD16ExtBatch = InnerProductSIMD16ExtAVXBatch;
         }
     #endif
     #if defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
             InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX;
+            InnerProductSIMD4ExtBatch = InnerProductSIMD4ExtAVXBatch;
         }
     #endif
 
-        if (dim % 16 == 0)
+        if (dim % 16 == 0) {
             fstdistfunc_ = InnerProductDistanceSIMD16Ext;
-        else if (dim % 4 == 0)
+            fstbatchdistfunc_ = InnerProductDistanceSIMD16ExtBatch;
+        } else if (dim % 4 == 0) {
             fstdistfunc_ = InnerProductDistanceSIMD4Ext;
-        else if (dim > 16)
+            fstbatchdistfunc_ = InnerProductDistanceSIMD4ExtBatch;
+        } else if (dim > 16) {
             fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
-        else if (dim > 4)
+            fstbatchdistfunc_ = InnerProductDistanceSIMD16ExtResidualsBatch;
+        } else if (dim > 4) {
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+            fstbatchdistfunc_ = InnerProductDistanceSIMD4ExtResidualsBatch;
+        }
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -390,6 +590,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return fstbatchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
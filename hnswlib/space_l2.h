@@ -52,6 +52,39 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 
     return (res);
 }
+
+// Four distances at a time, loading each block of the first vector once for all four
+static void
+L2SqrSIMD16ExtAVX512Batch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN64 TmpRes[16];
+    size_t qty16 = qty >> 4 << 4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m512 sum[4];
+        for (int t = 0; t < 4; t++)
+            sum[t] = _mm512_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 16) {
+            __m512 v1 = _mm512_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++) {
+                __m512 diff = _mm512_sub_ps(v1, _mm512_loadu_ps((float *) pVect2v[i + t] + j));
+                sum[t] = _mm512_add_ps(sum[t], _mm512_mul_ps(diff, diff));
+            }
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm512_store_ps(TmpRes, sum[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] +
+                    TmpRes[7] + TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] +
+                    TmpRes[13] + TmpRes[14] + TmpRes[15];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = L2SqrSIMD16ExtAVX512(pVect1v, pVect2v[i], qty_ptr);
+}
 #endif
 
 #if defined(USE_AVX)
@@ -90,6 +123,36 @@ L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
 }
 
+static void
+L2SqrSIMD16ExtAVXBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty16 = qty >> 4 << 4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256 sum[4];
+        for (int t = 0; t < 4; t++)
+            sum[t] = _mm256_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 8) {
+            __m256 v1 = _mm256_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++) {
+                __m256 diff = _mm256_sub_ps(v1, _mm256_loadu_ps((float *) pVect2v[i + t] + j));
+                sum[t] = _mm256_add_ps(sum[t], _mm256_mul_ps(diff, diff));
+            }
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm256_store_ps(TmpRes, sum[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = L2SqrSIMD16ExtAVX(pVect1v, pVect2v[i], qty_ptr);
+}
+
 #endif
 
 #if defined(USE_SSE)
@@ -141,10 +204,41 @@ L2SqrSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     _mm_store_ps(TmpRes, sum);
     return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 }
+
+static void
+L2SqrSIMD16ExtSSEBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty16 = qty >> 4 << 4;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum[4];
+        for (int t = 0; t < 4; t++)
+            sum[t] = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 4) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++) {
+                __m128 diff = _mm_sub_ps(v1, _mm_loadu_ps((float *) pVect2v[i + t] + j));
+                sum[t] = _mm_add_ps(sum[t], _mm_mul_ps(diff, diff));
+            }
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm_store_ps(TmpRes, sum[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = L2SqrSIMD16ExtSSE(pVect1v, pVect2v[i], qty_ptr);
+}
 #endif
 
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
 static DISTFUNC<float> L2SqrSIMD16Ext = L2SqrSIMD16ExtSSE;
+static BATCHDISTFUNC<float> L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtSSEBatch;
 
 static float
 L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
@@ -203,10 +297,65 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 
     return (res + res_tail);
 }
+
+static void
+L2SqrSIMD16ExtResidualsBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    L2SqrSIMD16ExtBatch(pVect1v, pVect2v, count, &qty16, res);
+    float *pVect1 = (float *) pVect1v + qty16;
+
+    size_t qty_left = qty - qty16;
+    for (size_t i = 0; i < count; i++)
+        res[i] += L2Sqr(pVect1, (float *) pVect2v[i] + qty16, &qty_left);
+}
+
+static void
+L2SqrSIMD4ExtBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum[4];
+        for (int t = 0; t < 4; t++)
+            sum[t] = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + j);
+            for (int t = 0; t < 4; t++) {
+                __m128 diff = _mm_sub_ps(v1, _mm_loadu_ps((float *) pVect2v[i + t] + j));
+                sum[t] = _mm_add_ps(sum[t], _mm_mul_ps(diff, diff));
+            }
+        }
+
+        for (int t = 0; t < 4; t++) {
+            _mm_store_ps(TmpRes, sum[t]);
+            res[i + t] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < count; i++)
+        res[i] = L2SqrSIMD4Ext(pVect1v, pVect2v[i], qty_ptr);
+}
+
+static void
+L2SqrSIMD4ExtResidualsBatch(const void *pVect1v, const void *const *pVect2v, size_t count, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    L2SqrSIMD4ExtBatch(pVect1v, pVect2v, count, &qty4, res);
+    float *pVect1 = (float *) pVect1v + qty4;
+
+    size_t qty_left = qty - qty4;
+    for (size_t i = 0; i < count; i++)
+        res[i] += L2Sqr(pVect1, (float *) pVect2v[i] + qty4, &qty_left);
+}
 #endif
 
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> fstbatchdistfunc_{nullptr};
     size_t data_size_;
     size_t dim_;
 
@@ -215,23 +364,33 @@ class L2Space : public SpaceInterface<float> {
         fstdistfunc_ = L2Sqr;
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
     #if defined(USE_AVX512)
-        if (AVX512Capable())
+        if (AVX512Capable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVX512Batch;
+        } else if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVXBatch;
+        }
     #elif defined(USE_AVX)
-        if (AVXCapable())
+        if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVXBatch;
+        }
     #endif
 
-        if (dim % 16 == 0)
+        if (dim % 16 == 0) {
             fstdistfunc_ = L2SqrSIMD16Ext;
-        else if (dim % 4 == 0)
+            fstbatchdistfunc_ = L2SqrSIMD16ExtBatch;
+        } else if (dim % 4 == 0) {
             fstdistfunc_ = L2SqrSIMD4Ext;
-        else if (dim > 16)
+            fstbatchdistfunc_ = L2SqrSIMD4ExtBatch;
+        } else if (dim > 16) {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
-        else if (dim > 4)
+            fstbatchdistfunc_ = L2SqrSIMD16ExtResidualsBatch;
+        } else if (dim > 4) {
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+            fstbatchdistfunc_ = L2SqrSIMD4ExtResidualsBatch;
+        }
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -245,6 +404,10 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return fstbatchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -0,0 +1,251 @@
+#pragma once
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace hnswlib {
+
+// Product quantization splits a vector into m subvectors and codes each by the nearest of 256 centroids of its subspace
+struct PQParams {
+    size_t dim;
+    size_t m;
+    size_t sub_dim;
+    std::vector<float> centroids;       // m * 256 * sub_dim
+    std::vector<float> code_distances;  // m * 256 * 256 distances between the centroids of each subspace
+};
+
+static const size_t kPQCentroids = 256;
+
+// Sum of one table entry per subspace, picked by the code of that subspace
+static float
+PQTableSum(const float *table, const uint8_t *code, size_t m, size_t stride) {
+    float res0 = 0, res1 = 0, res2 = 0, res3 = 0;
+    size_t j = 0;
+    for (; j + 4 <= m; j += 4) {
+        res0 += table[j * stride + code[j]];
+        res1 += table[(j + 1) * stride + code[j + 1]];
+        res2 += table[(j + 2) * stride + code[j + 2]];
+        res3 += table[(j + 3) * stride + code[j + 3]];
+    }
+    for (; j < m; j++)
+        res0 += table[j * stride + code[j]];
+    return (res0 + res1) + (res2 + res3);
+}
+
+// Distances between two codes, from the distances between the centroids they stand for
+static float
+PQSymmetricL2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const PQParams *params = (const PQParams *) qty_ptr;
+    const uint8_t *code1 = (const uint8_t *) pVect1v;
+    const uint8_t *code2 = (const uint8_t *) pVect2v;
+    const float *table = params->code_distances.data();
+    float res = 0;
+    for (size_t j = 0; j < params->m; j++)
+        res += table[(j * kPQCentroids + code1[j]) * kPQCentroids + code2[j]];
+    return res;
+}
+
+static float
+PQSymmetricInnerProductDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - PQSymmetricL2Sqr(pVect1v, pVect2v, qty_ptr);
+}
+
+// Distances from a query, encoded as the table of its distances to all centroids, to a code
+static float
+PQTableL2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const PQParams *params = (const PQParams *) qty_ptr;
+    return PQTableSum((const float *) pVect1v, (const uint8_t *) pVect2v, params->m, kPQCentroids);
+}
+
+static float
+PQTableInnerProductDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - PQTableL2Sqr(pVect1v, pVect2v, qty_ptr);
+}
+
+// Vectors stored as m bytes, one centroid index per subspace, learned from sample vectors by train()
+// The graph is built with the distances between centroids, which take m * 256 KB, and searched with a table of the
+// distances from the query to every centroid, computed once per query
+class PQSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> querydistfunc_;
+    PQParams params_;
+    L2Space exact_l2_;
+    InnerProductSpace exact_ip_;
+    SpaceMetric metric_;
+    bool trained_ = false;
+
+    float subDistance(const float *x, const float *y) const {
+        if (metric_ == SpaceMetric::L2) {
+            float res = 0;
+            for (size_t i = 0; i < params_.sub_dim; i++) {
+                float t = x[i] - y[i];
+                res += t * t;
+            }
+            return res;
+        }
+        float res = 0;
+        for (size_t i = 0; i < params_.sub_dim; i++)
+            res += x[i] * y[i];
+        return res;
+    }
+
+    // Index of the centroid of subspace j nearest to the subvector x
+    uint8_t nearestCentroid(size_t j, const float *x) const {
+        const float *centroids = params_.centroids.data() + j * kPQCentroids * params_.sub_dim;
+        size_t best = 0;
+        float best_distance = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < kPQCentroids; c++) {
+            float distance = 0;
+            for (size_t i = 0; i < params_.sub_dim; i++) {
+                float t = x[i] - centroids[c * params_.sub_dim + i];
+                distance += t * t;
+            }
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = c;
+            }
+        }
+        return (uint8_t) best;
+    }
+
+    void computeCodeDistances() {
+        params_.code_distances.resize(params_.m * kPQCentroids * kPQCentroids);
+        for (size_t j = 0; j < params_.m; j++) {
+            const float *centroids = params_.centroids.data() + j * kPQCentroids * params_.sub_dim;
+            float *table = params_.code_distances.data() + j * kPQCentroids * kPQCentroids;
+            for (size_t a = 0; a < kPQCentroids; a++) {
+                for (size_t b = 0; b < kPQCentroids; b++)
+                    table[a * kPQCentroids + b] = subDistance(centroids + a * params_.sub_dim, centroids + b * params_.sub_dim);
+            }
+        }
+        trained_ = true;
+    }
+
+ public:
+    PQSpace(size_t dim, size_t m, SpaceMetric metric = SpaceMetric::L2) : exact_l2_(dim), exact_ip_(dim), metric_(metric) {
+        if (m == 0 || dim % m != 0)
+            throw std::runtime_error("PQSpace needs a number of subspaces dividing the dimension");
+        bool l2 = metric == SpaceMetric::L2;
+        fstdistfunc_ = l2 ? PQSymmetricL2Sqr : PQSymmetricInnerProductDistance;
+        querydistfunc_ = l2 ? PQTableL2Sqr : PQTableInnerProductDistance;
+        params_.dim = dim;
+        params_.m = m;
+        params_.sub_dim = dim / m;
+    }
+
+    // Learns the centroids of each subspace from n float vectors with k-means
+    void train(const float *data, size_t n, size_t iterations = 25, unsigned seed = 100) {
+        if (n < kPQCentroids)
+            throw std::runtime_error("PQSpace needs at least 256 sample vectors for training");
+
+        size_t sub_dim = params_.sub_dim;
+        params_.centroids.resize(params_.m * kPQCentroids * sub_dim);
+        std::mt19937 rng(seed);
+        std::vector<size_t> order(n);
+        std::vector<uint8_t> assignment(n);
+        std::vector<size_t> counts(kPQCentroids);
+
+        for (size_t j = 0; j < params_.m; j++) {
+            float *centroids = params_.centroids.data() + j * kPQCentroids * sub_dim;
+            auto sample = [&](size_t i) { return data + i * params_.dim + j * sub_dim; };
+
+            for (size_t i = 0; i < n; i++)
+                order[i] = i;
+            std::shuffle(order.begin(), order.end(), rng);
+            for (size_t c = 0; c < kPQCentroids; c++)
+                std::copy(sample(order[c]), sample(order[c]) + sub_dim, centroids + c * sub_dim);
+
+            for (size_t iteration = 0; iteration < iterations; iteration++) {
+                for (size_t i = 0; i < n; i++)
+                    assignment[i] = nearestCentroid(j, sample(i));
+
+                std::fill(centroids, centroids + kPQCentroids * sub_dim, 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t i = 0; i < n; i++) {
+                    counts[assignment[i]]++;
+                    for (size_t d = 0; d < sub_dim; d++)
+                        centroids[assignment[i] * sub_dim + d] += sample(i)[d];
+                }
+                for (size_t c = 0; c < kPQCentroids; c++) {
+                    // Empty clusters restart at a random sample
+                    if (!counts[c]) {
+                        const float *x = sample(rng() % n);
+                        std::copy(x, x + sub_dim, centroids + c * sub_dim);
+                        continue;
+                    }
+                    for (size_t d = 0; d < sub_dim; d++)
+                        centroids[c * sub_dim + d] /= counts[c];
+                }
+            }
+        }
+        computeCodeDistances();
+    }
+
+    // Restores the centroids of an earlier training, such as the one an index was built with
+    void setCentroids(const std::vector<float> &centroids) {
+        if (centroids.size() != params_.m * kPQCentroids * params_.sub_dim)
+            throw std::runtime_error("PQSpace centroids do not match the dimension and subspaces");
+        params_.centroids = centroids;
+        computeCodeDistances();
+    }
+
+    const std::vector<float> &getCentroids() const {
+        return params_.centroids;
+    }
+
+    size_t get_data_size() {
+        return params_.m;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &params_;
+    }
+
+    SpaceInterface<float> *get_exact_space() {
+        if (metric_ == SpaceMetric::L2)
+            return &exact_l2_;
+        return &exact_ip_;
+    }
+
+    void encode(const void *vector, void *code) {
+        if (!trained_)
+            throw std::runtime_error("PQSpace must be trained before vectors are added or searched");
+
+        const float *input = (const float *) vector;
+        uint8_t *output = (uint8_t *) code;
+        for (size_t j = 0; j < params_.m; j++)
+            output[j] = nearestCentroid(j, input + j * params_.sub_dim);
+    }
+
+    size_t get_query_size() {
+        return params_.m * kPQCentroids * sizeof(float);
+    }
+
+    void encode_query(const void *vector, void *query) {
+        if (!trained_)
+            throw std::runtime_error("PQSpace must be trained before vectors are added or searched");
+
+        const float *input = (const float *) vector;
+        float *table = (float *) query;
+        for (size_t j = 0; j < params_.m; j++) {
+            const float *centroids = params_.centroids.data() + j * kPQCentroids * params_.sub_dim;
+            for (size_t c = 0; c < kPQCentroids; c++)
+                table[j * kPQCentroids + c] = subDistance(input + j * params_.sub_dim, centroids + c * params_.sub_dim);
+        }
+    }
+
+    DISTFUNC<float> get_query_dist_func() {
+        return querydistfunc_;
+    }
+
+    ~PQSpace() {}
+};
+
+}  // namespace hnswlib
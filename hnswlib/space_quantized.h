@@ -0,0 +1,491 @@
+#pragma once
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace hnswlib {
+
+enum class SpaceMetric {
+    L2,
+    InnerProduct
+};
+
+// Half precision conversions, rounding to the nearest even value
+static uint16_t
+floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+static float
+halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (!mantissa) {
+        bits = sign;
+    } else {
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static float
+Float16L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float t = halfToFloat(pVect1[i]) - halfToFloat(pVect2[i]);
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+Float16InnerProduct(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++)
+        res += halfToFloat(pVect1[i]) * halfToFloat(pVect2[i]);
+    return res;
+}
+
+static float
+Float16InnerProductDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - Float16InnerProduct(pVect1v, pVect2v, qty_ptr);
+}
+
+#if defined(USE_AVX512)
+
+static float
+Float16L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 v1 = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (pVect1 + i)));
+        __m512 v2 = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (pVect2 + i)));
+        __m512 diff = _mm512_sub_ps(v1, v2);
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+
+    size_t qty_left = qty - qty16;
+    return _mm512_reduce_add_ps(sum) + Float16L2Sqr(pVect1 + qty16, pVect2 + qty16, &qty_left);
+}
+
+static float
+Float16InnerProductDistanceAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 v1 = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (pVect1 + i)));
+        __m512 v2 = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) (pVect2 + i)));
+        sum = _mm512_fmadd_ps(v1, v2, sum);
+    }
+
+    size_t qty_left = qty - qty16;
+    return 1.0f - (_mm512_reduce_add_ps(sum) + Float16InnerProduct(pVect1 + qty16, pVect2 + qty16, &qty_left));
+}
+
+#endif
+
+#if defined(USE_AVX) && defined(__F16C__)
+
+static float
+Float16L2SqrAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 v1 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (pVect1 + i)));
+        __m256 v2 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (pVect2 + i)));
+        __m256 diff = _mm256_sub_ps(v1, v2);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    size_t qty_left = qty - qty8;
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+            Float16L2Sqr(pVect1 + qty8, pVect2 + qty8, &qty_left);
+}
+
+static float
+Float16InnerProductDistanceAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    uint16_t *pVect1 = (uint16_t *) pVect1v;
+    uint16_t *pVect2 = (uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 v1 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (pVect1 + i)));
+        __m256 v2 = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) (pVect2 + i)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(v1, v2));
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    size_t qty_left = qty - qty8;
+    return 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+            Float16InnerProduct(pVect1 + qty8, pVect2 + qty8, &qty_left));
+}
+
+#endif
+
+// Half precision vectors, at half the memory of float vectors
+class Float16Space : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    L2Space exact_l2_;
+    InnerProductSpace exact_ip_;
+    SpaceMetric metric_;
+
+ public:
+    Float16Space(size_t dim, SpaceMetric metric = SpaceMetric::L2) : exact_l2_(dim), exact_ip_(dim), metric_(metric) {
+        bool l2 = metric == SpaceMetric::L2;
+        fstdistfunc_ = l2 ? Float16L2Sqr : Float16InnerProductDistance;
+#if defined(USE_AVX) && defined(__F16C__)
+        if (AVXCapable())
+            fstdistfunc_ = l2 ? Float16L2SqrAVX : Float16InnerProductDistanceAVX;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = l2 ? Float16L2SqrAVX512 : Float16InnerProductDistanceAVX512;
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    SpaceInterface<float> *get_exact_space() {
+        if (metric_ == SpaceMetric::L2)
+            return &exact_l2_;
+        return &exact_ip_;
+    }
+
+    void encode(const void *vector, void *code) {
+        const float *input = (const float *) vector;
+        uint16_t *output = (uint16_t *) code;
+        for (size_t i = 0; i < dim_; i++)
+            output[i] = floatToHalf(input[i]);
+    }
+
+    ~Float16Space() {}
+};
+
+// Dimension and per-dimension offsets and scales of int8 codes, which stand for offset + code * scale
+struct Int8Params {
+    size_t dim;
+    std::vector<float> offset;
+    std::vector<float> scale;
+};
+
+static float
+Int8L2Sqr(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *scale = params->scale.data();
+
+    float res = 0;
+    for (size_t i = 0; i < params->dim; i++) {
+        float t = ((float) pVect1[i] - (float) pVect2[i]) * scale[i];
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+Int8InnerProductDistance(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *offset = params->offset.data();
+    const float *scale = params->scale.data();
+
+    float res = 0;
+    for (size_t i = 0; i < params->dim; i++)
+        res += (offset[i] + pVect1[i] * scale[i]) * (offset[i] + pVect2[i] * scale[i]);
+    return 1.0f - res;
+}
+
+#if defined(USE_AVX512)
+
+static float
+Int8L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *scale = params->scale.data();
+    size_t qty16 = params->dim >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 v1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *) (pVect1 + i))));
+        __m512 v2 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *) (pVect2 + i))));
+        __m512 diff = _mm512_mul_ps(_mm512_sub_ps(v1, v2), _mm512_loadu_ps(scale + i));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+
+    float res = _mm512_reduce_add_ps(sum);
+    for (size_t i = qty16; i < params->dim; i++) {
+        float t = ((float) pVect1[i] - (float) pVect2[i]) * scale[i];
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+Int8InnerProductDistanceAVX512(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *offset = params->offset.data();
+    const float *scale = params->scale.data();
+    size_t qty16 = params->dim >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 o = _mm512_loadu_ps(offset + i);
+        __m512 s = _mm512_loadu_ps(scale + i);
+        __m512 v1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *) (pVect1 + i))));
+        __m512 v2 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *) (pVect2 + i))));
+        sum = _mm512_fmadd_ps(_mm512_fmadd_ps(v1, s, o), _mm512_fmadd_ps(v2, s, o), sum);
+    }
+
+    float res = _mm512_reduce_add_ps(sum);
+    for (size_t i = qty16; i < params->dim; i++)
+        res += (offset[i] + pVect1[i] * scale[i]) * (offset[i] + pVect2[i] * scale[i]);
+    return 1.0f - res;
+}
+
+#endif
+
+#if defined(USE_AVX) && defined(__AVX2__)
+
+static float
+Int8L2SqrAVX2(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *scale = params->scale.data();
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = params->dim >> 3 << 3;
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 v1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pVect1 + i))));
+        __m256 v2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pVect2 + i))));
+        __m256 diff = _mm256_mul_ps(_mm256_sub_ps(v1, v2), _mm256_loadu_ps(scale + i));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (size_t i = qty8; i < params->dim; i++) {
+        float t = ((float) pVect1[i] - (float) pVect2[i]) * scale[i];
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+Int8InnerProductDistanceAVX2(const void *pVect1v, const void *pVect2v, const void *params_ptr) {
+    uint8_t *pVect1 = (uint8_t *) pVect1v;
+    uint8_t *pVect2 = (uint8_t *) pVect2v;
+    const Int8Params *params = (const Int8Params *) params_ptr;
+    const float *offset = params->offset.data();
+    const float *scale = params->scale.data();
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = params->dim >> 3 << 3;
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 o = _mm256_loadu_ps(offset + i);
+        __m256 s = _mm256_loadu_ps(scale + i);
+        __m256 v1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pVect1 + i))));
+        __m256 v2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pVect2 + i))));
+        __m256 x1 = _mm256_add_ps(o, _mm256_mul_ps(v1, s));
+        __m256 x2 = _mm256_add_ps(o, _mm256_mul_ps(v2, s));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(x1, x2));
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (size_t i = qty8; i < params->dim; i++)
+        res += (offset[i] + pVect1[i] * scale[i]) * (offset[i] + pVect2[i] * scale[i]);
+    return 1.0f - res;
+}
+
+#endif
+
+// Vectors quantized to one byte per dimension, at a quarter of the memory of float vectors
+// Each dimension maps its range of values to 256 steps, learned from sample vectors by train()
+class Int8Space : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    Int8Params params_;
+    L2Space exact_l2_;
+    InnerProductSpace exact_ip_;
+    SpaceMetric metric_;
+    bool trained_ = false;
+
+ public:
+    Int8Space(size_t dim, SpaceMetric metric = SpaceMetric::L2) : exact_l2_(dim), exact_ip_(dim), metric_(metric) {
+        bool l2 = metric == SpaceMetric::L2;
+        fstdistfunc_ = l2 ? Int8L2Sqr : Int8InnerProductDistance;
+#if defined(USE_AVX) && defined(__AVX2__)
+        if (AVXCapable())
+            fstdistfunc_ = l2 ? Int8L2SqrAVX2 : Int8InnerProductDistanceAVX2;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = l2 ? Int8L2SqrAVX512 : Int8InnerProductDistanceAVX512;
+#endif
+        params_.dim = dim;
+        params_.offset.assign(dim, 0.0f);
+        params_.scale.assign(dim, 0.0f);
+        data_size_ = dim * sizeof(uint8_t);
+    }
+
+    // Takes the range of each dimension from n float vectors
+    void train(const float *data, size_t n) {
+        if (n == 0)
+            throw std::runtime_error("Int8Space needs sample vectors for training");
+
+        std::vector<float> max_value(data, data + params_.dim);
+        params_.offset.assign(data, data + params_.dim);
+        for (size_t i = 1; i < n; i++) {
+            for (size_t d = 0; d < params_.dim; d++) {
+                params_.offset[d] = std::min(params_.offset[d], data[i * params_.dim + d]);
+                max_value[d] = std::max(max_value[d], data[i * params_.dim + d]);
+            }
+        }
+        for (size_t d = 0; d < params_.dim; d++)
+            params_.scale[d] = (max_value[d] - params_.offset[d]) / 255.0f;
+        trained_ = true;
+    }
+
+    // Restores the ranges of an earlier training, such as the one an index was built with
+    void setRanges(const std::vector<float> &offset, const std::vector<float> &scale) {
+        if (offset.size() != params_.dim || scale.size() != params_.dim)
+            throw std::runtime_error("Int8Space ranges do not match the dimension");
+        params_.offset = offset;
+        params_.scale = scale;
+        trained_ = true;
+    }
+
+    const std::vector<float> &getOffsets() const {
+        return params_.offset;
+    }
+
+    const std::vector<float> &getScales() const {
+        return params_.scale;
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &params_;
+    }
+
+    SpaceInterface<float> *get_exact_space() {
+        if (metric_ == SpaceMetric::L2)
+            return &exact_l2_;
+        return &exact_ip_;
+    }
+
+    // Values outside the trained range are clamped to it
+    void encode(const void *vector, void *code) {
+        if (!trained_)
+            throw std::runtime_error("Int8Space must be trained before vectors are added or searched");
+
+        const float *input = (const float *) vector;
+        uint8_t *output = (uint8_t *) code;
+        for (size_t d = 0; d < params_.dim; d++) {
+            float step = params_.scale[d] > 0 ? (input[d] - params_.offset[d]) / params_.scale[d] : 0.0f;
+            output[d] = (uint8_t) std::min(255.0f, std::max(0.0f, std::round(step)));
+        }
+    }
+
+    ~Int8Space() {}
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace hnswlib
+{
+    inline unsigned countTrailingZeros(uint64_t word) noexcept
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+    }
+
+    // Relaxed atomic access to the words of dense chunks, which queries keep reading while an insertion sets a bit
+    // Writers of the same bitmap are serialized by the caller, so a plain store of the new word suffices
+    inline uint64_t loadWord(const uint64_t* word) noexcept
+    {
+#ifdef _MSC_VER
+        return *(const volatile uint64_t*) word;
+#else
+        return __atomic_load_n(word, __ATOMIC_RELAXED);
+#endif
+    }
+
+    inline void storeWord(uint64_t* word, uint64_t value) noexcept
+    {
+#ifdef _MSC_VER
+        *(volatile uint64_t*) word = value;
+#else
+        __atomic_store_n(word, value, __ATOMIC_RELAXED);
+#endif
+    }
+
+    // Compressed bitmap of internal IDs in the style of roaring bitmaps
+    // The ID space is split into chunks of 2^16 IDs, where sparse chunks store the sorted low 16 bits and dense chunks store a bitset
+    template<typename T>
+    class TagBitmap
+    {
+    public:
+        static constexpr unsigned CHUNK_BITS = 16;
+        static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+        static constexpr size_t CHUNK_WORDS = CHUNK_SIZE / 64;
+        static constexpr size_t ARRAY_LIMIT = 4096;  // Beyond this many entries, a bitset is smaller than an array
+
+        struct Container
+        {
+            uint32_t key;
+            uint32_t cardinality = 0;
+            std::vector<uint16_t> array;
+            std::vector<uint64_t> bits;
+
+            [[nodiscard]] bool dense() const noexcept
+            {
+                return !bits.empty();
+            }
+
+            [[nodiscard]] bool contains(uint16_t low) const noexcept
+            {
+                if (dense())
+                {
+                    return (bits[low >> 6] >> (low & 63)) & 1;
+                }
+
+                return std::binary_search(array.begin(), array.end(), low);
+            }
+        };
+
+    private:
+        std::vector<Container> containers;    // Sorted by key
+
+        typename std::vector<Container>::iterator findContainer(uint32_t key)
+        {
+            return std::lower_bound(containers.begin(), containers.end(), key,
+                [](const Container& container, uint32_t k) { return container.key < k; });
+        }
+
+        typename std::vector<Container>::const_iterator findContainer(uint32_t key) const
+        {
+            return std::lower_bound(containers.begin(), containers.end(), key,
+                [](const Container& container, uint32_t k) { return container.key < k; });
+        }
+
+    public:
+        void add(const T& id)
+        {
+            uint32_t key = static_cast<uint32_t>(id >> CHUNK_BITS);
+            uint16_t low = static_cast<uint16_t>(id & (CHUNK_SIZE - 1));
+            auto it = containers.empty() || containers.back().key < key ? containers.end() : findContainer(key);
+
+            if (it == containers.end() || it->key != key)
+            {
+                it = containers.insert(it, Container());
+                it->key = key;
+            }
+
+            Container& container = *it;
+
+            if (container.dense())
+            {
+                uint64_t* word = &container.bits[low >> 6];
+                uint64_t mask = uint64_t(1) << (low & 63);
+                container.cardinality += (*word & mask) == 0;
+                storeWord(word, *word | mask);
+                return;
+            }
+
+            // IDs are mostly inserted in increasing order, so appending is the common case
+            auto pos = container.array.empty() || container.array.back() < low ?
+                container.array.end() : std::lower_bound(container.array.begin(), container.array.end(), low);
+
+            if (pos != container.array.end() && *pos == low)
+            {
+                return;
+            }
+
+            container.array.insert(pos, low);
+            container.cardinality++;
+
+            if (container.cardinality > ARRAY_LIMIT)
+            {
+                container.bits.assign(CHUNK_WORDS, 0);
+
+                for (uint16_t value : container.array)
+                {
+                    container.bits[value >> 6] |= uint64_t(1) << (value & 63);
+                }
+
+                std::vector<uint16_t>().swap(container.array);
+            }
+        }
+
+        [[nodiscard]] bool contains(const T& id) const noexcept
+        {
+            uint32_t key = static_cast<uint32_t>(id >> CHUNK_BITS);
+            auto it = findContainer(key);
+            return it != containers.end() && it->key == key && it->contains(static_cast<uint16_t>(id & (CHUNK_SIZE - 1)));
+        }
+
+        [[nodiscard]] size_t cardinality() const noexcept
+        {
+            size_t total = 0;
+
+            for (const Container& container : containers)
+            {
+                total += container.cardinality;
+            }
+
+            return total;
+        }
+
+        [[nodiscard]] const std::vector<Container>& getContainers() const noexcept
+        {
+            return containers;
+        }
+
+        void clear() noexcept
+        {
+            containers.clear();
+        }
+
+        void saveIndex(std::ostream& output) const
+        {
+            size_t size = containers.size();
+            output.write((char*) &size, sizeof(size_t));
+
+            for (const Container& container : containers)
+            {
+                output.write((char*) &container.key, sizeof(uint32_t));
+                output.write((char*) &container.cardinality, sizeof(uint32_t));
+
+                if (container.dense())
+                {
+                    output.write((char*) container.bits.data(), sizeof(uint64_t) * CHUNK_WORDS);
+                }
+
+                else
+                {
+                    output.write((char*) container.array.data(), sizeof(uint16_t) * container.cardinality);
+                }
+            }
+        }
+
+        void loadIndex(std::istream& input)
+        {
+            size_t size;
+            input.read((char*) &size, sizeof(size_t));
+            containers.resize(size);
+
+            for (Container& container : containers)
+            {
+                input.read((char*) &container.key, sizeof(uint32_t));
+                input.read((char*) &container.cardinality, sizeof(uint32_t));
+
+                if (container.cardinality > ARRAY_LIMIT)
+                {
+                    container.bits.resize(CHUNK_WORDS);
+                    input.read((char*) container.bits.data(), sizeof(uint64_t) * CHUNK_WORDS);
+                }
+
+                else
+                {
+                    container.array.resize(container.cardinality);
+                    input.read((char*) container.array.data(), sizeof(uint16_t) * container.cardinality);
+                }
+            }
+        }
+    };
+
+    // Uncompressed union of posting bitmaps, computed once per query
+    // Every chunk is a plain bitset, so a membership test is a single bit test
+    // Chunks that come from a single dense posting list are borrowed instead of copied, and see bits set by later insertions
+    template<typename T>
+    class QueryBitmap
+    {
+    private:
+        using Bitmap = TagBitmap<T>;
+
+        std::vector<const uint64_t*> chunks;
+        std::vector<bool> ownedChunks;
+        std::vector<std::unique_ptr<uint64_t[]>> owned;
+
+        uint64_t* own(size_t key)
+        {
+            owned.emplace_back(new uint64_t[Bitmap::CHUNK_WORDS]);
+            uint64_t* words = owned.back().get();
+
+            if (chunks[key])
+            {
+                for (size_t i = 0; i < Bitmap::CHUNK_WORDS; i++)
+                {
+                    words[i] = loadWord(chunks[key] + i);
+                }
+            }
+
+            else
+            {
+                memset(words, 0, sizeof(uint64_t) * Bitmap::CHUNK_WORDS);
+            }
+
+            chunks[key] = words;
+            ownedChunks[key] = true;
+            return words;
+        }
+
+    public:
+        void unionWith(const Bitmap& bitmap)
+        {
+            for (const typename Bitmap::Container& container : bitmap.getContainers())
+            {
+                if (container.key >= chunks.size())
+                {
+                    chunks.resize(container.key + 1, nullptr);
+                    ownedChunks.resize(container.key + 1, false);
+                }
+
+                if (!chunks[container.key] && container.dense())
+                {
+                    chunks[container.key] = container.bits.data();
+                    continue;
+                }
+
+                uint64_t* words = ownedChunks[container.key] ? const_cast<uint64_t*>(chunks[container.key]) : own(container.key);
+
+                if (container.dense())
+                {
+                    for (size_t i = 0; i < Bitmap::CHUNK_WORDS; i++)
+                    {
+                        words[i] |= container.bits[i];
+                    }
+                }
+
+                else
+                {
+                    for (uint16_t low : container.array)
+                    {
+                        words[low >> 6] |= uint64_t(1) << (low & 63);
+                    }
+                }
+            }
+        }
+
+        // Calls the function for every ID in the bitmap in increasing order
+        template<typename Function>
+        void forEach(Function fn) const
+        {
+            for (size_t key = 0; key < chunks.size(); key++)
+            {
+                if (!chunks[key])
+                {
+                    continue;
+                }
+
+                for (size_t i = 0; i < Bitmap::CHUNK_WORDS; i++)
+                {
+                    uint64_t word = loadWord(chunks[key] + i);
+
+                    while (word)
+                    {
+                        fn(static_cast<T>((key << Bitmap::CHUNK_BITS) + i * 64 + countTrailingZeros(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+
+        [[nodiscard]] bool contains(const T& id) const noexcept
+        {
+            size_t key = id >> Bitmap::CHUNK_BITS;
+
+            if (key >= chunks.size() || !chunks[key])
+            {
+                return false;
+            }
+
+            size_t low = id & (Bitmap::CHUNK_SIZE - 1);
+            return (loadWord(chunks[key] + (low >> 6)) >> (low & 63)) & 1;
+        }
+    };
+}
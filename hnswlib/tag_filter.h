@@ -0,0 +1,585 @@
+#pragma once
+
+#include "tag_index.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hnswlib
+{
+    // Boolean filter over tags, built with the factory functions or parsed from text like
+    // "type:Person AND type:Athlete AND NOT type:Retired"
+    class TagExpression
+    {
+    public:
+        enum class Operator
+        {
+            Tag,
+            And,
+            Or,
+            Not
+        };
+
+    private:
+        friend class TagFilterProgram;
+
+        Operator op;
+        std::string name;
+        std::vector<TagExpression> operands;
+
+        // There is deliberately no default constructor, so that {} passed to an overloaded search means an empty tag list
+        TagExpression(Operator op, std::string name, std::vector<TagExpression> operands)
+            : op(op), name(std::move(name)), operands(std::move(operands))
+        {}
+
+        class Parser
+        {
+        private:
+            const std::string& text;
+            size_t position = 0;
+            std::string token;
+            bool quoted = false;
+
+            void next()
+            {
+                while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position])))
+                {
+                    position++;
+                }
+
+                token.clear();
+                quoted = false;
+
+                if (position == text.size())
+                {
+                    return;
+                }
+
+                if (text[position] == '(' || text[position] == ')')
+                {
+                    token = text[position++];
+                    return;
+                }
+
+                if (text[position] == '"')
+                {
+                    size_t end = text.find('"', position + 1);
+
+                    if (end == std::string::npos)
+                    {
+                        throw std::invalid_argument("Unterminated quote in tag expression");
+                    }
+
+                    token = text.substr(position + 1, end - position - 1);
+                    quoted = true;
+                    position = end + 1;
+                    return;
+                }
+
+                while (position < text.size() && !std::isspace(static_cast<unsigned char>(text[position])) &&
+                    text[position] != '(' && text[position] != ')')
+                {
+                    token += text[position++];
+                }
+            }
+
+            bool keyword(const char* word) const
+            {
+                return !quoted && token == word;
+            }
+
+            bool atEnd() const
+            {
+                return token.empty() && !quoted;
+            }
+
+            // expression := term (OR term)*
+            TagExpression expression()
+            {
+                std::vector<TagExpression> terms{term()};
+
+                while (keyword("OR"))
+                {
+                    next();
+                    terms.push_back(term());
+                }
+
+                return terms.size() == 1 ? std::move(terms[0]) : any(std::move(terms));
+            }
+
+            // term := factor (AND factor)*
+            TagExpression term()
+            {
+                std::vector<TagExpression> factors{factor()};
+
+                while (keyword("AND"))
+                {
+                    next();
+                    factors.push_back(factor());
+                }
+
+                return factors.size() == 1 ? std::move(factors[0]) : all(std::move(factors));
+            }
+
+            // factor := NOT factor | ( expression ) | tag
+            TagExpression factor()
+            {
+                if (keyword("NOT"))
+                {
+                    next();
+                    return negate(factor());
+                }
+
+                if (keyword("("))
+                {
+                    next();
+                    TagExpression inner = expression();
+
+                    if (!keyword(")"))
+                    {
+                        throw std::invalid_argument("Missing closing parenthesis in tag expression");
+                    }
+
+                    next();
+                    return inner;
+                }
+
+                if (atEnd() || keyword(")") || keyword("AND") || keyword("OR"))
+                {
+                    throw std::invalid_argument("Expected a tag in tag expression");
+                }
+
+                TagExpression leaf = of(token);
+                next();
+                return leaf;
+            }
+
+        public:
+            explicit Parser(const std::string& text)
+                : text(text)
+            {}
+
+            TagExpression parse()
+            {
+                next();
+                TagExpression result = expression();
+
+                if (!atEnd())
+                {
+                    throw std::invalid_argument("Unexpected '" + token + "' in tag expression");
+                }
+
+                return result;
+            }
+        };
+
+    public:
+        static TagExpression of(const std::string& tag)
+        {
+            return TagExpression(Operator::Tag, tag, {});
+        }
+
+        static TagExpression all(std::vector<TagExpression> operands)
+        {
+            return TagExpression(Operator::And, "", std::move(operands));
+        }
+
+        static TagExpression any(std::vector<TagExpression> operands)
+        {
+            return TagExpression(Operator::Or, "", std::move(operands));
+        }
+
+        static TagExpression negate(TagExpression operand)
+        {
+            return TagExpression(Operator::Not, "", {std::move(operand)});
+        }
+
+        // Elements with at least one of the tags, the meaning of a plain tag list
+        static TagExpression anyOf(const std::vector<std::string>& tags)
+        {
+            std::vector<TagExpression> operands;
+            operands.reserve(tags.size());
+
+            for (const std::string& tag : tags)
+            {
+                operands.push_back(of(tag));
+            }
+
+            return any(std::move(operands));
+        }
+
+        // NOT binds tighter than AND, which binds tighter than OR, tags containing spaces, parentheses or keywords are quoted
+        static TagExpression parse(const std::string& text)
+        {
+            return Parser(text).parse();
+        }
+
+        [[nodiscard]] Operator getOperator() const noexcept
+        {
+            return op;
+        }
+
+        [[nodiscard]] const std::string& getTag() const noexcept
+        {
+            return name;
+        }
+
+        [[nodiscard]] const std::vector<TagExpression>& getOperands() const noexcept
+        {
+            return operands;
+        }
+
+        [[nodiscard]] std::string toString() const
+        {
+            switch (op)
+            {
+            case Operator::Tag:
+                return name;
+
+            case Operator::Not:
+                return "NOT " + operands[0].toString();
+
+            default:
+                std::string text = "(";
+
+                for (size_t i = 0; i < operands.size(); i++)
+                {
+                    text += (i ? (op == Operator::And ? " AND " : " OR ") : "") + operands[i].toString();
+                }
+
+                return text + ")";
+            }
+        }
+    };
+
+    // A tag expression compiled against tag IDs and tag frequencies, cheap to evaluate on every candidate of a search
+    // The program is the expression tree in preorder, where each instruction records the end of its subtree
+    // ORs of plain tags become a single test for any of the tags, and the operands of an AND are ordered by increasing
+    // and those of an OR by decreasing selectivity, so that evaluation short-circuits as early as possible
+    class TagFilterProgram
+    {
+    public:
+        enum class Operation : uint8_t
+        {
+            Any,    // Element has any of the instruction's tags
+            And,
+            Or,
+            Not
+        };
+
+        struct Instruction
+        {
+            Operation operation;
+            uint32_t end;                   // Index after the last instruction of the subtree
+            uint32_t tagsBegin, tagsEnd;    // Tag IDs of an Any instruction
+            double selectivity;             // Estimated fraction of the elements matched by the subtree
+        };
+
+    private:
+        std::vector<Instruction> instructions;
+        std::vector<tag_type> tagIds;
+
+        struct Node
+        {
+            Operation operation;
+            std::vector<tag_type> tags;
+            std::vector<Node> operands;
+            double selectivity = 0.0;
+        };
+
+        template<typename Resolve, typename Frequency>
+        static Node build(const TagExpression& expression, size_t elements, Resolve& resolve, Frequency& frequency)
+        {
+            Node node;
+
+            switch (expression.op)
+            {
+            case TagExpression::Operator::Tag:
+                node.operation = Operation::Any;
+                node.tags.push_back(resolve(expression.name));
+                break;
+
+            case TagExpression::Operator::Not:
+            {
+                Node operand = build(expression.operands[0], elements, resolve, frequency);
+
+                if (operand.operation == Operation::Not)    // Double negation
+                {
+                    return std::move(operand.operands[0]);
+                }
+
+                node.operation = Operation::Not;
+                node.operands.push_back(std::move(operand));
+                break;
+            }
+
+            default:
+                node.operation = expression.op == TagExpression::Operator::And ? Operation::And : Operation::Or;
+                Node anyTags;
+                anyTags.operation = Operation::Any;
+
+                for (const TagExpression& operandExpression : expression.operands)
+                {
+                    Node operand = build(operandExpression, elements, resolve, frequency);
+
+                    if (operand.operation == node.operation)    // Nested operations of the same kind are flattened
+                    {
+                        for (Node& nested : operand.operands)
+                        {
+                            node.operands.push_back(std::move(nested));
+                        }
+                    }
+
+                    else if (operand.operation == Operation::Any && node.operation == Operation::Or)
+                    {
+                        anyTags.tags.insert(anyTags.tags.end(), operand.tags.begin(), operand.tags.end());
+                    }
+
+                    else
+                    {
+                        node.operands.push_back(std::move(operand));
+                    }
+                }
+
+                // Flattened ORs may have brought in more plain tests
+                if (node.operation == Operation::Or)
+                {
+                    std::vector<Node> operands;
+
+                    for (Node& operand : node.operands)
+                    {
+                        if (operand.operation == Operation::Any)
+                        {
+                            anyTags.tags.insert(anyTags.tags.end(), operand.tags.begin(), operand.tags.end());
+                        }
+
+                        else
+                        {
+                            operands.push_back(std::move(operand));
+                        }
+                    }
+
+                    node.operands.swap(operands);
+
+                    if (!anyTags.tags.empty() || node.operands.empty())     // An empty OR matches nothing, like an empty tag list
+                    {
+                        std::sort(anyTags.tags.begin(), anyTags.tags.end());
+                        anyTags.tags.erase(std::unique(anyTags.tags.begin(), anyTags.tags.end()), anyTags.tags.end());
+                        anyTags.selectivity = estimate(anyTags, elements, frequency);
+
+                        if (node.operands.empty())
+                        {
+                            return anyTags;
+                        }
+
+                        node.operands.push_back(std::move(anyTags));
+                    }
+                }
+
+                if (node.operands.size() == 1)
+                {
+                    return std::move(node.operands[0]);
+                }
+
+                std::sort(node.operands.begin(), node.operands.end(), [&](const Node& a, const Node& b) {
+                    return node.operation == Operation::And ? a.selectivity < b.selectivity : a.selectivity > b.selectivity;
+                });
+            }
+
+            node.selectivity = estimate(node, elements, frequency);
+            return node;
+        }
+
+        // Assumes the tags of an element are independent
+        template<typename Frequency>
+        static double estimate(const Node& node, size_t elements, Frequency& frequency)
+        {
+            double selectivity = node.operation == Operation::And ? 1.0 : 0.0;
+
+            switch (node.operation)
+            {
+            case Operation::Any:
+                for (tag_type tagId : node.tags)
+                {
+                    selectivity += elements > 0 ? static_cast<double>(frequency(tagId)) / elements : 0.0;
+                }
+
+                return std::min(selectivity, 1.0);
+
+            case Operation::Not:
+                return 1.0 - node.operands[0].selectivity;
+
+            case Operation::And:
+                for (const Node& operand : node.operands)
+                {
+                    selectivity *= operand.selectivity;
+                }
+
+                return selectivity;
+
+            default:
+                double none = 1.0;
+
+                for (const Node& operand : node.operands)
+                {
+                    none *= 1.0 - operand.selectivity;
+                }
+
+                return 1.0 - none;
+            }
+        }
+
+        void emit(const Node& node)
+        {
+            size_t index = instructions.size();
+            instructions.push_back({node.operation, 0, static_cast<uint32_t>(tagIds.size()), 0, node.selectivity});
+            tagIds.insert(tagIds.end(), node.tags.begin(), node.tags.end());
+            instructions[index].tagsEnd = static_cast<uint32_t>(tagIds.size());
+
+            for (const Node& operand : node.operands)
+            {
+                emit(operand);
+            }
+
+            instructions[index].end = static_cast<uint32_t>(instructions.size());
+        }
+
+        template<typename AnyTest>
+        bool evaluateAt(size_t index, const AnyTest& test) const
+        {
+            const Instruction& instruction = instructions[index];
+
+            switch (instruction.operation)
+            {
+            case Operation::Any:
+                return test(index, tagIds.data() + instruction.tagsBegin, tagIds.data() + instruction.tagsEnd);
+
+            case Operation::Not:
+                return !evaluateAt(index + 1, test);
+
+            case Operation::And:
+                for (size_t operand = index + 1; operand < instruction.end; operand = instructions[operand].end)
+                {
+                    if (!evaluateAt(operand, test))
+                    {
+                        return false;
+                    }
+                }
+
+                return true;
+
+            default:
+                for (size_t operand = index + 1; operand < instruction.end; operand = instructions[operand].end)
+                {
+                    if (evaluateAt(operand, test))
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        }
+
+        bool cover(size_t index, std::vector<tag_type>& tags) const
+        {
+            const Instruction& instruction = instructions[index];
+
+            switch (instruction.operation)
+            {
+            case Operation::Any:
+                tags.insert(tags.end(), tagIds.begin() + instruction.tagsBegin, tagIds.begin() + instruction.tagsEnd);
+                return true;
+
+            case Operation::Not:
+                return false;
+
+            case Operation::And:
+                for (size_t operand = index + 1; operand < instruction.end; operand = instructions[operand].end)
+                {
+                    if (cover(operand, tags))   // Operands are ordered by selectivity, so the first cover is the smallest
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+
+            default:
+                for (size_t operand = index + 1; operand < instruction.end; operand = instructions[operand].end)
+                {
+                    if (!cover(operand, tags))
+                    {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+        }
+
+    public:
+        // Unknown tags must resolve to 0, which is never assigned to a tag, and frequency gives the number of elements with a tag
+        template<typename Resolve, typename Frequency>
+        static TagFilterProgram compile(const TagExpression& expression, size_t elements, Resolve resolve, Frequency frequency)
+        {
+            TagFilterProgram program;
+            program.emit(build(expression, elements, resolve, frequency));
+            return program;
+        }
+
+        // Evaluates the program, where test(index, begin, end) decides the Any instruction at the index with the tag IDs begin to end
+        template<typename AnyTest>
+        [[nodiscard]] bool evaluate(const AnyTest& test) const
+        {
+            return evaluateAt(0, test);
+        }
+
+        // Evaluates the program on the tag IDs of an element
+        [[nodiscard]] bool matches(const tag_type* begin, const tag_type* end) const
+        {
+            return evaluate([begin, end](size_t, const tag_type* tagsBegin, const tag_type* tagsEnd) {
+                for (const tag_type* tag = begin; tag != end; tag++)
+                {
+                    if (std::find(tagsBegin, tagsEnd, *tag) != tagsEnd)
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            });
+        }
+
+        // Collects tags such that every match carries at least one of them, so that their posting lists can drive an exact scan
+        // Returns false if there is no such set of tags, as for a negation
+        bool drivingTags(std::vector<tag_type>& tags) const
+        {
+            return cover(0, tags);
+        }
+
+        [[nodiscard]] double selectivity() const noexcept
+        {
+            return instructions[0].selectivity;
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return instructions.size();
+        }
+
+        [[nodiscard]] const Instruction& instruction(size_t index) const noexcept
+        {
+            return instructions[index];
+        }
+
+        [[nodiscard]] std::vector<tag_type> tags(size_t index) const
+        {
+            return std::vector<tag_type>(tagIds.begin() + instructions[index].tagsBegin, tagIds.begin() + instructions[index].tagsEnd);
+        }
+    };
+}
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "index_file.h"
 #include "relationship_graph.h"
+#include "tag_bitmap.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <map>
 #include <set>
 #include <stdexcept>
 #include <cstdlib>
@@ -19,217 +26,556 @@ namespace hnswlib
     class TagIndex
     {
     private:
-        static constexpr size_t expand_size = 10000;
-        static constexpr size_t internal_expand_size = 16;
+        static constexpr size_t unset = std::numeric_limits<size_t>::max();
+        static constexpr size_t MAX_TAG_LOCKS = 1024;
 
-        size_t capacity, levels = 1, count = 0;
+        size_t levels = 1;
+        std::atomic<size_t> count{0};
         unsigned tagIdCounter = 1;
-        size_t* capacities = nullptr;
-        size_t* entries = nullptr;
-        tag_type** tags = nullptr;
 
+        // Compacted node tags in CSR layout: the tags of internal ID i are packedTags[offsets[i]] to packedTags[offsets[i + 1] - 1]
+        std::vector<size_t> offsets;
+        std::vector<tag_type> packedTags;
+
+        // A read-only index maps its compacted node tags from the index file instead of holding them in offsets and packedTags
+        const size_t* mappedOffsets = nullptr;
+        const tag_type* mappedTags = nullptr;
+        size_t mappedNodes = 0;
+
+        // Append buffer for nodes inserted out of order, where slot i holds the begin and size in appendTags of internal ID compactedCount() + i
+        std::vector<std::pair<size_t, size_t>> appendSpans;
+        std::vector<tag_type> appendTags;
+
+        std::unordered_map<tag_type, TagBitmap<T>> postings;  // Inverted index from tag ID to the internal IDs carrying it
         std::vector<std::unordered_map<tag_type, size_t>> levelTagFrequency;
-        size_t *maxFrequenciesPerLevel;
+        std::deque<std::atomic<size_t>> maxFrequenciesPerLevel;   // A deque, as atomics cannot be moved by a growing vector
 
         std::unordered_map<tag_type, std::string> lookup;
         std::unordered_map<std::string, tag_type> inverted;
 
         RelationshipGraph<tag_type> relationship_graph;
 
-        // Expands number of internal ID entries
-        void expand(const size_t& minExpansion)
+        // Insertions hold dictionaryLock shared and the striped lock of each tag whose postings and frequencies they update
+        // It is only held exclusively to add a tag, or a level, which happens once for each
+        mutable std::shared_mutex dictionaryLock;
+        mutable std::vector<std::mutex> tagLocks;
+        mutable std::mutex nodeTagsLock;    // Guards the CSR layout and the append buffer
+
+        std::mutex& tagLock(tag_type tagId) const
         {
-            size_t expansion = expand_size;
+            return tagLocks[tagId & (MAX_TAG_LOCKS - 1)];
+        }
 
-            while (expansion < minExpansion)
+        // Resolves the tags of a node, and checks that their postings and frequency entries up to the level exist
+        bool registered(const std::vector<std::string>& internalTags, unsigned level, std::vector<tag_type>& tagIds) const
+        {
+            if (level >= levels)
+            {
+                return false;
+            }
+
+            for (const std::string& tag : internalTags)
             {
-                expansion += expand_size;
+                auto it = inverted.find(tag);
+
+                if (it == inverted.end() || postings.find(it->second) == postings.end())
+                {
+                    return false;
+                }
+
+                for (unsigned levelCopy = 0; levelCopy <= level; levelCopy++)
+                {
+                    if (levelTagFrequency[levelCopy].find(it->second) == levelTagFrequency[levelCopy].end())
+                    {
+                        return false;
+                    }
+                }
+
+                tagIds.push_back(it->second);
             }
 
-            tag_type** tagsCopy = (tag_type**) realloc(tags, sizeof(tag_type*) * (capacity + expansion));
-            size_t* capacitiesCopy = (size_t*) realloc(capacities, sizeof(size_t) * (capacity + expansion));
-            size_t* entriesCopy = (size_t*) realloc(entries, sizeof(size_t) * (capacity + expansion));
+            return true;
+        }
 
-            if (!tagsCopy || !capacitiesCopy || !entriesCopy)
+        // Adds the missing tags, postings, frequency entries and levels, with the dictionary lock held exclusively
+        void registerTags(const std::vector<std::string>& internalTags, unsigned level)
+        {
+            for (; levels <= level; levels++)
             {
-                throw std::runtime_error("Not enough memory");
+                maxFrequenciesPerLevel.emplace_back(0);
+                levelTagFrequency.emplace_back();
             }
 
-            for (int entry = capacity; entry < capacity + expansion; entry++)
+            for (const std::string& tag : internalTags)
             {
-                tagsCopy[entry] = (tag_type*) malloc(internal_expand_size * sizeof(tag_type));
+                tag_type tagId = assignIdUnlocked(tag);
+                postings[tagId];
 
-                if (!tagsCopy)
+                for (unsigned levelCopy = 0; levelCopy <= level; levelCopy++)
                 {
-                    throw std::runtime_error("Not enough memory");
+                    levelTagFrequency[levelCopy].emplace(tagId, 0);
                 }
+            }
+        }
+
+        size_t frequencyUnlocked(tag_type tagId, unsigned level) const
+        {
+            std::unique_lock<std::mutex> lock(tagLock(tagId));
+            auto it = levelTagFrequency[level].find(tagId);
+            return it != levelTagFrequency[level].end() ? it->second : 0;
+        }
+
+        tag_type assignIdUnlocked(const std::string& tag)
+        {
+            auto it = inverted.find(tag);
+
+            if (it != inverted.end())
+            {
+                return it->second;
+            }
+
+            lookup.insert({tagIdCounter, tag});
+            inverted.insert({tag, tagIdCounter});
+            return tagIdCounter++;
+        }
+
+        [[nodiscard]] size_t compactedCount() const noexcept
+        {
+            return mappedOffsets ? mappedNodes : offsets.size() - 1;
+        }
+
+        [[nodiscard]] const size_t* csrOffsets() const noexcept
+        {
+            return mappedOffsets ? mappedOffsets : offsets.data();
+        }
+
+        [[nodiscard]] const tag_type* csrTags() const noexcept
+        {
+            return mappedOffsets ? mappedTags : packedTags.data();
+        }
+
+        void saveCounts(std::ostream& output) const
+        {
+            output.write((char*) &levels, sizeof(size_t));
+            size_t nodeCount = count;
+            output.write((char*) &nodeCount, sizeof(size_t));
+            output.write((char*) &tagIdCounter, sizeof(unsigned));
 
-                size_t* cap = capacitiesCopy + entry;
-                *cap = internal_expand_size;
+            for (const std::atomic<size_t>& maxFrequency : maxFrequenciesPerLevel)
+            {
+                size_t value = maxFrequency;
+                output.write((char*) &value, sizeof(size_t));
             }
+        }
+
+        void loadCounts(std::istream& input)
+        {
+            size_t nodeCount;
+            input.read((char*) &levels, sizeof(size_t));
+            input.read((char*) &nodeCount, sizeof(size_t));
+            input.read((char*) &tagIdCounter, sizeof(unsigned));
+            count = nodeCount;
+            maxFrequenciesPerLevel.clear();
 
-            tags = tagsCopy;
-            capacities = capacitiesCopy;
-            entries = entriesCopy;
-            capacity += expansion;
-            memset(entries + capacity, 0, expansion);
+            for (size_t level = 0; level < levels; level++)
+            {
+                size_t value;
+                input.read((char*) &value, sizeof(size_t));
+                maxFrequenciesPerLevel.emplace_back(value);
+            }
         }
 
-        // Expands number of tag entries for a given internal ID
-        void expand(const T& internalId, const size_t& minExpansion)
+        // The tag frequencies, names, posting lists and relationship graph, in the order of the tag IDs
+        void saveDictionary(std::ostream& output) const
         {
-            size_t expansion = expand_size;
+            for (int level = 0; level < levels; level++)
+            {
+                std::map<tag_type, size_t> tagFrequencies(levelTagFrequency[level].begin(), levelTagFrequency[level].end());
+                std::size_t size = tagFrequencies.size();
+                output.write((char*) &size, sizeof(std::size_t));
 
-            while (expansion < minExpansion)
+                for (const auto& pair : tagFrequencies)
+                {
+                    output.write((char*) &pair.first, sizeof(tag_type));
+                    output.write((char*) &pair.second, sizeof(size_t));
+                }
+            }
+
+            std::map<tag_type, std::string> sortedLookup(lookup.begin(), lookup.end());
+            std::size_t size = sortedLookup.size();
+            output.write((char*) &size, sizeof(std::size_t));
+
+            for (const auto& pair : sortedLookup)
             {
-                expansion += internal_expand_size;
+                tag_type tagId = pair.first;
+                std::size_t tagLength = pair.second.length();
+                output.write((char*) &tagId, sizeof(tag_type));
+                output.write((char*) &tagLength, sizeof(std::size_t));
+                output.write(pair.second.c_str(), sizeof(char) * tagLength);
             }
 
-            size_t* capacity = capacities + internalId;
-            *capacity += expansion;
-            tag_type* idTags = tags[internalId];
-            tag_type* idTagsCopy = (tag_type*) realloc(idTags, sizeof(tag_type) * *capacity);
+            std::map<tag_type, const TagBitmap<T>*> sortedPostings;
 
-            if (!idTagsCopy)
+            for (const auto& pair : postings)
             {
-                throw std::runtime_error("Not enough memory");
+                sortedPostings.emplace(pair.first, &pair.second);
             }
 
-            tags[internalId] = idTagsCopy;
+            size = sortedPostings.size();
+            output.write((char*) &size, sizeof(std::size_t));
+
+            for (const auto& pair : sortedPostings)
+            {
+                output.write((char*) &pair.first, sizeof(tag_type));
+                pair.second->saveIndex(output);
+            }
+
+            relationship_graph.saveIndex(output);
         }
 
-        [[nodiscard]] static unsigned unionSize(const std::vector<tag_type>& s1, const std::vector<tag_type>& s2) noexcept
+        void loadDictionary(std::istream& input)
         {
-            std::set<tag_type> unique;
+            levelTagFrequency.resize(levels);
 
-            for (const tag_type& tag : s1)
+            for (int level = 0; level < levels; level++)
             {
-                unique.insert(tag);
+                std::unordered_map<tag_type, size_t> tagFrequencies;
+                std::size_t size;
+                input.read((char*) &size, sizeof(std::size_t));
+
+                for (int i = 0; i < size; i++)
+                {
+                    tag_type tag;
+                    size_t frequency;
+                    input.read((char*) &tag, sizeof(tag_type));
+                    input.read((char*) &frequency, sizeof(size_t));
+                    tagFrequencies.insert({tag, frequency});
+                }
+
+                levelTagFrequency[level] = tagFrequencies;
             }
 
-            for (const tag_type& tag : s2)
+            std::size_t size;
+            input.read((char*) &size, sizeof(std::size_t));
+
+            for (int i = 0; i < size; i++)
             {
-                unique.insert(tag);
+                tag_type tagId;
+                std::size_t tagLength;
+                input.read((char*) &tagId, sizeof(tag_type));
+                input.read((char*) &tagLength, sizeof(std::size_t));
+
+                std::string tag(tagLength, '\0');
+                input.read(&tag[0], sizeof(char) * tagLength);
+                lookup.insert({tagId, tag});
+                inverted.insert({tag, tagId});
             }
 
-            return unique.size();
+            input.read((char*) &size, sizeof(std::size_t));
+            postings.reserve(size);
+
+            for (int i = 0; i < size; i++)
+            {
+                tag_type tagId;
+                input.read((char*) &tagId, sizeof(tag_type));
+                postings[tagId].loadIndex(input);
+            }
+
+            relationship_graph.loadIndex(input, lookup, inverted);
         }
 
-    public:
-        explicit TagIndex(size_t capacity)
-            : capacity(capacity), relationship_graph(RelationshipGraph<tag_type>(lookup, inverted))
+        // Moves the compacted nodes from the given internal ID and onwards back into the append buffer
+        void decompact(const T& internalId)
         {
-            tags = (tag_type**) malloc(sizeof(tag_type*) * capacity);
-            capacities = (size_t*) malloc(sizeof(size_t) * capacity);
-            entries = (size_t*) malloc(sizeof(size_t) * capacity);
-            maxFrequenciesPerLevel = (size_t*) malloc(sizeof(size_t) * levels);
+            size_t compacted = compactedCount();
+            std::vector<std::pair<size_t, size_t>> spans;
+            spans.reserve(compacted - internalId + appendSpans.size());
 
-            if (!tags || !capacities || !entries || !maxFrequenciesPerLevel)
+            for (size_t id = internalId; id < compacted; id++)
             {
-                throw std::runtime_error("Not enough memory");
+                spans.emplace_back(appendTags.size(), offsets[id + 1] - offsets[id]);
+                appendTags.insert(appendTags.end(), packedTags.begin() + offsets[id], packedTags.begin() + offsets[id + 1]);
             }
 
-            memset(entries, 0, capacity * sizeof(size_t));
-            levelTagFrequency.emplace_back();
+            spans.insert(spans.end(), appendSpans.begin(), appendSpans.end());
+            appendSpans.swap(spans);
+            packedTags.resize(offsets[internalId]);
+            offsets.resize(internalId + 1);
+        }
+
+        // Stores the tags of a node, appending to the tags it might already have
+        void storeTags(const T& internalId, const std::vector<tag_type>& tagIds)
+        {
+            if (internalId < compactedCount())
+            {
+                decompact(internalId);
+            }
 
-            for (size_t i = 0; i < capacity; i++)
+            size_t compacted = compactedCount();
+
+            if (internalId == compacted && appendSpans.empty())    // In-order insertion goes straight to the compacted layout
+            {
+                packedTags.insert(packedTags.end(), tagIds.begin(), tagIds.end());
+                offsets.push_back(packedTags.size());
+                return;
+            }
+
+            size_t slot = internalId - compacted;
+
+            if (slot >= appendSpans.size())
+            {
+                appendSpans.resize(slot + 1, {unset, 0});
+            }
+
+            std::pair<size_t, size_t>& span = appendSpans[slot];
+            size_t begin = appendTags.size();
+
+            if (span.first != unset)    // Existing tags are copied to the end of the buffer to keep the node's tags contiguous
+            {
+                appendTags.insert(appendTags.end(), appendTags.begin() + span.first, appendTags.begin() + span.first + span.second);
+                span.second += tagIds.size();
+            }
+
+            else
+            {
+                span.second = tagIds.size();
+            }
+
+            span.first = begin;
+            appendTags.insert(appendTags.end(), tagIds.begin(), tagIds.end());
+
+            if (slot == 0)
+            {
+                merge(false);
+            }
+        }
+
+        // Merges the append buffer into the CSR layout
+        // Unless all nodes are merged, merging stops at the first node not inserted yet, which can then still be inserted in order
+        void merge(bool all)
+        {
+            size_t merged = 0;
+
+            for (; merged < appendSpans.size(); merged++)
             {
-                size_t* entry = capacities + i;
-                *entry = internal_expand_size;
-                tags[i] = (tag_type*) malloc(internal_expand_size * sizeof(tag_type));
+                const std::pair<size_t, size_t>& span = appendSpans[merged];
 
-                if (!tags[i])
+                if (span.first != unset)
                 {
-                    throw std::runtime_error("Not enough memory");
+                    packedTags.insert(packedTags.end(), appendTags.begin() + span.first, appendTags.begin() + span.first + span.second);
                 }
+
+                else if (!all)
+                {
+                    break;
+                }
+
+                offsets.push_back(packedTags.size());
             }
+
+            if (merged == 0)
+            {
+                return;
+            }
+
+            appendSpans.erase(appendSpans.begin(), appendSpans.begin() + merged);
+            std::vector<tag_type> remaining;
+
+            for (std::pair<size_t, size_t>& span : appendSpans)
+            {
+                if (span.first != unset)
+                {
+                    size_t begin = remaining.size();
+                    remaining.insert(remaining.end(), appendTags.begin() + span.first, appendTags.begin() + span.first + span.second);
+                    span.first = begin;
+                }
+            }
+
+            appendTags.swap(remaining);
+        }
+
+        [[nodiscard]] static unsigned unionSize(const std::vector<tag_type>& s1, const std::vector<tag_type>& s2) noexcept
+        {
+            std::set<tag_type> unique;
+
+            for (const tag_type& tag : s1)
+            {
+                unique.insert(tag);
+            }
+
+            for (const tag_type& tag : s2)
+            {
+                unique.insert(tag);
+            }
+
+            return unique.size();
+        }
+
+    public:
+        explicit TagIndex(size_t capacity)
+            : relationship_graph(lookup, inverted), tagLocks(MAX_TAG_LOCKS)
+        {
+            maxFrequenciesPerLevel.emplace_back(0);
+            offsets.reserve(capacity + 1);
+            offsets.push_back(0);
+            levelTagFrequency.emplace_back();
         }
 
         void clear() noexcept
         {
+            levels = 1;
             count = 0;
-            capacity = 0;
             tagIdCounter = 1;
-            free(capacities);
-            free(entries);
-            free(maxFrequenciesPerLevel);
+            maxFrequenciesPerLevel.clear();
+            maxFrequenciesPerLevel.emplace_back(0);
+            levelTagFrequency.assign(1, {});
+            lookup.clear();
+            inverted.clear();
+            offsets.assign(1, 0);
+            packedTags.clear();
+            mappedOffsets = nullptr;
+            mappedTags = nullptr;
+            mappedNodes = 0;
+            appendSpans.clear();
+            appendTags.clear();
+            postings.clear();
             relationship_graph.clear();
+        }
 
-            for (int i = 0; i < capacity; i++)
+        // Merges the append buffer into the CSR layout
+        // Unless all nodes are merged, merging stops at the first node not inserted yet, which can then still be inserted in order
+        void compact(bool all = true)
+        {
+            std::unique_lock<std::mutex> lock(nodeTagsLock);
+            merge(all);
+        }
+
+        // Renumbers the nodes, where order[i] is the old internal ID of the node getting internal ID i, and nodes past the
+        // end of order keep theirs; the tag frequencies and the relationship graph do not depend on internal IDs
+        void permute(const std::vector<T>& order)
+        {
+            if (mappedOffsets)
             {
-                free(tags[i]);
+                throw std::runtime_error("Cannot renumber a read-only tag index");
             }
 
-            free(tags);
-        }
+            std::unique_lock<std::shared_mutex> dictionary(dictionaryLock);
+            std::unique_lock<std::mutex> lock(nodeTagsLock);
+            merge(true);
 
-        void insert(const T& internalId, const std::vector<std::string>& internalTags, unsigned level)
-        {
-            if (level >= levels)
+            size_t nodes = std::max(order.size(), offsets.size() - 1);
+            std::vector<size_t> permutedOffsets;
+            std::vector<tag_type> permutedTags;
+            permutedOffsets.reserve(nodes + 1);
+            permutedOffsets.push_back(0);
+            permutedTags.reserve(packedTags.size());
+
+            for (size_t id = 0; id < nodes; id++)
             {
-                size_t* maxLevelFrequencyCopy = (size_t*) realloc(maxFrequenciesPerLevel, sizeof(size_t) * (level + 1));
+                size_t oldId = id < order.size() ? order[id] : id;
 
-                if (!maxLevelFrequencyCopy)
+                if (oldId + 1 < offsets.size())
                 {
-                    throw std::runtime_error("Not enough memory");
+                    permutedTags.insert(permutedTags.end(), packedTags.begin() + offsets[oldId], packedTags.begin() + offsets[oldId + 1]);
                 }
 
-                maxFrequenciesPerLevel = maxLevelFrequencyCopy;
+                permutedOffsets.push_back(permutedTags.size());
+            }
+
+            offsets.swap(permutedOffsets);
+            packedTags.swap(permutedTags);
 
-                for (int i = levels; i < (level + 1); i++)
+            // Adding the new IDs in increasing order appends to the posting lists
+            for (auto& pair : postings)
+            {
+                pair.second.clear();
+            }
+
+            for (size_t id = 0; id + 1 < offsets.size(); id++)
+            {
+                for (size_t i = offsets[id]; i < offsets[id + 1]; i++)
                 {
-                    size_t* maxFrequency = maxFrequenciesPerLevel + i;
-                    *maxFrequency = 0;
-                    levelTagFrequency.emplace_back();
+                    postings.find(packedTags[i])->second.add(static_cast<T>(id));
                 }
+            }
+        }
+
+        // Returns the range of tag IDs of a node, which is not synchronized with concurrent insertions
+        [[nodiscard]] std::pair<const tag_type*, const tag_type*> nodeTags(const T& internalId) const noexcept
+        {
+            size_t compacted = compactedCount();
 
-                levels = level + 1;
+            if (internalId < compacted)
+            {
+                const tag_type* begin = csrTags();
+                const size_t* csr = csrOffsets();
+                return {begin + csr[internalId], begin + csr[internalId + 1]};
             }
 
-            else if (internalId >= capacity)
+            size_t slot = internalId - compacted;
+
+            if (slot >= appendSpans.size() || appendSpans[slot].first == unset)
             {
-                expand(internalId + 1);
+                return {nullptr, nullptr};
             }
 
-            size_t* internalCapacity = capacities + internalId;
-            size_t* internalEntries = entries + internalId;
-            std::unordered_set<tag_type> tagIds;
-            tagIds.reserve(internalTags.size());
+            const tag_type* begin = appendTags.data() + appendSpans[slot].first;
+            return {begin, begin + appendSpans[slot].second};
+        }
 
-            for (const std::string& tag : internalTags)
+        // Can be called concurrently for different internal IDs
+        void insert(const T& internalId, const std::vector<std::string>& internalTags, unsigned level)
+        {
+            if (mappedOffsets)
             {
-                if (inverted.find(tag) == inverted.end())
-                {
-                    lookup.insert({tagIdCounter, tag});
-                    inverted.insert({tag, tagIdCounter++});
-                }
+                throw std::runtime_error("Cannot insert into a read-only tag index");
+            }
+
+            std::vector<tag_type> nodeTagIds;
+            nodeTagIds.reserve(internalTags.size());
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
 
-                if (*internalEntries >= *internalCapacity)
+            if (!registered(internalTags, level, nodeTagIds))
+            {
+                dictionary.unlock();
                 {
-                    expand(internalId, *internalEntries + 1);
+                    std::unique_lock<std::shared_mutex> exclusive(dictionaryLock);
+                    registerTags(internalTags, level);
                 }
+                dictionary.lock();
+                nodeTagIds.clear();
+                registered(internalTags, level, nodeTagIds);
+            }
 
-                tag_type tagId = inverted[tag];
-                memcpy(tags[internalId] + *internalEntries, &tagId, sizeof(tag_type));
-                (*internalEntries)++;
-                tagIds.insert(tagId);
+            for (tag_type tagId : nodeTagIds)
+            {
+                std::unique_lock<std::mutex> lock(tagLock(tagId));
+                postings.find(tagId)->second.add(internalId);
 
                 for (int levelCopy = static_cast<int>(level); levelCopy >= 0; levelCopy--)
                 {
-                    if (levelTagFrequency[levelCopy].find(tagId) == levelTagFrequency[levelCopy].end())
-                    {
-                        levelTagFrequency[levelCopy][tagId] = 0;
-                    }
+                    size_t frequency = ++levelTagFrequency[levelCopy].find(tagId)->second;
+                    std::atomic<size_t>& maxFrequency = maxFrequenciesPerLevel[levelCopy];
+                    size_t current = maxFrequency.load(std::memory_order_relaxed);
 
-                    levelTagFrequency[levelCopy][tagId]++;
-                    size_t* maxFrequency = maxFrequenciesPerLevel + levelCopy;
-                    *maxFrequency = std::max(*maxFrequency, levelTagFrequency[levelCopy][tagId]);
+                    while (current < frequency && !maxFrequency.compare_exchange_weak(current, frequency, std::memory_order_relaxed));
                 }
             }
 
+            dictionary.unlock();
+            std::unique_lock<std::mutex> lock(nodeTagsLock);
+            storeTags(internalId, nodeTagIds);
             count++;
         }
 
+        // Copies the tag IDs of a node
+        [[nodiscard]] std::vector<tag_type> tagIds(const T& internalId) const
+        {
+            std::unique_lock<std::mutex> lock(nodeTagsLock);
+            std::pair<const tag_type*, const tag_type*> range = nodeTags(internalId);
+            return std::vector<tag_type>(range.first, range.second);
+        }
+
         [[nodiscard]] std::vector<std::string> get(const T& internalId) const
         {
             if (internalId < 0)
@@ -237,35 +583,119 @@ namespace hnswlib
                 throw std::runtime_error("Invalid internal ID");
             }
 
-            else if (internalId > count)
+            std::vector<tag_type> nodeTagIds = tagIds(internalId);
+            std::vector<std::string> tags;
+            tags.reserve(nodeTagIds.size());
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+
+            for (tag_type tagId : nodeTagIds)
             {
-                return {};
+                tags.push_back(lookup.at(tagId));
             }
 
-            tag_type* internalTags = tags[internalId];
-            size_t size = *((size_t*) entries + internalId);
+            return tags;
+        }
+
+        // Resolves tags to their IDs, such that the per-node filter checks never touch strings
+        // Unknown tags are resolved to 0, which is never assigned to a tag, and therefore never matches any node
+        [[nodiscard]] std::vector<tag_type> resolve(const std::vector<std::string>& tags) const
+        {
+            std::vector<tag_type> tagIds;
+            tagIds.reserve(tags.size());
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+
+            for (const std::string& tag : tags)
+            {
+                auto it = inverted.find(tag);
+                tagIds.push_back(it != inverted.end() ? it->second : 0);
+            }
+
+            return tagIds;
+        }
+
+        [[nodiscard]] tag_type resolveTag(const std::string& tag) const
+        {
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+            auto it = inverted.find(tag);
+            return it != inverted.end() ? it->second : 0;
+        }
+
+        // Looks up the names of tag IDs, skipping unknown IDs
+        [[nodiscard]] std::vector<std::string> names(const std::vector<tag_type>& tagIds) const
+        {
             std::vector<std::string> tags;
-            tags.reserve(size);
+            tags.reserve(tagIds.size());
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
 
-            for (int i = 0; i < size; i++)
+            for (tag_type tagId : tagIds)
             {
-                tag_type tagId = *(internalTags + i);
-                std::string tag = lookup.at(tagId);
-                tags.push_back(tag);
+                auto it = lookup.find(tagId);
+
+                if (it != lookup.end())
+                {
+                    tags.push_back(it->second);
+                }
             }
 
             return tags;
         }
 
-        [[nodiscard]] tag_type assignId(const std::string& tag) noexcept
+        // Checks whether a node has at least one of the given tag IDs without allocating
+        [[nodiscard]] bool hasAny(const T& internalId, const std::vector<tag_type>& tagIds) const
         {
-            if (inverted.find(tag) == inverted.end())
+            std::unique_lock<std::mutex> lock(nodeTagsLock);
+            std::pair<const tag_type*, const tag_type*> range = nodeTags(internalId);
+            const tag_type* internalTags = range.first;
+            const tag_type* end = range.second;
+            const tag_type* queryBegin = tagIds.data();
+            const tag_type* queryEnd = queryBegin + tagIds.size();
+
+            for (const tag_type* tag = internalTags; tag != end; tag++)
             {
-                lookup.insert({tagIdCounter, tag});
-                inverted.insert({tag, tagIdCounter++});
+                for (const tag_type* queryTag = queryBegin; queryTag != queryEnd; queryTag++)
+                {
+                    if (*tag == *queryTag)
+                    {
+                        return true;
+                    }
+                }
             }
 
-            return inverted[tag];
+            return false;
+        }
+
+        // The posting list is not synchronized with concurrent insertions
+        [[nodiscard]] const TagBitmap<T>* getPostings(tag_type tagId) const
+        {
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+            auto it = postings.find(tagId);
+            return it != postings.end() ? &it->second : nullptr;
+        }
+
+        // Union of the posting lists of the given tags, used to test "node has any of the query tags" with a single bit test
+        [[nodiscard]] QueryBitmap<T> postingUnion(const std::vector<tag_type>& tagIds) const
+        {
+            QueryBitmap<T> bitmap;
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+
+            for (const tag_type& tagId : tagIds)
+            {
+                auto it = postings.find(tagId);
+
+                if (it != postings.end())
+                {
+                    std::unique_lock<std::mutex> lock(tagLock(tagId));
+                    bitmap.unionWith(it->second);
+                }
+            }
+
+            return bitmap;
+        }
+
+        [[nodiscard]] tag_type assignId(const std::string& tag)
+        {
+            std::unique_lock<std::shared_mutex> dictionary(dictionaryLock);
+            return assignIdUnlocked(tag);
         }
 
         [[nodiscard]] size_t size() const noexcept
@@ -273,38 +703,41 @@ namespace hnswlib
             return count;
         }
 
-        [[nodiscard]] bool exists(const std::string& tag) const noexcept
+        [[nodiscard]] bool exists(const std::string& tag) const
         {
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
             return inverted.find(tag) != inverted.end();
         }
 
         [[nodiscard]] unsigned frequency(const std::string& tag, unsigned level) const
         {
-            if (level >= levels || !exists(tag))
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+            auto it = inverted.find(tag);
+
+            if (level >= levels || it == inverted.end())
             {
                 return 0;
             }
 
-            try
-            {
-                tag_type tagId = inverted.at(tag);
-                return levelTagFrequency.at(level).at(tagId);
-            }
+            return frequencyUnlocked(it->second, level);
+        }
 
-            catch (const std::out_of_range& exc)
-            {
-                return 0;
-            }
+        [[nodiscard]] size_t frequency(tag_type tagId, unsigned level) const
+        {
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+            return level < levels ? frequencyUnlocked(tagId, level) : 0;
         }
 
         [[nodiscard]] unsigned maxLevelFrequency(unsigned level)
         {
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
+
             if (level >= levels)
             {
                 throw std::invalid_argument("Level value too great");
             }
 
-            return *(maxFrequenciesPerLevel + level);
+            return maxFrequenciesPerLevel[level].load(std::memory_order_relaxed);
         }
 
         [[nodiscard]] double jaccardSimilarity(const std::vector<std::string>& tags1, const std::vector<std::string>& tags2) const
@@ -333,6 +766,7 @@ namespace hnswlib
             }
 
             double minDist = std::numeric_limits<double>::max();
+            std::shared_lock<std::shared_mutex> dictionary(dictionaryLock);
 
             for (const std::string& tag1 : tags1)
             {
@@ -378,120 +812,78 @@ namespace hnswlib
             return relationship_graph;
         }
 
-        void saveIndex(std::ofstream& output) const
+        // Compacts the append buffer first, so the node tags are written as two contiguous arrays
+        void saveIndex(std::ostream& output)
         {
-            output.write((char*) &capacity, sizeof(size_t));
-            output.write((char*) &levels, sizeof(size_t));
-            output.write((char*) &count, sizeof(size_t));
-            output.write((char*) &tagIdCounter, sizeof(unsigned));
-            output.write((char*) capacities, sizeof(size_t) * capacity);
-            output.write((char*) entries, sizeof(size_t) * capacity);
-            output.write((char*) maxFrequenciesPerLevel, sizeof(size_t) * levels);
-
-            for (size_t i = 0; i < capacity; i++)
-            {
-                size_t internalCapacity = *(capacities + i);
-                output.write((char*) tags[i], sizeof(tag_type) * internalCapacity);
-            }
-
-            for (int level = 0; level < levels; level++)
-            {
-                std::unordered_map<tag_type, size_t> tagFrequencies = levelTagFrequency[level];
-                std::size_t size = tagFrequencies.size();
-                output.write((char*) &size, sizeof(std::size_t));
-
-                for (const auto& pair : tagFrequencies)
-                {
-                    output.write((char*) &pair.first, sizeof(tag_type));
-                    output.write((char*) &pair.second, sizeof(size_t));
-                }
-            }
-
-            std::size_t size = lookup.size();
-            output.write((char*) &size, sizeof(std::size_t));
-
-            for (const auto& pair : lookup)
-            {
-                tag_type tagId = pair.first;
-                std::string tag = pair.second;
-                const char* cTag = tag.c_str();
-                std::size_t tagLength = tag.length();
-                output.write((char*) &tagId, sizeof(tag_type));
-                output.write((char*) &tagLength, sizeof(std::size_t));
-                output.write(cTag, sizeof(char) * tagLength);
-            }
-
-            relationship_graph.saveIndex(output);
+            compact();
+            size_t nodes = compactedCount();
+            size_t packedSize = csrOffsets()[nodes];
+            saveCounts(output);
+            output.write((char*) &nodes, sizeof(size_t));
+            output.write((char*) &packedSize, sizeof(size_t));
+            output.write((char*) csrOffsets(), sizeof(size_t) * (nodes + 1));
+            output.write((char*) csrTags(), sizeof(tag_type) * packedSize);
+            saveDictionary(output);
         }
 
-        void loadIndex(std::ifstream& input)
+        void loadIndex(std::istream& input)
         {
-            input.read((char*) &capacity, sizeof(size_t));
-            input.read((char*) &levels, sizeof(size_t));
-            input.read((char*) &count, sizeof(size_t));
-            input.read((char*) &tagIdCounter, sizeof(unsigned));
-
-            capacities = (size_t*) malloc(sizeof(size_t) * capacity);
-            entries = (size_t*) malloc(sizeof(size_t) * capacity);
-            maxFrequenciesPerLevel = (size_t*) malloc(sizeof(size_t) * levels);
-            tags = (tag_type**) malloc(sizeof(tag_type*) * capacity);
-
-            if (!capacities || ! entries || !tags)
-            {
-                throw std::runtime_error("Not enough memory");
-            }
+            size_t nodes, packedSize;
+            loadCounts(input);
+            input.read((char*) &nodes, sizeof(size_t));
+            input.read((char*) &packedSize, sizeof(size_t));
+
+            offsets.resize(nodes + 1);
+            packedTags.resize(packedSize);
+            appendSpans.clear();
+            appendTags.clear();
+            input.read((char*) offsets.data(), sizeof(size_t) * (nodes + 1));
+            input.read((char*) packedTags.data(), sizeof(tag_type) * packedSize);
+            loadDictionary(input);
+        }
 
-            input.read((char*) capacities, sizeof(size_t) * capacity);
-            input.read((char* ) entries, sizeof(size_t) * capacity);
-            input.read((char*) maxFrequenciesPerLevel, sizeof(size_t) * levels);
+        // Writes the node tags as sections of their own, so that a read-only load can map them
+        void saveIndex(IndexFileWriter& file, uint32_t part = 0)
+        {
+            compact();
+            size_t nodes = compactedCount();
+            file.beginSection(IndexSection::TagOffsets, part).write((char*) csrOffsets(), sizeof(size_t) * (nodes + 1));
+            file.endSection();
+            file.beginSection(IndexSection::NodeTags, part).write((char*) csrTags(), sizeof(tag_type) * csrOffsets()[nodes]);
+            file.endSection();
+            std::ostream& output = file.beginSection(IndexSection::TagDictionary, part);
+            saveCounts(output);
+            saveDictionary(output);
+            file.endSection();
+        }
 
-            for (size_t i = 0; i < capacity; i++)
-            {
-                size_t internalCapacity = *(capacities + i);
-                tags[i] = (tag_type*) malloc(sizeof(tag_type) * internalCapacity);
-                input.read((char*) tags[i], sizeof(tag_type) * internalCapacity);
-            }
+        // A mapped tag index points into the mapping of the file, which the caller keeps alive, and cannot take insertions
+        void loadIndex(IndexFileReader& file, bool mapped, bool verifyChecksums = true, uint32_t part = 0)
+        {
+            size_t nodes = file.size(IndexSection::TagOffsets, part) / sizeof(size_t) - 1;
+            appendSpans.clear();
+            appendTags.clear();
 
-            for (int level = 0; level < levels; level++)
+            if (mapped)
             {
-                std::unordered_map<tag_type, size_t> tagFrequencies;
-                std::size_t size;
-                input.read((char*) &size, sizeof(std::size_t));
-                levelTagFrequency.emplace_back();
-
-                for (int i = 0; i < size; i++)
-                {
-                    tag_type tag;
-                    size_t frequency;
-                    input.read((char*) &tag, sizeof(tag_type));
-                    input.read((char*) &frequency, sizeof(size_t));
-                    tagFrequencies.insert({tag, frequency});
-                }
-
-                levelTagFrequency[level] = tagFrequencies;
+                offsets.assign(1, 0);
+                packedTags.clear();
+                mappedNodes = nodes;
+                mappedOffsets = (const size_t*) file.map(IndexSection::TagOffsets, sizeof(size_t) * (nodes + 1), part, verifyChecksums);
+                mappedTags = (const tag_type*) file.map(IndexSection::NodeTags, sizeof(tag_type) * mappedOffsets[nodes], part, verifyChecksums);
             }
 
-            std::size_t size;
-            input.read((char*) &size, sizeof(std::size_t));
-
-            for (int i = 0; i < size; i++)
+            else
             {
-                tag_type tagId;
-                char* cTag;
-                std::size_t tagLength;
-                input.read((char*) &tagId, sizeof(tag_type));
-                input.read((char*) &tagLength, sizeof(std::size_t));
-
-                cTag = (char*) malloc(tagLength);
-                input.read(cTag, sizeof(char) * tagLength);
-
-                std::string tag = cTag;
-                tag = tag.substr(0, tagLength);
-                lookup.insert({tagId, tag});
-                inverted.insert({tag, tagId});
+                offsets.resize(nodes + 1);
+                file.read(IndexSection::TagOffsets, offsets.data(), sizeof(size_t) * (nodes + 1), part);
+                packedTags.resize(offsets[nodes]);
+                file.read(IndexSection::NodeTags, packedTags.data(), sizeof(tag_type) * offsets[nodes], part);
             }
 
-            relationship_graph.loadIndex(input, lookup, inverted);
+            std::istream& input = file.open(IndexSection::TagDictionary, part);
+            loadCounts(input);
+            loadDictionary(input);
         }
     };
 }
\ No newline at end of file
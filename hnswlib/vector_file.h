@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib
+{
+    // Fixed-size records in a memory-mapped file, which keeps its records when it is opened again
+    // The file grows with the capacity but never shrinks, and the operating system pages records in and out as needed
+    class VectorFile
+    {
+    public:
+        VectorFile(const std::string& path, size_t record_size, size_t capacity)
+            : record_size_(record_size)
+        {
+#ifdef _WIN32
+            throw std::runtime_error("Memory-mapped vector files are not supported on this platform");
+#else
+            fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd_ < 0)
+                throw std::runtime_error("Cannot open vector file " + path);
+
+            struct stat file_stat;
+            if (fstat(fd_, &file_stat) != 0)
+            {
+                ::close(fd_);
+                throw std::runtime_error("Cannot read the size of vector file " + path);
+            }
+            file_records_ = (size_t) file_stat.st_size / record_size_;
+            capacity_ = file_records_;
+            try
+            {
+                resize(capacity);
+            }
+            catch (...)
+            {
+                ::close(fd_);
+                throw;
+            }
+#endif
+        }
+
+        VectorFile(const VectorFile&) = delete;
+        VectorFile& operator=(const VectorFile&) = delete;
+
+        ~VectorFile()
+        {
+#ifndef _WIN32
+            unmap();
+            ::close(fd_);
+#endif
+        }
+
+        // Grows the file to hold at least capacity records, which invalidates the pointers returned by at()
+        void resize(size_t capacity)
+        {
+#ifndef _WIN32
+            if (data_ && capacity <= capacity_)
+                return;
+            unmap();
+            if (capacity > capacity_)
+            {
+                if (ftruncate(fd_, (off_t) (capacity * record_size_)) != 0)
+                    throw std::runtime_error("Cannot grow the vector file");
+                capacity_ = capacity;
+            }
+            if (capacity_ == 0)
+                return;
+
+            void* data = mmap(nullptr, capacity_ * record_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("Cannot map the vector file");
+            data_ = (char*) data;
+#endif
+        }
+
+        // Writes the modified records back to the file
+        void flush()
+        {
+#ifndef _WIN32
+            if (data_ && msync(data_, capacity_ * record_size_, MS_SYNC) != 0)
+                throw std::runtime_error("Cannot write the vector file");
+#endif
+        }
+
+        inline char* at(size_t id) const
+        {
+            return data_ + id * record_size_;
+        }
+
+        // Records the file held when it was opened
+        size_t fileRecords() const
+        {
+            return file_records_;
+        }
+
+    private:
+        void unmap()
+        {
+#ifndef _WIN32
+            if (data_)
+                munmap(data_, capacity_ * record_size_);
+            data_ = nullptr;
+#endif
+        }
+
+        int fd_ = -1;
+        char* data_ = nullptr;
+        size_t record_size_;
+        size_t capacity_ = 0;
+        size_t file_records_ = 0;
+    };
+}
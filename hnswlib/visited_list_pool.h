@@ -3,6 +3,7 @@
 #include <mutex>
 #include <string.h>
 #include <deque>
+#include <vector>
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
@@ -62,11 +63,35 @@ class VisitedListPool {
         return rez;
     }
 
+    // Takes count lists under a single lock, for searches running several queries together
+    std::vector<VisitedList *> getFreeVisitedLists(size_t count) {
+        std::vector<VisitedList *> lists;
+        lists.reserve(count);
+        {
+            std::unique_lock <std::mutex> lock(poolguard);
+            while (lists.size() < count && pool.size() > 0) {
+                lists.push_back(pool.front());
+                pool.pop_front();
+            }
+        }
+        while (lists.size() < count)
+            lists.push_back(new VisitedList(numelements));
+        for (VisitedList *vl : lists)
+            vl->reset();
+        return lists;
+    }
+
     void releaseVisitedList(VisitedList *vl) {
         std::unique_lock <std::mutex> lock(poolguard);
         pool.push_front(vl);
     }
 
+    void releaseVisitedLists(const std::vector<VisitedList *> &lists) {
+        std::unique_lock <std::mutex> lock(poolguard);
+        for (VisitedList *vl : lists)
+            pool.push_front(vl);
+    }
+
     ~VisitedListPool() {
         while (pool.size()) {
             VisitedList *rez = pool.front();
@@ -341,9 +341,9 @@ class Index {
     std::vector<hnswlib::labeltype> getIdsList() {
         std::vector<hnswlib::labeltype> ids;
 
-        for (auto kv : appr_alg->label_lookup_) {
-            ids.push_back(kv.first);
-        }
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint internal_id) {
+            ids.push_back(label);
+        });
         return ids;
     }
 
@@ -373,11 +373,11 @@ class Index {
         memset(label_lookup_val_npy, -1, appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
 
         size_t idx = 0;
-        for (auto it = appr_alg->label_lookup_.begin(); it != appr_alg->label_lookup_.end(); ++it) {
-            label_lookup_key_npy[idx] = it->first;
-            label_lookup_val_npy[idx] = it->second;
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint internal_id) {
+            label_lookup_key_npy[idx] = label;
+            label_lookup_val_npy[idx] = internal_id;
             idx++;
-        }
+        });
 
         memset(link_list_npy, 0, link_npy_size);
 
@@ -558,7 +558,7 @@ class Index {
             if (label_lookup_val_npy.data()[i] < 0) {
                 throw std::runtime_error("Internal id cannot be negative!");
             } else {
-                appr_alg->label_lookup_.insert(std::make_pair(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]));
+                appr_alg->label_lookup_.set(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]);
             }
         }
 
@@ -581,10 +581,7 @@ class Index {
             if (linkListSize == 0) {
                 appr_alg->linkLists_[i] = nullptr;
             } else {
-                appr_alg->linkLists_[i] = (char*)malloc(linkListSize);
-                if (appr_alg->linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-
+                appr_alg->linkLists_[i] = appr_alg->link_list_arena_.allocate(appr_alg->element_levels_[i]);
                 memcpy(appr_alg->linkLists_[i], link_list_npy.data() + link_npy_offsets[i], linkListSize);
             }
         }
@@ -59,15 +59,13 @@ def has_flag(compiler, flagname):
 
 
 def cpp_flag(compiler):
-    """Return the -std=c++[11/14] compiler flag.
-    The c++14 is prefered over c++11 (when it is available).
+    """Return the -std=c++17 compiler flag.
+    The index headers use std::shared_mutex, so c++17 is required.
     """
-    if has_flag(compiler, '-std=c++14'):
-        return '-std=c++14'
-    elif has_flag(compiler, '-std=c++11'):
-        return '-std=c++11'
+    if has_flag(compiler, '-std=c++17'):
+        return '-std=c++17'
     else:
-        raise RuntimeError('Unsupported compiler -- at least C++11 support '
+        raise RuntimeError('Unsupported compiler -- at least C++17 support '
                            'is needed!')
 
 
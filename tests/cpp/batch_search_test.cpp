@@ -0,0 +1,150 @@
+// This is a test file for batched multi-query searches and the batched distance kernels
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<float> makeData(size_t count, int seed) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+// The batched kernels give the same distances as the single ones, for every dimension the spaces dispatch on
+void test_kernels() {
+    for (size_t d : {3, 4, 7, 16, 20, 33, 64}) {
+        hnswlib::L2Space l2(d);
+        hnswlib::InnerProductSpace ip(d);
+        std::vector<float> data = makeData(10 * d, 47);
+
+        for (hnswlib::SpaceInterface<float>* space : std::vector<hnswlib::SpaceInterface<float>*>{&l2, &ip}) {
+            hnswlib::BATCHDISTFUNC<float> batch_distance = space->get_batch_dist_func();
+            if (!batch_distance) {
+                continue;
+            }
+
+            std::vector<const void*> others;
+            for (size_t i = 1; i < 10; i++) {
+                others.push_back(data.data() + i * d);
+            }
+            for (size_t count = 0; count <= others.size(); count++) {
+                std::vector<float> distances(count);
+                batch_distance(data.data(), others.data(), count, space->get_dist_func_param(), distances.data());
+                for (size_t i = 0; i < count; i++) {
+                    float expected = space->get_dist_func()(data.data(), others[i], space->get_dist_func_param());
+                    assert(std::fabs(distances[i] - expected) <= 1e-5f * std::max(1.0f, std::fabs(expected)));
+                }
+            }
+        }
+    }
+}
+
+void test_search() {
+    int d = 32;
+    idx_t n = 5000;
+    size_t k = 10, nq = 120;
+
+    std::vector<float> data = makeData(n * d, 47);
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        std::vector<std::string> tags = {"t" + std::to_string(i % 10)};
+        if (i % 100 == 0) {
+            tags.push_back("rare");
+        }
+        alg_hnsw.addPoint(data.data() + d * i, i, tags);
+    }
+    alg_hnsw.setEf(50);
+
+    // Queries come in bursts close to each other, so that their searches reach many of the same nodes
+    std::vector<float> noise = makeData(nq * d, 48);
+    std::vector<float> query_data(nq * d);
+    std::vector<const void*> queries;
+    for (size_t q = 0; q < nq; ++q) {
+        for (int j = 0; j < d; ++j) {
+            query_data[q * d + j] = data[(q / 4) * 31 * d + j] + 0.05f * noise[q * d + j];
+        }
+        queries.push_back(query_data.data() + q * d);
+    }
+
+    // Filters for every plan in one batch, from one that all elements pass to a brute-force one
+    const std::vector<std::string> expressions = {"t1 OR NOT t1", "t3", "rare", "NOT t3", "t2 OR t5"};
+    std::vector<hnswlib::TagExpression> filters;
+    for (size_t q = 0; q < nq; ++q) {
+        filters.push_back(hnswlib::TagExpression::parse(expressions[q % expressions.size()]));
+    }
+
+    for (bool planned : {false, true}) {
+        hnswlib::QueryPlanner planner;
+        planner.enabled = planned;
+        alg_hnsw.setQueryPlanner(planner);
+
+        auto results = alg_hnsw.searchKnnBatch(queries, k, filters);
+        assert(results.size() == nq);
+
+        size_t same = 0;
+        for (size_t q = 0; q < nq; ++q) {
+            std::unordered_set<idx_t> expected;
+            auto knn = alg_hnsw.searchKnn(queries[q], k, filters[q]);
+            assert(results[q].size() == knn.size());
+            while (!knn.empty()) {
+                expected.insert(knn.top().second);
+                knn.pop();
+            }
+            while (!results[q].empty()) {
+                same += expected.count(results[q].top().second);
+                results[q].pop();
+            }
+        }
+        std::cout << (planned ? "Planned" : "Filtered graph") << " batch results matching single queries: " << same << " of " << nq * k << std::endl;
+        assert(same >= nq * k * 99 / 100);
+    }
+
+    // Unfiltered batches, and tag lists where an empty list means no filter
+    auto unfiltered = alg_hnsw.searchKnnBatch(queries, k);
+    std::vector<std::vector<std::string>> tags(nq);
+    tags[1] = {"t3", "t4"};
+    auto tagged = alg_hnsw.searchKnnBatch(queries, k, tags);
+    for (size_t q = 0; q < 2; ++q) {
+        assert(unfiltered[q].size() == k && tagged[q].size() == k);
+        while (!tagged[q].empty()) {
+            idx_t label = tagged[q].top().second;
+            assert(q == 0 ? label == unfiltered[q].top().second : label % 10 == 3 || label % 10 == 4);
+            tagged[q].pop();
+            unfiltered[q].pop();
+        }
+    }
+
+    bool thrown = false;
+    try {
+        alg_hnsw.searchKnnBatch(queries, k, std::vector<hnswlib::TagExpression>(1, hnswlib::TagExpression::of("t1")));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_kernels();
+    test_search();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Benchmarks the build throughput of addPoints with tags on one thread and on all threads
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+// Usage: build_benchmark [elements] [threads], by default 100k elements and all hardware threads
+int main(int argc, char** argv) {
+    int d = 16;
+    idx_t n = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t threads = argc > 2 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+    size_t num_tags = 100;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    std::vector<idx_t> labels(n);
+    std::vector<std::vector<std::string>> tags(n);
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = i;
+        tags[i].push_back("type_" + std::to_string(i % num_tags));
+        if (i % 5 == 0) {
+            tags[i].push_back("rare_" + std::to_string(i % 7));
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    for (bool adaptive : {false, true}) {
+        double single_thread_rate = 0;
+        for (size_t num_threads : {size_t(1), threads}) {
+            hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, false, adaptive);
+
+            auto start = std::chrono::steady_clock::now();
+            alg_hnsw.addPoints(data.data(), labels.data(), tags, n, num_threads);
+            double build_time = secondsSince(start);
+
+            if (alg_hnsw.getCurrentElementCount() != n) {
+                std::cerr << "Index holds " << alg_hnsw.getCurrentElementCount() << " instead of " << n << " elements" << std::endl;
+                return 1;
+            }
+
+            double rate = n / build_time;
+            if (num_threads == 1) {
+                single_thread_rate = rate;
+            }
+            std::cout << (adaptive ? "Adaptive" : "Plain") << " build with " << num_threads << " threads: " << rate
+                      << " inserts/s (" << rate / single_thread_rate << "x)" << std::endl;
+        }
+    }
+
+    return 0;
+}
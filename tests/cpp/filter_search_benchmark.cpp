@@ -0,0 +1,166 @@
+// Benchmarks the per-candidate tag filter check and filtered query throughput
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// The filter check as it used to be done: materialize the node's tags as strings and search them for every query tag
+bool hasAnyByString(const hnswlib::TagIndex<hnswlib::tableint>& tag_index, hnswlib::tableint id, const std::vector<std::string>& tags) {
+    std::vector<std::string> nodeTags = tag_index.get(id);
+    for (const std::string& tag : nodeTags) {
+        if (std::find(tags.begin(), tags.end(), tag) != tags.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int d = 16;
+    idx_t n = argc > 1 ? std::stoul(argv[1]) : 10000;
+    idx_t nq = 1000;
+    size_t k = 10;
+    size_t num_tags = 50;
+    size_t checks = 2000000;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    std::vector<std::vector<std::string>> tags(n);
+    for (idx_t i = 0; i < n; ++i) {
+        tags[i].push_back("type_" + std::to_string(i % num_tags));
+        if (i % 7 == 0) {
+            tags[i].push_back("rare_" + std::to_string(i % 3));
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, false, true);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_hnsw.addNodeTags(tags[i]);
+    }
+    alg_hnsw.flushTags();
+
+    std::cout << "Building index of " << n << " elements" << std::endl;
+    for (idx_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + i * d, i, tags[i]);
+    }
+    alg_hnsw.setEf(100);
+
+    // Micro benchmark of the filter check itself on random candidates
+    std::vector<std::string> query_tags = {"type_3", "type_17", "rare_1"};
+    std::vector<hnswlib::tag_type> query_tag_ids = alg_hnsw.tag_index.resolve(query_tags);
+    std::uniform_int_distribution<hnswlib::tableint> distrib_id(0, n - 1);
+    std::vector<hnswlib::tableint> candidates(checks);
+    for (size_t i = 0; i < checks; ++i) {
+        candidates[i] = distrib_id(rng);
+    }
+
+    size_t matches_string = 0, matches_id = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (hnswlib::tableint id : candidates) {
+        matches_string += hasAnyByString(alg_hnsw.tag_index, id, query_tags);
+    }
+    double string_time = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (hnswlib::tableint id : candidates) {
+        matches_id += alg_hnsw.tag_index.hasAny(id, query_tag_ids);
+    }
+    double id_time = secondsSince(start);
+
+    size_t matches_bitmap = 0;
+    start = std::chrono::steady_clock::now();
+    hnswlib::QueryBitmap<hnswlib::tableint> query_bitmap = alg_hnsw.tag_index.postingUnion(query_tag_ids);
+    for (hnswlib::tableint id : candidates) {
+        matches_bitmap += query_bitmap.contains(id);
+    }
+    double bitmap_time = secondsSince(start);
+
+    if (matches_string != matches_id || matches_string != matches_bitmap) {
+        std::cerr << "Filter checks disagree: " << matches_string << " vs " << matches_id << " vs " << matches_bitmap << std::endl;
+        return 1;
+    }
+
+    std::cout << "String filter check: " << checks / string_time / 1e6 << " M checks/s" << std::endl;
+    std::cout << "Tag ID filter check: " << checks / id_time / 1e6 << " M checks/s" << std::endl;
+    std::cout << "Posting bitmap filter check: " << checks / bitmap_time / 1e6 << " M checks/s" << std::endl;
+
+    // End-to-end filtered search throughput
+    std::vector<float> query(nq * d);
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    for (bool planned : {false, true}) {
+        hnswlib::QueryPlanner planner;
+        planner.enabled = planned;
+        alg_hnsw.setQueryPlanner(planner);
+
+        size_t correct = 0, brute_force = 0;
+        start = std::chrono::steady_clock::now();
+        for (idx_t q = 0; q < nq; ++q) {
+            std::vector<std::string> filter = {"type_" + std::to_string(q % num_tags)};
+            hnswlib::QueryStats stats;
+            auto result = alg_hnsw.searchKnnWithStats(query.data() + q * d, k, filter, stats);
+            brute_force += stats.plan == hnswlib::QueryPlan::BruteForce;
+            while (!result.empty()) {
+                correct += result.top().second % num_tags == q % num_tags;
+                result.pop();
+            }
+        }
+        double search_time = secondsSince(start);
+
+        if (correct == 0) {
+            std::cerr << "Filtered search returned no matching elements" << std::endl;
+            return 1;
+        }
+
+        std::cout << (planned ? "Planned search: " : "Filtered graph search: ") << nq / search_time << " QPS ("
+                  << brute_force << " brute-force plans)" << std::endl;
+    }
+
+    // Filtered graph search with the tags checked in the level-0 records instead of the posting bitmaps
+    for (size_t slots : {0, 4}) {
+        hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100, false, false, slots);
+        for (idx_t i = 0; i < n; ++i) {
+            index.addPoint(data.data() + i * d, i, tags[i]);
+        }
+        index.setEf(100);
+        hnswlib::QueryPlanner planner;
+        planner.enabled = false;
+        index.setQueryPlanner(planner);
+
+        start = std::chrono::steady_clock::now();
+        for (idx_t q = 0; q < nq; ++q) {
+            std::vector<std::string> filter = {"type_" + std::to_string(q % num_tags), "rare_" + std::to_string(q % 3)};
+            index.searchKnn(query.data() + q * d, k, filter);
+        }
+        double search_time = secondsSince(start);
+
+        std::cout << (slots ? "Inline tags search: " : "Posting bitmap search: ") << nq / search_time << " QPS" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+// This is a test file for the versioned and checksummed index file written by all index types
+
+#include "../../hnswlib/hnswlib.h"
+#include "../../hnswlib/postfilter_hnsw.h"
+#include "../../hnswlib/multi_filter_hnsw.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const int d = 16;
+const idx_t n = 2000;
+
+std::vector<float> makeData(size_t count, int seed) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+std::vector<std::string> tagsOf(idx_t i) {
+    std::vector<std::string> tags = {i % 2 ? "odd" : "even"};
+    if (i % 3 == 0) {
+        tags.push_back("three");
+    }
+    return tags;
+}
+
+std::vector<char> readFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& path, const std::vector<char>& bytes) {
+    std::ofstream output(path, std::ios::binary);
+    output.write(bytes.data(), bytes.size());
+}
+
+template<typename F>
+bool throws(F f) {
+    try {
+        f();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+template<typename A, typename B>
+void assertSameResults(const A& a, const B& b, const std::vector<float>& queries) {
+    const std::vector<std::string> filters = {"odd", "three", "even OR three", "odd AND NOT three"};
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        hnswlib::TagExpression filter = hnswlib::TagExpression::parse(filters[q % filters.size()]);
+        auto expected = a.searchKnn(queries.data() + q * d, 10, filter);
+        auto result = b.searchKnn(queries.data() + q * d, 10, filter);
+        assert(expected.size() == result.size());
+        while (!expected.empty()) {
+            assert(expected.top() == result.top());
+            expected.pop();
+            result.pop();
+        }
+    }
+}
+
+void test_crc() {
+    const char check[] = "123456789";
+    assert(hnswlib::crc32c(0, check, 9) == 0xE3069283u);
+    // Checksums continue over split buffers
+    assert(hnswlib::crc32c(hnswlib::crc32c(0, check, 4), check + 4, 5) == 0xE3069283u);
+    std::vector<char> zeros(32, 0);
+    assert(hnswlib::crc32c(0, zeros.data(), zeros.size()) == 0x8A9136AAu);
+}
+
+void test_hnsw_file() {
+    std::vector<float> data = makeData(n * d, 47);
+    std::vector<float> queries = makeData(40 * d, 48);
+    hnswlib::L2Space space(d);
+
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 200, 100, false, true, 2, 1);
+    for (idx_t i = 0; i < n; ++i) {
+        index.addPoint(data.data() + d * i, i, tagsOf(i));
+    }
+    index.setEf(50);
+
+    // Saving the same index twice, or a loaded copy of it, gives the same bytes
+    index.saveIndex("index_file_a.bin");
+    index.saveIndex("index_file_b.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space, "index_file_a.bin");
+    loaded.setEf(50);
+    loaded.saveIndex("index_file_c.bin");
+    std::vector<char> bytes = readFile("index_file_a.bin");
+    assert(bytes == readFile("index_file_b.bin") && bytes == readFile("index_file_c.bin"));
+    assert(bytes.size() > 2 * hnswlib::INDEX_FILE_ALIGNMENT);
+    assertSameResults(index, loaded, queries);
+
+    // A flipped byte in the level-0 block fails the load, and the read-only load when it verifies the checksums
+    hnswlib::IndexFileHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    assert(header.version == hnswlib::INDEX_FILE_VERSION && header.kind == (uint32_t) hnswlib::IndexKind::HierarchicalNSW);
+    std::vector<char> corrupted = bytes;
+    corrupted[2 * hnswlib::INDEX_FILE_ALIGNMENT + 100] ^= 1;
+    writeFile("index_file_corrupted.bin", corrupted);
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    assert(throws([&] { loaded.loadIndex("index_file_corrupted.bin", &space); }));
+    assert(throws([&] { mapped.mapIndex("index_file_corrupted.bin", &space, true); }));
+    mapped.mapIndex("index_file_corrupted.bin", &space);
+
+    // So do a damaged section table, a truncated file and another version
+    corrupted = bytes;
+    corrupted[header.table_offset + 8] ^= 1;
+    writeFile("index_file_corrupted.bin", corrupted);
+    assert(throws([&] { loaded.loadIndex("index_file_corrupted.bin", &space); }));
+    writeFile("index_file_corrupted.bin", std::vector<char>(bytes.begin(), bytes.begin() + header.table_offset));
+    assert(throws([&] { loaded.loadIndex("index_file_corrupted.bin", &space); }));
+    corrupted = bytes;
+    corrupted[8] = 99;
+    writeFile("index_file_corrupted.bin", corrupted);
+    assert(throws([&] { loaded.loadIndex("index_file_corrupted.bin", &space); }));
+
+    std::remove("index_file_a.bin");
+    std::remove("index_file_b.bin");
+    std::remove("index_file_c.bin");
+    std::remove("index_file_corrupted.bin");
+}
+
+void test_baseline_files() {
+    std::vector<float> data = makeData(n * d, 47);
+    std::vector<float> queries = makeData(40 * d, 48);
+    hnswlib::L2Space space(d);
+
+    hnswlib::PostfilterHNSW<float> postfilter(&space, n);
+    hnswlib::MultiIndexHNSW<float> multi(&space, {"odd", "even", "three"}, n);
+    for (idx_t i = 0; i < n; ++i) {
+        postfilter.addPoint(data.data() + d * i, i, tagsOf(i));
+        multi.addPoint(data.data() + d * i, i, tagsOf(i));
+    }
+    postfilter.saveIndex("index_file_postfilter.bin");
+    multi.saveIndex("index_file_multi.bin");
+
+    hnswlib::PostfilterHNSW<float> loaded_postfilter(&space);
+    loaded_postfilter.loadIndex("index_file_postfilter.bin", &space);
+    hnswlib::MultiIndexHNSW<float> loaded_multi(&space, {});
+    loaded_multi.loadIndex("index_file_multi.bin", &space);
+    assertSameResults(postfilter, loaded_postfilter, queries);
+    assertSameResults(multi, loaded_multi, queries);
+
+    // The file of one kind of index does not load as another
+    hnswlib::HierarchicalNSW<float> hnsw(&space);
+    assert(throws([&] { hnsw.loadIndex("index_file_multi.bin", &space); }));
+    assert(throws([&] { hnsw.loadIndex("index_file_postfilter.bin", &space); }));
+    assert(throws([&] { loaded_postfilter.loadIndex("index_file_multi.bin", &space); }));
+
+    std::remove("index_file_postfilter.bin");
+    std::remove("index_file_multi.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_crc();
+    test_hnsw_file();
+    test_baseline_files();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
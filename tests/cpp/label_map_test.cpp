@@ -0,0 +1,167 @@
+// This is a test file for the concurrent label lookup of the index
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+using hnswlib::tableint;
+
+void assertSameContents(const hnswlib::LabelMap<tableint>& map, const std::map<idx_t, tableint>& expected) {
+    assert(map.size() == expected.size());
+    size_t visited = 0;
+    map.forEach([&](idx_t label, tableint id) {
+        assert(expected.at(label) == id);
+        visited++;
+    });
+    assert(visited == expected.size());
+}
+
+void test_single_thread() {
+    hnswlib::LabelMap<tableint> map;
+    map.resize(1000);
+    std::map<idx_t, tableint> expected;
+    std::mt19937_64 rng(47);
+
+    // Labels in and beyond the dense range, with replacements and removals that leave reused removed slots
+    for (int round = 0; round < 20000; ++round) {
+        idx_t label = round % 3 ? rng() % 2000 : rng();
+        if (rng() % 4 == 0) {
+            assert(map.erase(label) == (expected.erase(label) == 1));
+        } else {
+            map.set(label, (tableint) round);
+            expected[label] = (tableint) round;
+        }
+    }
+    assertSameContents(map, expected);
+    for (const auto& pair : expected) {
+        assert(map.at(pair.first) == pair.second);
+    }
+    assert(!map.contains(5000) || expected.count(5000));
+
+    bool thrown = false;
+    try {
+        map.at(123456789);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown == !expected.count(123456789));
+
+    // Growing the dense range moves the labels it now covers out of the hash tables
+    map.resize(4000);
+    assertSameContents(map, expected);
+
+    std::vector<idx_t> labels;
+    for (const auto& pair : expected) {
+        labels.push_back(pair.first);
+    }
+    map.rebuild(labels.data(), labels.size(), 2);
+    std::map<idx_t, tableint> rebuilt;
+    for (size_t i = 0; i < labels.size(); ++i) {
+        rebuilt[labels[i]] = i;
+    }
+    assertSameContents(map, rebuilt);
+
+    map.clear();
+    assert(map.size() == 0 && !map.contains(labels[0]));
+}
+
+void test_concurrent() {
+    hnswlib::LabelMap<tableint> map;
+    map.resize(100000);
+    const size_t threads = 8;
+    const size_t per_thread = 50000;
+
+    // Each thread sets, overwrites and removes labels of its own, half of them beyond the dense range
+    auto label_of = [](size_t thread, size_t i) {
+        return i % 2 ? (idx_t) (thread * per_thread + i) : (idx_t) ((thread * per_thread + i) * 0x9E3779B97F4A7C15ULL);
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < per_thread; ++i) {
+                map.set(label_of(t, i), (tableint) i);
+            }
+            for (size_t i = 0; i < per_thread; i += 3) {
+                map.set(label_of(t, i), (tableint) (i + 1));
+            }
+            for (size_t i = 0; i < per_thread; i += 5) {
+                map.erase(label_of(t, i));
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    size_t count = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        for (size_t i = 0; i < per_thread; ++i) {
+            tableint id;
+            bool found = map.find(label_of(t, i), id);
+            assert(found == (i % 5 != 0));
+            if (found) {
+                assert(id == (i % 3 ? i : i + 1));
+                count++;
+            }
+        }
+    }
+    assert(map.size() == count);
+}
+
+void test_index_labels() {
+    const int d = 8;
+    const size_t n = 2000;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+
+    // Labels far beyond the capacity of the index, next to ones within it
+    auto label_of = [](size_t i) { return i % 2 ? (idx_t) i : (idx_t) (i * 1000003 + (1ULL << 40)); };
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100, true);
+    for (size_t i = 0; i < n; ++i) {
+        index.addPoint(data.data() + i * d, label_of(i), {});
+    }
+    assert(index.label_lookup_.size() == n);
+    for (size_t i = 0; i < n; i += 7) {
+        assert(index.getDataByLabel<float>(label_of(i)) == std::vector<float>(data.begin() + i * d, data.begin() + (i + 1) * d));
+    }
+
+    // A deleted element can be replaced by another label
+    index.markDelete(label_of(10));
+    index.addPoint(data.data() + 10 * d, 7777777, {}, true);
+    assert(!index.label_lookup_.contains(label_of(10)) && index.label_lookup_.contains(7777777));
+
+    index.saveIndex("label_map_index.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space, "label_map_index.bin");
+    assert(loaded.label_lookup_.size() == n);
+    index.label_lookup_.forEach([&](idx_t label, tableint id) {
+        assert(loaded.label_lookup_.at(label) == id);
+    });
+    std::remove("label_map_index.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_single_thread();
+    test_concurrent();
+    test_index_labels();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,120 @@
+// This is a test file for the arena holding the upper-level link lists
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test_arena() {
+    const size_t list_size = 68;
+    hnswlib::LinkListArena arena;
+    arena.reset(list_size);
+
+    // Blocks of each level are zeroed, do not overlap, and lie in slabs of their level
+    std::vector<std::pair<char*, int>> blocks;
+    for (int i = 0; i < 30000; ++i) {
+        int level = 1 + i % 3;
+        char* block = arena.allocate(level);
+        assert(std::all_of(block, block + list_size * level, [](char c) { return c == 0; }));
+        memset(block, level, list_size * level);
+        blocks.push_back({block, level});
+    }
+    std::sort(blocks.begin(), blocks.end());
+    for (size_t i = 1; i < blocks.size(); ++i) {
+        assert(blocks[i - 1].first + list_size * blocks[i - 1].second <= blocks[i].first);
+    }
+    for (const auto& block : blocks) {
+        assert(block.first[0] == block.second && block.first[list_size * block.second - 1] == block.second);
+    }
+    size_t used = 10000 * list_size * (1 + 2 + 3);
+    assert(arena.memoryUsage() >= used && arena.memoryUsage() < used + 3 * hnswlib::LinkListArena::SLAB_SIZE);
+
+    // A released block goes to the next element of its level, zeroed
+    char* released = blocks[5].first;
+    int level = blocks[5].second;
+    arena.release(released, level);
+    size_t memory = arena.memoryUsage();
+    char* reused = arena.allocate(level);
+    assert(reused == released && reused[0] == 0 && arena.memoryUsage() == memory);
+
+    arena.clear();
+    assert(arena.memoryUsage() == 0);
+}
+
+void test_index() {
+    const int d = 16;
+    const size_t n = 3000;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    std::vector<float> queries(50 * d);
+    for (float& value : queries) {
+        value = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100);
+    for (size_t i = 0; i < n; ++i) {
+        index.addPoint(data.data() + i * d, i, {"t" + std::to_string(i % 5)});
+    }
+    index.setEf(50);
+    size_t upper_lists = 0;
+    for (size_t i = 0; i < n; ++i) {
+        upper_lists += index.element_levels_[i];
+    }
+    assert(index.link_list_arena_.memoryUsage() >= upper_lists * index.size_links_per_element_);
+
+    // Moving an element up keeps its lists and adds empty ones above them
+    hnswlib::tableint id = 0;
+    while (index.element_levels_[id] != 1) {
+        id++;
+    }
+    std::vector<hnswlib::tableint> level1 = index.getConnectionsWithLock(id, 1);
+    index.moveUp(id, 2, index.enterpoint_node_);
+    assert(index.element_levels_[id] == 2 && index.getConnectionsWithLock(id, 1) == level1);
+
+    // The loaded index reads the link lists into one slab and searches the same
+    index.saveIndex("link_list_arena.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space, "link_list_arena.bin");
+    loaded.setEf(50);
+    assert(loaded.link_list_arena_.memoryUsage() == (upper_lists + 1) * index.size_links_per_element_);
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        auto expected = index.searchKnn(queries.data() + q * d, 10, std::vector<std::string>());
+        auto result = loaded.searchKnn(queries.data() + q * d, 10, std::vector<std::string>());
+        assert(expected.size() == result.size());
+        while (!expected.empty()) {
+            assert(expected.top() == result.top());
+            expected.pop();
+            result.pop();
+        }
+    }
+
+    // Inserting into the loaded index takes new blocks next to the slab it was read into
+    loaded.resizeIndex(n + 100);
+    for (size_t i = 0; i < 100; ++i) {
+        loaded.addPoint(queries.data() + (i % 50) * d, n + i, {"t1"});
+    }
+    assert(loaded.getCurrentElementCount() == n + 100);
+    std::remove("link_list_arena.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_arena();
+    test_index();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Benchmarks the startup time of an index: loading it on one thread, on all threads, and mapping it read-only
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fills the index with random vectors and random links of full lists, in the shape addPoint gives to a graph,
+// since building a graph of tens of millions of points takes far longer than loading it
+void synthesize(hnswlib::HierarchicalNSW<float>& index, size_t n, int d, size_t num_tags) {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib;
+
+    for (size_t i = 0; i < n; ++i) {
+        hnswlib::tableint id = (hnswlib::tableint) i;
+        int level = index.getRandomLevel(index.mult_);
+        index.element_levels_[id] = level;
+
+        memset(index.data_level0_memory_ + id * index.size_data_per_element_ + index.offsetLevel0_, 0, index.size_data_per_element_);
+        idx_t label = i;
+        memcpy(index.getExternalLabeLp(id), &label, sizeof(idx_t));
+        float* vector = (float*) index.getDataByInternalId(id);
+        for (int j = 0; j < d; ++j) {
+            vector[j] = distrib(rng);
+        }
+
+        std::vector<std::string> tags = {"type_" + std::to_string(i % num_tags)};
+        if (i % 5 == 0) {
+            tags.push_back("rare_" + std::to_string(i % 7));
+        }
+        index.tag_index.insert(id, tags, level);
+
+        hnswlib::linklistsizeint* links = index.get_linklist0(id);
+        index.setListCount(links, (unsigned short) index.maxM0_);
+        for (size_t j = 0; j < index.maxM0_; ++j) {
+            ((hnswlib::tableint*) (links + 1))[j] = rng() % n;
+        }
+
+        if (level > 0) {
+            index.linkLists_[id] = index.link_list_arena_.allocate(level);
+            for (int l = 1; l <= level; ++l) {
+                links = index.get_linklist(id, l);
+                index.setListCount(links, (unsigned short) index.maxM_);
+                for (size_t j = 0; j < index.maxM_; ++j) {
+                    ((hnswlib::tableint*) (links + 1))[j] = rng() % n;
+                }
+            }
+        }
+
+        if (level > index.maxlevel_ || i == 0) {
+            index.maxlevel_ = level;
+            index.enterpoint_node_ = id;
+        }
+    }
+    index.cur_element_count = n;
+}
+
+}  // namespace
+
+// Usage: load_benchmark [elements...], by default 1M, 10M and 30M elements
+// The index file is written next to the binary and read from the page cache, so the times leave out the disk
+int main(int argc, char** argv) {
+    int d = 16;
+    size_t num_tags = 100;
+    std::vector<size_t> sizes = {1000000, 10000000, 30000000};
+    if (argc > 1) {
+        sizes.clear();
+        for (int i = 1; i < argc; ++i) {
+            sizes.push_back(std::stoul(argv[i]));
+        }
+    }
+    size_t threads = std::thread::hardware_concurrency();
+    const std::string path = "load_benchmark.bin";
+
+    hnswlib::L2Space space(d);
+    for (size_t n : sizes) {
+        {
+            hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100);
+            synthesize(index, n, d, num_tags);
+            index.saveIndex(path);
+        }
+
+        double single_thread_time = 0;
+        for (size_t num_threads : {size_t(1), threads}) {
+            hnswlib::HierarchicalNSW<float> index(&space);
+            auto start = std::chrono::steady_clock::now();
+            index.loadIndex(path, &space, 0, num_threads);
+            double load_time = secondsSince(start);
+            if (index.getCurrentElementCount() != n) {
+                std::cerr << "Index holds " << index.getCurrentElementCount() << " instead of " << n << " elements" << std::endl;
+                return 1;
+            }
+
+            if (num_threads == 1) {
+                single_thread_time = load_time;
+            }
+            std::cout << n << " elements, load on " << num_threads << " threads: " << load_time << " s ("
+                      << single_thread_time / load_time << "x)" << std::endl;
+        }
+
+        hnswlib::HierarchicalNSW<float> mapped(&space);
+        auto start = std::chrono::steady_clock::now();
+        mapped.mapIndex(path, &space);
+        std::cout << n << " elements, read-only mapping: " << secondsSince(start) << " s" << std::endl;
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
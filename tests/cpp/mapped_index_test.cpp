@@ -0,0 +1,132 @@
+// This is a test file for the sectioned index file and read-only loading by mapping it
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const int d = 16;
+const idx_t n = 3000;
+
+std::vector<float> makeData(size_t count, int seed) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+template<typename F>
+bool throws(F f) {
+    try {
+        f();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void assertSameResults(hnswlib::HierarchicalNSW<float>& a, hnswlib::HierarchicalNSW<float>& b, const std::vector<float>& queries) {
+    const std::vector<std::string> filters = {"", "t3", "t1 OR t7", "NOT t2", "rare"};
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        const std::string& filter = filters[q % filters.size()];
+        auto expected = filter.empty() ? a.searchKnn(queries.data() + q * d, 10, std::vector<std::string>())
+                                       : a.searchKnn(queries.data() + q * d, 10, hnswlib::TagExpression::parse(filter));
+        auto result = filter.empty() ? b.searchKnn(queries.data() + q * d, 10, std::vector<std::string>())
+                                     : b.searchKnn(queries.data() + q * d, 10, hnswlib::TagExpression::parse(filter));
+        assert(expected.size() == result.size());
+        while (!expected.empty()) {
+            assert(expected.top() == result.top());
+            expected.pop();
+            result.pop();
+        }
+    }
+}
+
+void test_mapped_index() {
+    std::vector<float> data = makeData(n * d, 47);
+    std::vector<float> queries = makeData(100 * d, 48);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 200, 100, false, true, 2, 1);
+    for (idx_t i = 0; i < n; ++i) {
+        std::vector<std::string> tags = {"t" + std::to_string(i % 10)};
+        if (i % 97 == 0) {
+            tags.push_back("rare");
+        }
+        index.addPoint(data.data() + d * i, i, tags);
+    }
+    for (idx_t i = 0; i < n; i += 50) {
+        index.markDelete(i);
+    }
+    index.setEf(50);
+    index.saveIndex("mapped_index.bin");
+
+    hnswlib::HierarchicalNSW<float> loaded(&space, "mapped_index.bin");
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    mapped.mapIndex("mapped_index.bin", &space);
+    assert(!loaded.isReadOnly() && mapped.isReadOnly());
+    assert(mapped.getCurrentElementCount() == n && mapped.getDeletedCount() == index.getDeletedCount());
+    for (hnswlib::HierarchicalNSW<float>* copy : {&loaded, &mapped}) {
+        copy->setEf(50);
+        assertSameResults(index, *copy, queries);
+        assert(copy->getDataByLabel<float>(7) == std::vector<float>(data.begin() + 7 * d, data.begin() + 8 * d));
+        assert(copy->tag_index.get(13) == index.tag_index.get(13));
+    }
+
+    // A second mapping of the same file shares its pages
+    hnswlib::HierarchicalNSW<float> shared(&space);
+    shared.mapIndex("mapped_index.bin", &space);
+    shared.setEf(50);
+    assertSameResults(mapped, shared, queries);
+
+    // The mapped index cannot change, but can be saved again
+    assert(throws([&] { mapped.addPoint(data.data(), n, {"t1"}); }));
+    assert(throws([&] { mapped.markDelete(1); }));
+    assert(throws([&] { mapped.unmarkDelete(0); }));
+    assert(throws([&] { mapped.resizeIndex(2 * n); }));
+    mapped.saveIndex("mapped_index_copy.bin");
+    hnswlib::HierarchicalNSW<float> copy(&space, "mapped_index_copy.bin");
+    copy.setEf(50);
+    assertSameResults(index, copy, queries);
+
+    // The regular load can grow and take insertions
+    loaded.resizeIndex(n + 1);
+    loaded.addPoint(data.data(), n, {"t1"});
+    assert(loaded.getCurrentElementCount() == n + 1);
+
+    // Files that are not index files or are cut short are rejected
+    {
+        std::ofstream output("mapped_index_truncated.bin", std::ios::binary);
+        std::ifstream input("mapped_index.bin", std::ios::binary);
+        std::vector<char> head(3 * hnswlib::INDEX_FILE_ALIGNMENT);
+        input.read(head.data(), head.size());
+        output.write(head.data(), head.size());
+    }
+    assert(throws([&] { hnswlib::HierarchicalNSW<float> truncated(&space, "mapped_index_truncated.bin"); }));
+    assert(throws([&] { mapped.mapIndex("mapped_index_missing.bin", &space); }));
+
+    std::remove("mapped_index.bin");
+    std::remove("mapped_index_copy.bin");
+    std::remove("mapped_index_truncated.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_mapped_index();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,141 @@
+// This is a test file for allocating the memory of an index with huge pages and NUMA placement
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<std::pair<float, idx_t>> results(const hnswlib::HierarchicalNSW<float>& index, const float* query) {
+    std::vector<std::pair<float, idx_t>> result;
+    auto knn = index.searchKnn(query, 10, std::vector<std::string>());
+    while (!knn.empty()) {
+        result.push_back(knn.top());
+        knn.pop();
+    }
+    return result;
+}
+
+void test_topology() {
+    assert(hnswlib::parseRangeList("0-3,8,10-11\n") == std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    assert(hnswlib::parseRangeList("").empty());
+
+    std::vector<int> nodes = hnswlib::numaNodes();
+    assert(!nodes.empty());
+    for (int node : nodes) {
+        assert(!hnswlib::numaNodeCpus(node).empty());
+    }
+}
+
+void test_allocation() {
+    std::vector<hnswlib::MemoryPolicy> policies(4);
+    policies[1].huge_pages = hnswlib::HugePages::Transparent;
+    policies[2].placement = hnswlib::NumaPlacement::Interleave;
+    policies[3].huge_pages = hnswlib::HugePages::Transparent;
+    policies[3].placement = hnswlib::NumaPlacement::Node;
+    policies[3].node = hnswlib::numaNodes().back();
+
+    for (const hnswlib::MemoryPolicy& policy : policies) {
+        size_t size = 5 * hnswlib::MemoryPolicy::HUGE_PAGE_SIZE + 123;
+        char* memory = (char*) hnswlib::allocateMemory(size, policy);
+        assert(memory != nullptr);
+        if (policy.huge_pages == hnswlib::HugePages::Transparent) {
+            assert((uintptr_t) memory % hnswlib::MemoryPolicy::HUGE_PAGE_SIZE == 0);
+        }
+        memset(memory, 7, size);
+
+        char* grown = (char*) hnswlib::reallocateMemory(memory, size, 2 * size, size, policy);
+        assert(grown != nullptr && grown[0] == 7 && grown[size - 1] == 7);
+        hnswlib::freeMemory(grown, 2 * size, policy);
+    }
+
+    // Reserved huge pages may not be configured, which fails the allocation instead of falling back
+    hnswlib::MemoryPolicy explicit_pages;
+    explicit_pages.huge_pages = hnswlib::HugePages::Explicit;
+    void* memory = hnswlib::allocateMemory(hnswlib::MemoryPolicy::HUGE_PAGE_SIZE, explicit_pages);
+    hnswlib::freeMemory(memory, hnswlib::MemoryPolicy::HUGE_PAGE_SIZE, explicit_pages);
+
+    hnswlib::MemoryPolicy missing_node;
+    missing_node.placement = hnswlib::NumaPlacement::Node;
+    missing_node.node = 4096;
+    bool thrown = false;
+    try {
+        hnswlib::allocateMemory(100, missing_node);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_index() {
+    const int d = 16;
+    const size_t n = 3000;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+
+    hnswlib::MemoryPolicy policy;
+    policy.huge_pages = hnswlib::HugePages::Transparent;
+    policy.placement = hnswlib::NumaPlacement::Interleave;
+
+    // An index built in memory of the policy matches one built in default memory
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> plain(&space, n / 2, 16, 100, 100);
+    hnswlib::HierarchicalNSW<float> placed(&space, n / 2, 16, 100, 100);
+    placed.setMemoryPolicy(policy);
+    for (hnswlib::HierarchicalNSW<float>* index : {&plain, &placed}) {
+        for (size_t i = 0; i < n / 2; ++i) {
+            index->addPoint(data.data() + i * d, i, {"t" + std::to_string(i % 5)});
+        }
+        index->resizeIndex(n);
+        for (size_t i = n / 2; i < n; ++i) {
+            index->addPoint(data.data() + i * d, i, {"t" + std::to_string(i % 5)});
+        }
+        index->setEf(50);
+    }
+    assert((uintptr_t) placed.data_level0_memory_ % hnswlib::MemoryPolicy::HUGE_PAGE_SIZE == 0);
+    for (size_t q = 0; q < n; q += 50) {
+        assert(results(plain, data.data() + q * d) == results(placed, data.data() + q * d));
+    }
+
+    // Setting the policy of a built index moves its memory, and an empty index loads into memory of its policy
+    plain.setMemoryPolicy(policy);
+    assert((uintptr_t) plain.data_level0_memory_ % hnswlib::MemoryPolicy::HUGE_PAGE_SIZE == 0);
+    plain.saveIndex("memory_policy.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space);
+    loaded.setMemoryPolicy(policy);
+    loaded.loadIndex("memory_policy.bin", &space);
+    loaded.setEf(50);
+    assert((uintptr_t) loaded.data_level0_memory_ % hnswlib::MemoryPolicy::HUGE_PAGE_SIZE == 0);
+    for (size_t q = 0; q < n; q += 50) {
+        assert(results(plain, data.data() + q * d) == results(loaded, data.data() + q * d));
+    }
+
+    // Back to the default policy, the memory comes from malloc again
+    loaded.setMemoryPolicy(hnswlib::MemoryPolicy());
+    loaded.resizeIndex(n + 10);
+    loaded.addPoint(data.data(), n, {"t1"});
+    assert(loaded.getCurrentElementCount() == n + 1);
+    std::remove("memory_policy.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_topology();
+    test_allocation();
+    test_index();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
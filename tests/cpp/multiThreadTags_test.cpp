@@ -0,0 +1,141 @@
+// This is a test file for the parallel insertion of tagged points
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test_add_points(bool adaptive) {
+    int d = 8;
+    size_t n = 4000;
+    size_t k = 10;
+    size_t num_tags = 20;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    std::vector<idx_t> labels(n);
+    std::vector<std::vector<std::string>> tags(n);
+    for (size_t i = 0; i < n; ++i) {
+        labels[i] = 1000 + i;
+        tags[i].push_back("tag_" + std::to_string(i % num_tags));
+        if (i % 3 == 0) {
+            tags[i].push_back("third");
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, false, adaptive, 2);
+    if (adaptive) {
+        for (size_t i = 0; i < n; ++i) {
+            alg_hnsw.addNodeTags(tags[i]);
+        }
+        alg_hnsw.flushTags();
+    }
+    alg_hnsw.addPoints(data.data(), labels.data(), tags, n, 8);
+
+    // Internal IDs are assigned in completion order, so every element's tags are checked through its label
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    for (size_t i = 0; i < n; ++i) {
+        hnswlib::tableint internal_id = alg_hnsw.label_lookup_.at(labels[i]);
+        std::vector<std::string> stored = alg_hnsw.tag_index.get(internal_id);
+        assert(stored == tags[i]);
+    }
+    for (size_t t = 0; t < num_tags; ++t) {
+        std::string tag = "tag_" + std::to_string(t);
+        const auto* postings = alg_hnsw.tag_index.getPostings(alg_hnsw.tag_index.resolve({tag})[0]);
+        assert(postings && postings->cardinality() == n / num_tags);
+
+        // The entry point of a tag is an element with the tag on the highest level any such element has
+        int max_level = 0;
+        for (size_t i = t; i < n; i += num_tags) {
+            max_level = std::max(max_level, alg_hnsw.element_levels_[alg_hnsw.label_lookup_.at(labels[i])]);
+        }
+        auto enterpoint = alg_hnsw.enterpoints.at(tag);
+        assert(enterpoint.first == max_level);
+        assert(alg_hnsw.element_levels_[enterpoint.second] == max_level);
+        assert((alg_hnsw.getExternalLabel(enterpoint.second) - 1000) % num_tags == t);
+    }
+
+    alg_hnsw.setEf(50);
+    for (size_t q = 0; q < 50; ++q) {
+        std::vector<std::string> filter = {"tag_" + std::to_string(q % num_tags)};
+        auto result = alg_hnsw.searchKnn(data.data() + q * d, k, filter);
+        assert(result.size() == k);
+        while (!result.empty()) {
+            assert((result.top().second - 1000) % num_tags == q % num_tags);
+            result.pop();
+        }
+    }
+}
+
+// Filtered searches run while other threads keep inserting tagged points
+void test_search_during_insert() {
+    int d = 8;
+    size_t n = 4000;
+    size_t k = 5;
+    size_t num_tags = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    std::vector<idx_t> labels(n);
+    std::vector<std::vector<std::string>> tags(n);
+    for (size_t i = 0; i < n; ++i) {
+        labels[i] = i;
+        tags[i].push_back("tag_" + std::to_string(i % num_tags));
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, false, false, 2);
+    alg_hnsw.addPoints(data.data(), labels.data(), std::vector<std::vector<std::string>>(tags.begin(), tags.begin() + n / 4), n / 4, 4);
+
+    std::thread inserter([&]() {
+        alg_hnsw.addPoints(data.data() + n / 4 * d, labels.data() + n / 4,
+                           std::vector<std::vector<std::string>>(tags.begin() + n / 4, tags.end()), n - n / 4, 4);
+    });
+
+    size_t searches = 0;
+    while (alg_hnsw.getCurrentElementCount() < n || searches < 100) {
+        size_t q = searches++;
+        std::vector<std::string> filter = {"tag_" + std::to_string(q % num_tags)};
+        auto result = alg_hnsw.searchKnn(data.data() + (q % n) * d, k, filter);
+        while (!result.empty()) {
+            assert(result.top().second % num_tags == q % num_tags);
+            result.pop();
+        }
+    }
+    inserter.join();
+    assert(alg_hnsw.getCurrentElementCount() == n);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_add_points(false);
+    test_add_points(true);
+    test_search_during_insert();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
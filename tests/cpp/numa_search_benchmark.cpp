@@ -0,0 +1,151 @@
+// Benchmarks multi-threaded search throughput for the memory policies of the index, with the search threads of each
+// NUMA node pinned to its CPUs and all nodes searching at once
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+struct Configuration {
+    const char* name;
+    hnswlib::HugePages huge_pages;
+    hnswlib::NumaPlacement placement;  // NumaPlacement::Node loads a replica of the index on every node
+};
+
+// Runs all queries on every node at once, on one thread per CPU of the node, and returns the QPS of each node
+std::vector<double> searchOnAllNodes(const std::vector<hnswlib::HierarchicalNSW<float>*>& indexes, const std::vector<int>& nodes,
+                                     const std::vector<float>& queries, int d, size_t k) {
+    size_t nq = queries.size() / d;
+    std::vector<double> qps(nodes.size());
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<std::atomic<size_t>>> next(nodes.size());
+    std::vector<std::unique_ptr<std::atomic<size_t>>> running(nodes.size());
+    std::atomic<bool> start(false);
+
+    for (size_t s = 0; s < nodes.size(); ++s) {
+        next[s].reset(new std::atomic<size_t>(0));
+        running[s].reset(new std::atomic<size_t>(0));
+        size_t cpus = hnswlib::numaNodeCpus(nodes[s]).size();
+        for (size_t t = 0; t < cpus; ++t) {
+            threads.emplace_back([&, s] {
+                hnswlib::pinThreadToNode(nodes[s]);
+                (*running[s])++;
+                while (!start) {
+                    std::this_thread::yield();
+                }
+                auto begin = std::chrono::steady_clock::now();
+                for (size_t q = (*next[s])++; q < nq; q = (*next[s])++) {
+                    indexes[s]->searchKnn(queries.data() + q * d, k, std::vector<std::string>());
+                }
+                // The last thread of a node to finish times the node
+                if (--(*running[s]) == 0) {
+                    qps[s] = nq / std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                }
+            });
+        }
+    }
+    start = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return qps;
+}
+
+}  // namespace
+
+// Usage: numa_search_benchmark [elements] [dimensions], by default 1000000 elements of 64 dimensions
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    int d = argc > 2 ? std::stoi(argv[2]) : 64;
+    size_t nq = 20000;
+    size_t k = 10;
+    const std::string path = "numa_search_benchmark.bin";
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> data(n * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    std::vector<float> queries(nq * d);
+    for (float& value : queries) {
+        value = distrib(rng);
+    }
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; ++i) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    {
+        std::cout << "Building index of " << n << " elements" << std::endl;
+        hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100);
+        index.addPoints(data.data(), labels.data(), {}, n);
+        index.saveIndex(path);
+    }
+    std::vector<float>().swap(data);
+
+    std::vector<int> nodes = hnswlib::numaNodes();
+    std::cout << nodes.size() << " NUMA nodes, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    std::vector<Configuration> configurations = {
+        {"malloc, 4 KB pages", hnswlib::HugePages::None, hnswlib::NumaPlacement::Default},
+        {"transparent huge pages", hnswlib::HugePages::Transparent, hnswlib::NumaPlacement::Default},
+        {"explicit huge pages", hnswlib::HugePages::Explicit, hnswlib::NumaPlacement::Default},
+        {"interleaved, 4 KB pages", hnswlib::HugePages::None, hnswlib::NumaPlacement::Interleave},
+        {"interleaved, transparent huge pages", hnswlib::HugePages::Transparent, hnswlib::NumaPlacement::Interleave},
+        {"replica per node, transparent huge pages", hnswlib::HugePages::Transparent, hnswlib::NumaPlacement::Node},
+    };
+
+    double base_qps = 0;
+    for (const Configuration& configuration : configurations) {
+        // The index is loaded once, or once for every node when it is replicated
+        std::vector<std::unique_ptr<hnswlib::HierarchicalNSW<float>>> loaded;
+        std::vector<hnswlib::HierarchicalNSW<float>*> indexes;
+        try {
+            for (size_t s = 0; s < nodes.size(); ++s) {
+                if (s == 0 || configuration.placement == hnswlib::NumaPlacement::Node) {
+                    hnswlib::MemoryPolicy policy;
+                    policy.huge_pages = configuration.huge_pages;
+                    policy.placement = configuration.placement;
+                    policy.node = nodes[s];
+                    loaded.emplace_back(new hnswlib::HierarchicalNSW<float>(&space));
+                    loaded.back()->setMemoryPolicy(policy);
+                    loaded.back()->loadIndex(path, &space);
+                    loaded.back()->setEf(100);
+                }
+                indexes.push_back(loaded.back().get());
+            }
+        } catch (const std::runtime_error& error) {
+            std::cout << configuration.name << ": skipped (" << error.what() << ")" << std::endl;
+            continue;
+        }
+
+        std::vector<double> qps = searchOnAllNodes(indexes, nodes, queries, d, k);
+        double total = 0;
+        std::cout << configuration.name << ":";
+        for (size_t s = 0; s < nodes.size(); ++s) {
+            std::cout << " node " << nodes[s] << " " << qps[s] << " QPS,";
+            total += qps[s];
+        }
+        if (base_qps == 0) {
+            base_qps = total;
+        }
+        std::cout << " total " << total << " QPS (" << total / base_qps << "x)" << std::endl;
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,275 @@
+// This is a test file for the int8, fp16 and product-quantized spaces and the re-ranking with full precision vectors
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<float> makeData(size_t count, int seed) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+void test_half_conversion() {
+    for (float value : {0.0f, 1.0f, -2.5f, 65504.0f, 0.333251953125f, std::ldexp(1.0f, -24), std::ldexp(3.0f, -20)}) {
+        assert(hnswlib::halfToFloat(hnswlib::floatToHalf(value)) == value);
+    }
+    // Ties round to even, values beyond the range become infinite
+    assert(hnswlib::halfToFloat(hnswlib::floatToHalf(1.0f + std::ldexp(1.0f, -11))) == 1.0f);
+    assert(hnswlib::halfToFloat(hnswlib::floatToHalf(1.0f + std::ldexp(3.0f, -11))) == 1.0f + std::ldexp(1.0f, -9));
+    assert(std::isinf(hnswlib::halfToFloat(hnswlib::floatToHalf(1e6f))));
+}
+
+// The SIMD kernels match the distances between the decoded vectors
+void test_kernels() {
+    for (size_t d : {5, 16, 33, 200}) {
+        std::vector<float> data = makeData(2 * d, 47);
+        for (hnswlib::SpaceMetric metric : {hnswlib::SpaceMetric::L2, hnswlib::SpaceMetric::InnerProduct}) {
+            hnswlib::Float16Space fp16(d, metric);
+            hnswlib::Int8Space int8(d, metric);
+            int8.train(data.data(), 2);
+
+            std::vector<uint16_t> half(2 * d);
+            std::vector<uint8_t> bytes(2 * d);
+            fp16.encode(data.data(), half.data());
+            fp16.encode(data.data() + d, half.data() + d);
+            int8.encode(data.data(), bytes.data());
+            int8.encode(data.data() + d, bytes.data() + d);
+
+            std::vector<float> decoded_half(2 * d), decoded_bytes(2 * d);
+            for (size_t i = 0; i < 2 * d; i++) {
+                decoded_half[i] = hnswlib::halfToFloat(half[i]);
+                decoded_bytes[i] = int8.getOffsets()[i % d] + bytes[i] * int8.getScales()[i % d];
+            }
+
+            hnswlib::SpaceInterface<float>* exact = fp16.get_exact_space();
+            float expected_half = exact->get_dist_func()(decoded_half.data(), decoded_half.data() + d, exact->get_dist_func_param());
+            float expected_bytes = exact->get_dist_func()(decoded_bytes.data(), decoded_bytes.data() + d, exact->get_dist_func_param());
+            float distance_half = fp16.get_dist_func()(half.data(), half.data() + d, fp16.get_dist_func_param());
+            float distance_bytes = int8.get_dist_func()(bytes.data(), bytes.data() + d, int8.get_dist_func_param());
+            assert(std::fabs(distance_half - expected_half) <= 1e-4f * std::max(1.0f, std::fabs(expected_half)));
+            assert(std::fabs(distance_bytes - expected_bytes) <= 1e-4f * std::max(1.0f, std::fabs(expected_bytes)));
+        }
+    }
+}
+
+// Fraction of the exact neighbors found, checking that re-ranked results carry exact distances
+float recall(hnswlib::HierarchicalNSW<float>& index, const std::vector<float>& data, const std::vector<float>& queries,
+             int d, size_t k, bool exact_distances) {
+    hnswlib::L2Space space(d);
+    size_t n = data.size() / d, nq = queries.size() / d, found = 0;
+    for (size_t q = 0; q < nq; ++q) {
+        const float* query = queries.data() + q * d;
+        std::priority_queue<std::pair<float, idx_t>> expected;
+        for (idx_t i = 0; i < n; ++i) {
+            expected.emplace(space.get_dist_func()(query, data.data() + d * i, space.get_dist_func_param()), i);
+            if (expected.size() > k) {
+                expected.pop();
+            }
+        }
+
+        std::unordered_set<idx_t> result;
+        auto knn = index.searchKnn(query, k, std::vector<std::string>());
+        while (!knn.empty()) {
+            float distance = space.get_dist_func()(query, data.data() + d * knn.top().second, space.get_dist_func_param());
+            assert(!exact_distances || knn.top().first == distance);
+            result.insert(knn.top().second);
+            knn.pop();
+        }
+        while (!expected.empty()) {
+            found += result.count(expected.top().second);
+            expected.pop();
+        }
+    }
+    return float(found) / (nq * k);
+}
+
+void test_search() {
+    int d = 32;
+    idx_t n = 5000;
+    size_t k = 10;
+    std::vector<float> data = makeData(n * d, 47);
+    std::vector<float> queries = makeData(100 * d, 48);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space l2(d);
+    hnswlib::Float16Space fp16(d);
+    hnswlib::Int8Space int8(d);
+    int8.train(data.data(), 1000);
+    assert(fp16.get_data_size() * 2 == l2.get_data_size() && int8.get_data_size() * 4 == l2.get_data_size());
+
+    hnswlib::HierarchicalNSW<float> full_index(&l2, n);
+    hnswlib::HierarchicalNSW<float> fp16_index(&fp16, n);
+    hnswlib::HierarchicalNSW<float> int8_index(&int8, n);
+    hnswlib::HierarchicalNSW<float> reranked_index(&int8, n);
+    reranked_index.setExactVectorFile("quantized_vectors.bin");
+
+    for (hnswlib::HierarchicalNSW<float>* index : {&full_index, &fp16_index, &int8_index, &reranked_index}) {
+        index->addPoints(data.data(), labels.data(), {}, n, 1);
+        index->setEf(100);
+    }
+
+    float recall_full = recall(full_index, data, queries, d, k, true);
+    float recall_fp16 = recall(fp16_index, data, queries, d, k, false);
+    float recall_int8 = recall(int8_index, data, queries, d, k, false);
+    float recall_reranked = recall(reranked_index, data, queries, d, k, true);
+    std::cout << "Recall float: " << recall_full << ", fp16: " << recall_fp16 << ", int8: " << recall_int8
+              << ", int8 re-ranked: " << recall_reranked << std::endl;
+    assert(recall_fp16 >= recall_full - 0.02f);
+    assert(recall_reranked >= recall_int8);
+    assert(recall_reranked >= recall_full - 0.05f);
+
+    // Batched queries are re-ranked as well
+    std::vector<const void*> batch_queries = {queries.data(), queries.data() + d};
+    auto batch = reranked_index.searchKnnBatch(batch_queries, k);
+    for (size_t q = 0; q < batch_queries.size(); ++q) {
+        auto single = reranked_index.searchKnn(batch_queries[q], k, std::vector<std::string>());
+        assert(batch[q].size() == single.size());
+        while (!single.empty()) {
+            assert(batch[q].top() == single.top());
+            batch[q].pop();
+            single.pop();
+        }
+    }
+
+    // The full precision vectors are found again after loading the index
+    assert(reranked_index.getDataByLabel<float>(7) == std::vector<float>(data.begin() + 7 * d, data.begin() + 8 * d));
+    reranked_index.saveIndex("quantized_index.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&int8, "quantized_index.bin");
+    loaded.setExactVectorFile("quantized_vectors.bin");
+    loaded.setEf(100);
+    assert(recall(loaded, data, queries, d, k, true) == recall_reranked);
+
+    bool thrown = false;
+    try {
+        full_index.setExactVectorFile("quantized_vectors.bin");
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::remove("quantized_index.bin");
+    std::remove("quantized_vectors.bin");
+}
+
+// The lookup tables of queries and the distances between codes match the distances to the decoded vectors
+void test_pq_kernels() {
+    size_t d = 12, m = 4, sub_dim = 3;
+    std::vector<float> data = makeData(300 * d, 47);
+    for (hnswlib::SpaceMetric metric : {hnswlib::SpaceMetric::L2, hnswlib::SpaceMetric::InnerProduct}) {
+        hnswlib::PQSpace pq(d, m, metric);
+        pq.train(data.data(), 300, 5);
+        assert(pq.get_data_size() == m && pq.get_query_size() == m * 256 * sizeof(float));
+
+        std::vector<uint8_t> codes(2 * m);
+        pq.encode(data.data(), codes.data());
+        pq.encode(data.data() + d, codes.data() + m);
+        std::vector<float> decoded(2 * d);
+        for (size_t i = 0; i < 2 * d; i++) {
+            size_t j = (i % d) / sub_dim;
+            decoded[i] = pq.getCentroids()[(j * 256 + codes[(i / d) * m + j]) * sub_dim + i % sub_dim];
+        }
+        std::vector<float> table(m * 256);
+        pq.encode_query(data.data(), table.data());
+
+        hnswlib::SpaceInterface<float>* exact = pq.get_exact_space();
+        float expected_codes = exact->get_dist_func()(decoded.data(), decoded.data() + d, exact->get_dist_func_param());
+        float expected_query = exact->get_dist_func()(data.data(), decoded.data() + d, exact->get_dist_func_param());
+        float distance_codes = pq.get_dist_func()(codes.data(), codes.data() + m, pq.get_dist_func_param());
+        float distance_query = pq.get_query_dist_func()(table.data(), codes.data() + m, pq.get_dist_func_param());
+        assert(std::fabs(distance_codes - expected_codes) <= 1e-4f * std::max(1.0f, std::fabs(expected_codes)));
+        assert(std::fabs(distance_query - expected_query) <= 1e-4f * std::max(1.0f, std::fabs(expected_query)));
+    }
+
+    bool thrown = false;
+    try {
+        hnswlib::PQSpace pq(d, 5);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_pq_search() {
+    int d = 32;
+    idx_t n = 5000;
+    size_t k = 10;
+    std::vector<float> data = makeData(n * d, 47);
+    std::vector<float> queries = makeData(100 * d, 48);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space l2(d);
+    hnswlib::PQSpace pq(d, 16);
+    pq.train(data.data(), 2000, 10);
+
+    hnswlib::HierarchicalNSW<float> full_index(&l2, n);
+    hnswlib::HierarchicalNSW<float> pq_index(&pq, n);
+    pq_index.setExactVectorFile("pq_vectors.bin");
+    for (hnswlib::HierarchicalNSW<float>* index : {&full_index, &pq_index}) {
+        index->addPoints(data.data(), labels.data(), {}, n, 1);
+        index->setEf(100);
+    }
+
+    float recall_full = recall(full_index, data, queries, d, k, true);
+    float recall_pq = recall(pq_index, data, queries, d, k, true);
+    std::cout << "Recall float: " << recall_full << ", pq re-ranked: " << recall_pq << std::endl;
+    assert(recall_pq >= recall_full - 0.1f);
+
+    // Batched queries search with the lookup tables too
+    std::vector<const void*> batch_queries = {queries.data(), queries.data() + d, queries.data() + 2 * d};
+    auto batch = pq_index.searchKnnBatch(batch_queries, k);
+    for (size_t q = 0; q < batch_queries.size(); ++q) {
+        auto single = pq_index.searchKnn(batch_queries[q], k, std::vector<std::string>());
+        assert(batch[q].size() == single.size());
+        while (!single.empty()) {
+            assert(batch[q].top() == single.top());
+            batch[q].pop();
+            single.pop();
+        }
+    }
+
+    // An index loads with a space given the centroids it was built with
+    pq_index.saveIndex("pq_index.bin");
+    hnswlib::PQSpace restored(d, 16);
+    restored.setCentroids(pq.getCentroids());
+    hnswlib::HierarchicalNSW<float> loaded(&restored, "pq_index.bin");
+    loaded.setExactVectorFile("pq_vectors.bin");
+    loaded.setEf(100);
+    assert(recall(loaded, data, queries, d, k, true) == recall_pq);
+    std::remove("pq_index.bin");
+    std::remove("pq_vectors.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_half_conversion();
+    test_kernels();
+    test_search();
+    test_pq_kernels();
+    test_pq_search();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+// This is a test file for the selectivity-aware query planner
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <iostream>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test_plan_choice() {
+    hnswlib::QueryPlanner planner;
+    hnswlib::QueryStats stats;
+    size_t elements = 1000000, ef = 100, maxM0 = 32;
+
+    planner.plan(0, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::BruteForce);
+    assert(stats.estimated_cost == 0);
+
+    planner.plan(500, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::BruteForce);
+    assert(stats.estimated_cost == 500);
+
+    planner.plan(100000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::FilteredGraph);
+
+    planner.plan(900000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::PostFilter);
+    assert(stats.ef > ef);
+
+    planner.enabled = false;
+    planner.plan(500, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::FilteredGraph);
+}
+
+void test_planned_search() {
+    int d = 8;
+    idx_t n = 2000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        std::vector<std::string> tags = {"common"};
+        if (i % 100 == 0) {
+            tags.push_back("rare");
+        }
+        alg_hnsw.addPoint(data.data() + d * i, i, tags);
+    }
+
+    for (idx_t q = 0; q < 10; ++q) {
+        const float* query = data.data() + d * (q * 7);
+
+        // The rare tag is scanned exactly, so the result must match a brute-force search
+        hnswlib::QueryStats stats;
+        auto result = alg_hnsw.searchKnnWithStats(query, k, {"rare"}, stats);
+        assert(stats.plan == hnswlib::QueryPlan::BruteForce);
+        assert(stats.estimated_matches == n / 100);
+
+        std::priority_queue<std::pair<float, idx_t>> expected;
+        for (idx_t i = 0; i < n; i += 100) {
+            expected.emplace(space.get_dist_func()(query, data.data() + d * i, space.get_dist_func_param()), i);
+            if (expected.size() > k) {
+                expected.pop();
+            }
+        }
+        assert(result.size() == expected.size());
+        while (!result.empty()) {
+            assert(result.top().second == expected.top().second);
+            result.pop();
+            expected.pop();
+        }
+
+        // Every element carries the common tag, which makes post-filtering the cheapest plan
+        result = alg_hnsw.searchKnnWithStats(query, k, {"common"}, stats);
+        assert(stats.plan == hnswlib::QueryPlan::PostFilter);
+        assert(result.size() == k);
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_plan_choice();
+    test_planned_search();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,150 @@
+// This is a test file for the tag distances of the relationship graph
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+using Graph = hnswlib::RelationshipGraph<hnswlib::tag_type>;
+
+// Edge weights are the maximum co-occurrence frequency minus the edge's frequency plus one, where relating a pair counts it twice:
+// 1-2 related three times (weight 1), 3-4 twice (weight 3), 2-3 and 1-5 once (weight 5)
+void relate(Graph& graph) {
+    for (int i = 0; i < 3; i++) {
+        graph.relate({1, 2});
+    }
+    graph.relate({2, 3});
+    graph.relate({3, 4});
+    graph.relate({3, 4});
+    graph.relate({1, 5});
+}
+
+void test_lazy_distances() {
+    const int unreachable = std::numeric_limits<int32_t>::max();
+    std::unordered_map<hnswlib::tag_type, std::string> lookup;
+    std::unordered_map<std::string, hnswlib::tag_type> inverted;
+
+    Graph graph(lookup, inverted);
+    graph.setLazyDistances(8, 2);
+    relate(graph);
+    graph.computeDistances();
+
+    assert(graph.distance(1, 1) == 0);
+    assert(graph.distance(1, 2) == 1);
+    assert(graph.distance(1, 3) == 6);
+    assert(graph.distance(1, 4) == 9);
+    assert(graph.distance(5, 4) == 14);
+    assert(graph.distance(4, 5) == 14);
+
+    // Evicted sources are recomputed with the same result
+    assert(graph.distance(3, 1) == 6);
+    assert(graph.distance(2, 5) == 6);
+    assert(graph.distance(1, 4) == 9);
+
+    Graph bounded(lookup, inverted);
+    bounded.setLazyDistances(2, 16);
+    relate(bounded);
+    bounded.computeDistances();
+
+    assert(bounded.distance(1, 3) == 6);
+    assert(bounded.distance(1, 4) == unreachable);
+    assert(bounded.distance(2, 4) == 8);
+
+    // Relating more tags after flushing invalidates the cached distances
+    for (int i = 0; i < 3; i++) {
+        bounded.relate({2, 4});
+    }
+    bounded.computeDistances();
+    assert(bounded.distance(1, 4) == 2);
+
+    std::string path = "relationship_graph_test.bin";
+    {
+        std::ofstream output(path, std::ios::binary);
+        graph.saveIndex(output);
+    }
+    Graph loaded(lookup, inverted);
+    {
+        std::ifstream input(path, std::ios::binary);
+        loaded.loadIndex(input, lookup, inverted);
+    }
+    std::remove(path.c_str());
+
+    assert(loaded.distance(5, 4) == 14);
+    assert(loaded.distance(1, 3) == 6);
+}
+
+void test_parallel_distances() {
+    std::unordered_map<hnswlib::tag_type, std::string> lookup;
+    std::unordered_map<std::string, hnswlib::tag_type> inverted;
+
+    Graph graph(lookup, inverted);
+    relate(graph);
+    graph.relate({6, 7});
+    graph.computeDistances(4);
+
+    Graph lazy(lookup, inverted);
+    lazy.setLazyDistances(100, 4);
+    relate(lazy);
+    lazy.relate({6, 7});
+    lazy.computeDistances();
+
+    assert(graph.distance(5, 4) == 14);
+    assert(graph.distance(6, 1) == std::numeric_limits<int32_t>::max());
+    for (hnswlib::tag_type from = 1; from <= 7; from++) {
+        for (hnswlib::tag_type to = 1; to <= 7; to++) {
+            assert(graph.distance(from, to) == lazy.distance(from, to));
+            assert(graph.distance(from, to) == graph.distance(to, from));
+        }
+    }
+
+    std::string path = "relationship_graph_test.bin";
+    {
+        std::ofstream output(path, std::ios::binary);
+        graph.saveIndex(output);
+    }
+    Graph loaded(lookup, inverted);
+    {
+        std::ifstream input(path, std::ios::binary);
+        loaded.loadIndex(input, lookup, inverted);
+    }
+    std::remove(path.c_str());
+
+    for (hnswlib::tag_type from = 1; from <= 7; from++) {
+        for (hnswlib::tag_type to = 1; to <= 7; to++) {
+            assert(graph.distance(from, to) == loaded.distance(from, to));
+        }
+    }
+}
+
+void test_distance_buckets() {
+    using Distances = hnswlib::TriangularDistances<int32_t>;
+
+    for (int32_t distance = 0; distance < 64; distance++) {
+        assert(Distances::decode(Distances::encode(distance)) == distance);
+    }
+    for (double distance = 64; distance < 5e8; distance *= 1.01) {
+        double decoded = Distances::decode(Distances::encode(static_cast<int32_t>(distance)));
+        assert(std::abs(decoded - static_cast<int32_t>(distance)) <= 0.05 * distance);
+    }
+    assert(Distances::decode(Distances::encode(std::numeric_limits<int32_t>::max())) == std::numeric_limits<int32_t>::max());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_lazy_distances();
+    test_parallel_distances();
+    test_distance_buckets();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Benchmarks the query throughput of an index before and after renumbering its elements in a locality-improving order
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs the queries and returns the labels found, to check that reordering leaves the results unchanged
+std::vector<idx_t> runQueries(const hnswlib::HierarchicalNSW<float>& index, const std::vector<float>& queries, int d,
+                              size_t k, size_t num_tags, bool filtered, double& qps) {
+    size_t nq = queries.size() / d;
+    std::vector<idx_t> labels;
+    labels.reserve(nq * k);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < nq; ++q) {
+        std::vector<std::string> filter;
+        if (filtered) {
+            filter.push_back("type_" + std::to_string(q % num_tags));
+        }
+        auto result = index.searchKnn(queries.data() + q * d, k, filter);
+        while (!result.empty()) {
+            labels.push_back(result.top().second);
+            result.pop();
+        }
+    }
+    qps = nq / secondsSince(start);
+    return labels;
+}
+
+}  // namespace
+
+// Usage: reorder_benchmark [elements] [dimensions], by default 200000 elements of 64 dimensions
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::stoul(argv[1]) : 200000;
+    int d = argc > 2 ? std::stoi(argv[2]) : 64;
+    size_t nq = 5000;
+    size_t k = 10;
+    size_t num_tags = 20;
+    const std::string path = "reorder_benchmark.bin";
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> data(n * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    std::vector<float> queries(nq * d);
+    for (float& value : queries) {
+        value = distrib(rng);
+    }
+    std::vector<idx_t> labels(n);
+    std::vector<std::vector<std::string>> tags(n);
+    for (size_t i = 0; i < n; ++i) {
+        labels[i] = i;
+        tags[i] = {"type_" + std::to_string(i % num_tags)};
+    }
+
+    hnswlib::L2Space space(d);
+    {
+        std::cout << "Building index of " << n << " elements" << std::endl;
+        hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100);
+        index.addPoints(data.data(), labels.data(), tags, n);
+        index.saveIndex(path);
+    }
+
+    // Every order starts from the same saved index, in insertion order
+    struct Variant {
+        const char* name;
+        bool reorder;
+        hnswlib::GraphOrder method;
+        bool cluster_by_tags;
+    };
+    std::vector<Variant> variants = {
+        {"insertion order", false, hnswlib::GraphOrder::BFS, false},
+        {"BFS", true, hnswlib::GraphOrder::BFS, false},
+        {"Gorder", true, hnswlib::GraphOrder::Gorder, false},
+        {"Gorder, tag clustered", true, hnswlib::GraphOrder::Gorder, true},
+    };
+
+    double base_qps[2] = {0, 0};
+    std::vector<idx_t> base_labels[2];
+    for (const Variant& variant : variants) {
+        hnswlib::HierarchicalNSW<float> index(&space, path);
+        index.setEf(100);
+        double reorder_time = 0;
+        if (variant.reorder) {
+            auto start = std::chrono::steady_clock::now();
+            index.reorder(variant.method, variant.cluster_by_tags);
+            reorder_time = secondsSince(start);
+        }
+
+        for (int filtered = 0; filtered < 2; ++filtered) {
+            double qps;
+            std::vector<idx_t> found = runQueries(index, queries, d, k, num_tags, filtered, qps);
+            if (!variant.reorder) {
+                base_qps[filtered] = qps;
+                base_labels[filtered] = found;
+            } else if (found != base_labels[filtered]) {
+                std::cerr << variant.name << " changed the search results" << std::endl;
+                return 1;
+            }
+            std::cout << variant.name << (filtered ? ", filtered: " : ", unfiltered: ") << qps << " QPS ("
+                      << qps / base_qps[filtered] << "x)";
+            if (variant.reorder && !filtered) {
+                std::cout << ", reordered in " << reorder_time << " s";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,147 @@
+// This is a test file for renumbering the elements of an index in a locality-improving order
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const int d = 16;
+const size_t n = 4000;
+const size_t num_tags = 8;
+
+std::vector<float> makeData(size_t count, int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+std::vector<std::string> tagsOf(size_t i) {
+    std::vector<std::string> tags = {"type_" + std::to_string(i % num_tags)};
+    if (i % 3 == 0) {
+        tags.push_back("rare_" + std::to_string(i % 5));
+    }
+    return tags;
+}
+
+// Mean number of blocks of 16 consecutive internal IDs holding the level-0 neighbors of an element, which are the
+// records a search reads on expanding it
+double meanNeighborBlocks(const hnswlib::HierarchicalNSW<float>& index) {
+    size_t blocks = 0;
+    for (hnswlib::tableint id = 0; id < index.cur_element_count; ++id) {
+        hnswlib::linklistsizeint* list = index.get_linklist0(id);
+        hnswlib::tableint* data = (hnswlib::tableint*) (list + 1);
+        std::set<hnswlib::tableint> touched;
+        for (size_t j = 0; j < index.getListCount(list); ++j) {
+            touched.insert(data[j] / 16);
+        }
+        blocks += touched.size();
+    }
+    return double(blocks) / index.cur_element_count;
+}
+
+std::vector<std::pair<float, idx_t>> results(const hnswlib::HierarchicalNSW<float>& index, const float* query,
+                                             const std::vector<std::string>& tags) {
+    std::vector<std::pair<float, idx_t>> result;
+    auto knn = index.searchKnn(query, 10, tags);
+    while (!knn.empty()) {
+        result.push_back(knn.top());
+        knn.pop();
+    }
+    return result;
+}
+
+void test_reorder(hnswlib::GraphOrder method, bool cluster_by_tags) {
+    std::vector<float> data = makeData(n, 47);
+    std::vector<float> queries = makeData(100, 48);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100, 100, true, false, 2, 1);
+    for (size_t i = 0; i < n; ++i) {
+        index.addPoint(data.data() + i * d, i, tagsOf(i));
+    }
+    for (size_t i = 0; i < n; i += 97) {
+        index.markDelete(i);
+    }
+    index.setEf(50);
+
+    // Each query runs unfiltered, with a common tag, and with a rare tag that the planner may answer by brute force
+    std::vector<std::vector<std::string>> filters = {{}, {"type_3"}, {"rare_2"}};
+    std::vector<std::vector<std::pair<float, idx_t>>> expected;
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        for (const auto& filter : filters) {
+            expected.push_back(results(index, queries.data() + q * d, filter));
+        }
+    }
+    double neighbor_blocks = meanNeighborBlocks(index);
+    size_t deleted = index.getDeletedCount();
+
+    index.reorder(method, cluster_by_tags);
+    assert(meanNeighborBlocks(index) < neighbor_blocks);
+    assert(index.getDeletedCount() == deleted && index.deleted_elements.size() == deleted);
+
+    // The elements keep their labels, vectors, tags, levels and deletion marks under their new internal IDs
+    assert(index.label_lookup_.size() == n);
+    for (size_t i = 0; i < n; ++i) {
+        hnswlib::tableint id = index.label_lookup_.at(i);
+        assert(index.getExternalLabel(id) == i);
+        assert(index.tag_index.get(id) == tagsOf(i));
+        assert(index.tag_index.getPostings(index.tag_index.resolveTag(tagsOf(i)[0]))->contains(id));
+        assert(index.isMarkedDeleted(id) == (i % 97 == 0));
+        assert(index.deleted_elements.count(id) == (i % 97 == 0));
+        assert(memcmp(index.getDataByInternalId(id), data.data() + i * d, d * sizeof(float)) == 0);
+    }
+    for (const auto& pair : index.enterpoints) {
+        assert(index.element_levels_[pair.second.second] >= (int) pair.second.first);
+    }
+    assert(index.element_levels_[index.enterpoint_node_] == index.maxlevel_);
+
+    // Searches follow the same graph and return the same results
+    size_t r = 0;
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        for (const auto& filter : filters) {
+            assert(results(index, queries.data() + q * d, filter) == expected[r++]);
+        }
+    }
+
+    // The reordered index saves, loads and keeps accepting insertions and replacements of deleted elements
+    index.saveIndex("reorder_index.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space, "reorder_index.bin", false, n + 100, true);
+    loaded.setEf(50);
+    r = 0;
+    for (size_t q = 0; q < queries.size() / d; ++q) {
+        for (const auto& filter : filters) {
+            assert(results(loaded, queries.data() + q * d, filter) == expected[r++]);
+        }
+    }
+    for (size_t i = 0; i < 100; ++i) {
+        loaded.addPoint(queries.data() + (i % 100) * d, n + i, tagsOf(i), i % 2 == 0);
+    }
+    assert(loaded.getCurrentElementCount() == n + 100 - deleted && loaded.getDeletedCount() == 0);
+    std::remove("reorder_index.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    for (hnswlib::GraphOrder method : {hnswlib::GraphOrder::BFS, hnswlib::GraphOrder::Gorder}) {
+        test_reorder(method, false);
+        test_reorder(method, true);
+    }
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+// This is a test file for the tag posting bitmaps
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test_bitmap_containers() {
+    hnswlib::TagBitmap<hnswlib::tableint> sparse, dense;
+    std::set<hnswlib::tableint> sparse_ids, dense_ids;
+
+    // The sparse bitmap keeps array containers, the dense one converts its first chunk to a bitset
+    for (hnswlib::tableint id = 0; id < 200000; id += 97) {
+        sparse.add(id);
+        sparse_ids.insert(id);
+    }
+    for (hnswlib::tableint id = 0; id < 10000; id++) {
+        dense.add(id);
+        dense_ids.insert(id);
+    }
+    dense.add(150000);
+    dense_ids.insert(150000);
+    dense.add(5);
+
+    assert(sparse.cardinality() == sparse_ids.size());
+    assert(dense.cardinality() == dense_ids.size());
+
+    hnswlib::QueryBitmap<hnswlib::tableint> query;
+    query.unionWith(sparse);
+    query.unionWith(dense);
+
+    for (hnswlib::tableint id = 0; id < 210000; id++) {
+        bool in_sparse = sparse_ids.count(id) != 0, in_dense = dense_ids.count(id) != 0;
+        assert(sparse.contains(id) == in_sparse);
+        assert(dense.contains(id) == in_dense);
+        assert(query.contains(id) == (in_sparse || in_dense));
+    }
+}
+
+void test_filtered_search_after_load() {
+    int d = 8;
+    idx_t n = 500;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i, {"tag_" + std::to_string(i % 5)});
+    }
+
+    std::string path = "tag_bitmap_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    std::remove(path.c_str());
+
+    for (idx_t q = 0; q < 20; ++q) {
+        auto result = loaded.searchKnn(data.data() + d * q, k, {"tag_" + std::to_string(q % 5)});
+        assert(!result.empty());
+        while (!result.empty()) {
+            assert(result.top().second % 5 == q % 5);
+            result.pop();
+        }
+        assert(loaded.searchKnn(data.data() + d * q, k, {"unknown"}).empty());
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_bitmap_containers();
+    test_filtered_search_after_load();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
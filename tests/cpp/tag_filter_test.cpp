@@ -0,0 +1,221 @@
+// This is a test file for compiled AND/OR/NOT tag filter expressions
+
+#include "../../hnswlib/hnswlib.h"
+#include "../../hnswlib/postfilter_hnsw.h"
+#include "../../hnswlib/multi_filter_hnsw.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+bool parseFails(const std::string& text) {
+    try {
+        hnswlib::TagExpression::parse(text);
+    } catch (const std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+void test_parse() {
+    using hnswlib::TagExpression;
+
+    assert(TagExpression::parse("a AND (b OR NOT c)").toString() == "(a AND (b OR NOT c))");
+    assert(TagExpression::parse("a OR b AND c").toString() == "(a OR (b AND c))");
+    assert(TagExpression::parse("NOT NOT a").toString() == "NOT NOT a");
+    assert(TagExpression::parse("\"new york\" AND NOT \"AND\"").toString() == "(new york AND NOT AND)");
+
+    assert(parseFails(""));
+    assert(parseFails("a AND"));
+    assert(parseFails("(a OR b"));
+    assert(parseFails("a b"));
+    assert(parseFails("\"a"));
+}
+
+void test_compile() {
+    using hnswlib::TagExpression;
+    using hnswlib::TagFilterProgram;
+    using Operation = TagFilterProgram::Operation;
+
+    // Tag IDs 1 to 3 with decreasing frequency, 0 for unknown tags
+    std::unordered_map<std::string, hnswlib::tag_type> ids = {{"common", 1}, {"medium", 2}, {"rare", 3}};
+    std::vector<size_t> frequencies = {0, 900, 300, 10};
+    auto resolve = [&](const std::string& tag) { return ids.count(tag) ? ids.at(tag) : 0; };
+    auto frequency = [&](hnswlib::tag_type tag) { return frequencies[tag]; };
+
+    // The rarest operand of an AND is tested first
+    TagFilterProgram program = TagFilterProgram::compile(TagExpression::parse("common AND medium AND rare"), 1000, resolve, frequency);
+    assert(program.size() == 4);
+    assert(program.instruction(0).operation == Operation::And);
+    assert(program.tags(1) == std::vector<hnswlib::tag_type>({3}));
+    assert(program.tags(3) == std::vector<hnswlib::tag_type>({1}));
+    assert(program.selectivity() < 0.01);
+
+    std::vector<hnswlib::tag_type> driving;
+    assert(program.drivingTags(driving));
+    assert(driving == std::vector<hnswlib::tag_type>({3}));
+
+    // A plain tag list becomes a single test, double negations cancel out
+    program = TagFilterProgram::compile(TagExpression::anyOf({"rare", "common", "unknown"}), 1000, resolve, frequency);
+    assert(program.size() == 1);
+    assert(program.instruction(0).operation == Operation::Any);
+    program = TagFilterProgram::compile(TagExpression::parse("NOT NOT rare"), 1000, resolve, frequency);
+    assert(program.size() == 1);
+
+    hnswlib::tag_type both[] = {1, 3}, commonOnly[] = {1}, none[] = {7};
+    program = TagFilterProgram::compile(TagExpression::parse("(rare OR medium) AND NOT unknown"), 1000, resolve, frequency);
+    assert(program.matches(both, both + 2));
+    assert(!program.matches(commonOnly, commonOnly + 1));
+    program = TagFilterProgram::compile(TagExpression::parse("NOT medium"), 1000, resolve, frequency);
+    assert(program.matches(none, none + 1));
+    assert(!program.drivingTags(driving));
+}
+
+// Tags of element i, with a predicate for every tested expression
+std::vector<std::string> tagsOf(idx_t i) {
+    std::vector<std::string> tags = {i % 2 ? "odd" : "even"};
+    if (i % 3 == 0) tags.push_back("three");
+    if (i % 5 == 0) tags.push_back("five");
+    return tags;
+}
+
+const std::vector<std::pair<std::string, std::function<bool(idx_t)>>> expressions = {
+    {"three AND five", [](idx_t i) { return i % 15 == 0; }},
+    {"three AND NOT even", [](idx_t i) { return i % 3 == 0 && i % 2; }},
+    {"(three OR five) AND NOT odd", [](idx_t i) { return (i % 3 == 0 || i % 5 == 0) && i % 2 == 0; }},
+    {"NOT three", [](idx_t i) { return i % 3 != 0; }},
+    {"five OR missing", [](idx_t i) { return i % 5 == 0; }},
+    {"missing AND five", [](idx_t) { return false; }},
+};
+
+// Checks that every result matches and, as graph searches are approximate, that most of the exact neighbors are found
+template<typename Search>
+void checkSearch(const std::string& name, const std::vector<float>& data, int d, idx_t n, hnswlib::L2Space& space, Search search, float min_recall = 0.8f) {
+    size_t k = 10;
+    for (const auto& expression : expressions) {
+        hnswlib::TagExpression filter = hnswlib::TagExpression::parse(expression.first);
+        size_t found = 0, total = 0;
+
+        for (idx_t q = 0; q < 20; ++q) {
+            const float* query = data.data() + d * (q * 37);
+            std::priority_queue<std::pair<float, idx_t>> expected;
+            for (idx_t i = 0; i < n; ++i) {
+                if (expression.second(i)) {
+                    expected.emplace(space.get_dist_func()(query, data.data() + d * i, space.get_dist_func_param()), i);
+                    if (expected.size() > k) {
+                        expected.pop();
+                    }
+                }
+            }
+
+            std::unordered_set<idx_t> result;
+            for (const std::pair<float, idx_t>& item : search(query, k, filter)) {
+                assert(expression.second(item.second));
+                result.insert(item.second);
+            }
+            total += expected.size();
+            while (!expected.empty()) {
+                found += result.count(expected.top().second);
+                expected.pop();
+            }
+        }
+
+        float recall = total ? float(found) / total : 1.0f;
+        if (recall < min_recall) {
+            std::cerr << name << ": " << expression.first << " recall " << recall << std::endl;
+            assert(false);
+        }
+    }
+}
+
+template<typename Queue>
+std::vector<typename Queue::value_type> drain(Queue queue) {
+    std::vector<typename Queue::value_type> items;
+    while (!queue.empty()) {
+        items.push_back(queue.top());
+        queue.pop();
+    }
+    return items;
+}
+
+void test_search() {
+    int d = 8;
+    idx_t n = 3000;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    for (size_t slots : {0, 4}) {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 200, 100, false, false, slots);
+        for (idx_t i = 0; i < n; ++i) {
+            alg_hnsw.addPoint(data.data() + d * i, i, tagsOf(i));
+        }
+        alg_hnsw.setEf(100);
+
+        checkSearch("searchKnn", data, d, n, space, [&](const float* query, size_t k, const hnswlib::TagExpression& filter) {
+            return drain(alg_hnsw.searchKnn(query, k, filter));
+        });
+
+        // Every plan gives exact filtering
+        for (bool planned : {false, true}) {
+            hnswlib::QueryPlanner planner;
+            planner.enabled = planned;
+            alg_hnsw.setQueryPlanner(planner);
+            checkSearch(planned ? "planned" : "filtered graph", data, d, n, space, [&](const float* query, size_t k, const hnswlib::TagExpression& filter) {
+                hnswlib::QueryStats stats;
+                return drain(alg_hnsw.searchKnnWithStats(query, k, filter, stats));
+            });
+        }
+
+        checkSearch("searchStopConditionClosest", data, d, n, space, [&](const float* query, size_t k, const hnswlib::TagExpression& filter) {
+            hnswlib::EpsilonSearchStopCondition<float> stop_condition(100.0f, k, 100);
+            auto result = alg_hnsw.searchStopConditionClosest(query, stop_condition, filter);
+            result.resize(std::min(result.size(), k));
+            return result;
+        });
+    }
+
+    hnswlib::PostfilterHNSW<float> postfilter(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        postfilter.addPoint(data.data() + d * i, i, tagsOf(i));
+    }
+    checkSearch("PostfilterHNSW", data, d, n, space, [&](const float* query, size_t k, const hnswlib::TagExpression& filter) {
+        return drain(postfilter.searchKnn(query, k, filter));
+    });
+
+    // The per-tag indexes are searched with their default ef, so only a low recall is expected
+    hnswlib::MultiIndexHNSW<float> multi(&space, {"odd", "even", "three", "five"}, n);
+    for (idx_t i = 0; i < n; ++i) {
+        multi.addPoint(data.data() + d * i, i, tagsOf(i));
+    }
+    checkSearch("MultiIndexHNSW", data, d, n, space, [&](const float* query, size_t k, const hnswlib::TagExpression& filter) {
+        return drain(multi.searchKnn(query, k, filter));
+    }, 0.2f);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_parse();
+    test_compile();
+    test_search();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,69 @@
+// Benchmarks flushing the tag relationship graph, i.e. computing the shortest-path distances between all tags
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Relates random tag sets with a skewed tag popularity, like the type hierarchies of knowledge bases
+void relateRandomTags(hnswlib::RelationshipGraph<hnswlib::tag_type>& graph, size_t num_tags, std::mt19937& rng) {
+    std::uniform_real_distribution<> distrib;
+    std::uniform_int_distribution<> distrib_size(2, 4);
+
+    for (size_t i = 0; i < num_tags * 4; ++i) {
+        std::unordered_set<hnswlib::tag_type> tags;
+        tags.insert(static_cast<hnswlib::tag_type>(i % num_tags) + 1);  // Every tag is related at least once
+        for (int j = distrib_size(rng); j > 1; --j) {
+            tags.insert(static_cast<hnswlib::tag_type>(std::pow(distrib(rng), 3) * num_tags) + 1);
+        }
+        graph.relate(tags);
+    }
+}
+
+}  // namespace
+
+// Usage: tag_graph_benchmark [threads] [tag counts...], by default all hardware threads and 10k, 50k and 100k tags
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? std::stoul(argv[1]) : 0;
+    std::vector<size_t> tag_counts;
+    for (int i = 2; i < argc; ++i) {
+        tag_counts.push_back(std::stoul(argv[i]));
+    }
+    if (tag_counts.empty()) {
+        tag_counts = {10000, 50000, 100000};
+    }
+
+    std::mt19937 rng;
+    rng.seed(47);
+
+    for (size_t num_tags : tag_counts) {
+        std::unordered_map<hnswlib::tag_type, std::string> lookup;
+        std::unordered_map<std::string, hnswlib::tag_type> inverted;
+        hnswlib::RelationshipGraph<hnswlib::tag_type> graph(lookup, inverted);
+
+        auto start = std::chrono::steady_clock::now();
+        relateRandomTags(graph, num_tags, rng);
+        double relate_time = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        graph.computeDistances(threads);
+        double flush_time = secondsSince(start);
+
+        std::cout << num_tags << " tags: relate " << relate_time << " s, flush " << flush_time << " s on "
+                  << hnswlib::resolveThreadCount(threads) << " threads" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+// This is a test file for the compacted tag index storage and the inline tags of the level-0 records
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Index = hnswlib::TagIndex<hnswlib::tableint>;
+
+void check_tags(const Index& index, const std::map<hnswlib::tableint, std::vector<std::string>>& expected, hnswlib::tableint n) {
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        auto it = expected.find(id);
+        std::vector<std::string> tags = index.get(id);
+        assert(tags == (it != expected.end() ? it->second : std::vector<std::string>()));
+    }
+}
+
+void test_out_of_order_insertion() {
+    hnswlib::tableint n = 2000;
+    Index index(16);
+    std::map<hnswlib::tableint, std::vector<std::string>> expected;
+
+    // Threads finish out of order, so IDs arrive shuffled, with some IDs never inserted
+    std::vector<hnswlib::tableint> ids;
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        if (id % 13 != 5) {
+            ids.push_back(id);
+        }
+    }
+    std::mt19937 rng(47);
+    for (size_t i = 0; i + 8 < ids.size(); i += 8) {
+        std::shuffle(ids.begin() + i, ids.begin() + i + 8, rng);
+    }
+    std::swap(ids[3], ids[ids.size() - 3]);
+
+    for (hnswlib::tableint id : ids) {
+        std::vector<std::string> tags = {"tag_" + std::to_string(id % 7)};
+        if (id % 3 == 0) {
+            tags.push_back("three_" + std::to_string(id % 2));
+        }
+        index.insert(id, tags, 0);
+        expected[id] = tags;
+    }
+
+    // Adding tags to a node that has already been compacted
+    index.insert(10, {"late"}, 0);
+    expected[10].push_back("late");
+    check_tags(index, expected, n + 10);
+
+    std::vector<hnswlib::tag_type> query = index.resolve({"late", "tag_2"});
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        assert(index.hasAny(id, query) == (id == 10 || (expected.count(id) && id % 7 == 2)));
+    }
+
+    index.compact();
+    check_tags(index, expected, n + 10);
+
+    std::string path = "tag_index_test.bin";
+    {
+        std::ofstream output(path, std::ios::binary);
+        index.saveIndex(output);
+    }
+    Index loaded(16);
+    {
+        std::ifstream input(path, std::ios::binary);
+        loaded.loadIndex(input);
+    }
+    std::remove(path.c_str());
+
+    check_tags(loaded, expected, n + 10);
+    assert(loaded.size() == index.size());
+
+    // Inserting after a load continues the compacted layout
+    loaded.insert(n, {"tag_0"}, 0);
+    expected[n] = {"tag_0"};
+    check_tags(loaded, expected, n + 10);
+}
+
+void test_inline_tags() {
+    int d = 8;
+    hnswlib::labeltype n = 1000;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    // Every fourth element has more tags than inline slots and overflows to the posting bitmaps
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> plain(&space, n, 16, 100, 100);
+    hnswlib::HierarchicalNSW<float> inlined(&space, n, 16, 100, 100, false, false, 2);
+    for (hnswlib::labeltype i = 0; i < n; ++i) {
+        std::vector<std::string> tags = {"tag_" + std::to_string(i % 5)};
+        if (i % 4 == 0) {
+            tags.push_back("four_" + std::to_string(i % 3));
+            tags.push_back("extra");
+        }
+        plain.addPoint(data.data() + d * i, i, tags);
+        inlined.addPoint(data.data() + d * i, i, tags);
+    }
+
+    std::string path = "tag_index_test.bin";
+    inlined.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    std::remove(path.c_str());
+
+    hnswlib::QueryPlanner planner;
+    planner.enabled = false;
+    plain.setQueryPlanner(planner);
+    inlined.setQueryPlanner(planner);
+    loaded.setQueryPlanner(planner);
+
+    for (hnswlib::labeltype q = 0; q < 50; ++q) {
+        std::vector<std::string> filter = {"tag_" + std::to_string(q % 5), "four_" + std::to_string(q % 3)};
+        auto expected = plain.searchKnn(data.data() + d * q, k, filter);
+        auto result = inlined.searchKnn(data.data() + d * q, k, filter);
+        auto result_loaded = loaded.searchKnn(data.data() + d * q, k, filter);
+        assert(!expected.empty());
+        while (!expected.empty()) {
+            assert(result.top() == expected.top());
+            assert(result_loaded.top() == expected.top());
+            expected.pop();
+            result.pop();
+            result_loaded.pop();
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_out_of_order_insertion();
+    test_inline_tags();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,127 @@
+// This is a test file for the level-0 link lists of elements sharing a tag
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const int d = 16;
+const idx_t n = 5000;
+const size_t num_tags = 10;
+
+std::vector<float> makeData(idx_t count, int seed) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(count * d);
+    for (float& value : data) {
+        value = distrib(rng);
+    }
+    return data;
+}
+
+// Fraction of the exact filtered neighbors found by the filtered graph search
+float filteredRecall(const hnswlib::HierarchicalNSW<float>& index, hnswlib::L2Space& space,
+                     const std::vector<float>& data, const std::vector<float>& queries, size_t k) {
+    size_t found = 0, total = 0;
+    for (idx_t q = 0; q < queries.size() / d; ++q) {
+        const float* query = queries.data() + q * d;
+        size_t tag = q % num_tags;
+
+        std::priority_queue<std::pair<float, idx_t>> expected;
+        for (idx_t i = tag; i < n; i += num_tags) {
+            expected.emplace(space.get_dist_func()(query, data.data() + d * i, space.get_dist_func_param()), i);
+            if (expected.size() > k) {
+                expected.pop();
+            }
+        }
+
+        std::unordered_set<idx_t> result;
+        auto knn = index.searchKnn(query, k, {"type_" + std::to_string(tag)});
+        while (!knn.empty()) {
+            assert(knn.top().second % num_tags == tag);
+            result.insert(knn.top().second);
+            knn.pop();
+        }
+        while (!expected.empty()) {
+            found += result.count(expected.top().second);
+            total++;
+            expected.pop();
+        }
+    }
+    return float(found) / total;
+}
+
+void test_tag_links() {
+    std::vector<float> data = makeData(n, 47);
+    std::vector<float> queries = makeData(200, 48);
+    size_t k = 10;
+
+    hnswlib::L2Space space(d);
+    hnswlib::QueryPlanner planner;
+    planner.enabled = false;
+    hnswlib::HierarchicalNSW<float> plain(&space, n);
+    hnswlib::HierarchicalNSW<float> linked(&space, n, 16, 200, 100, false, false, 0, 1);
+    for (hnswlib::HierarchicalNSW<float>* index : {&plain, &linked}) {
+        for (idx_t i = 0; i < n; ++i) {
+            index->addPoint(data.data() + d * i, i, {"type_" + std::to_string(i % num_tags)});
+        }
+        index->setEf(20);
+        index->setQueryPlanner(planner);
+    }
+
+    // Every element links to others with its tag
+    size_t links = 0;
+    for (hnswlib::tableint id = 0; id < n; ++id) {
+        hnswlib::tag_type* tag_links = linked.getTagLinkList(id, 0);
+        assert(*tag_links == linked.tag_index.resolveTag("type_" + std::to_string(linked.getExternalLabel(id) % num_tags)));
+        hnswlib::linklistsizeint* list = (hnswlib::linklistsizeint*) (tag_links + 1);
+        hnswlib::tableint* neighbors = (hnswlib::tableint*) (list + 1);
+        for (size_t j = 0; j < linked.getListCount(list); ++j) {
+            assert(linked.getExternalLabel(neighbors[j]) % num_tags == linked.getExternalLabel(id) % num_tags);
+        }
+        links += linked.getListCount(list);
+    }
+    assert(links > n * 8);
+
+    // The regular links are untouched, so unfiltered searches give the same results
+    for (idx_t q = 0; q < 50; ++q) {
+        auto a = plain.searchKnn(queries.data() + q * d, k, std::vector<std::string>());
+        auto b = linked.searchKnn(queries.data() + q * d, k, std::vector<std::string>());
+        while (!a.empty()) {
+            assert(a.top().second == b.top().second);
+            a.pop();
+            b.pop();
+        }
+    }
+
+    float recall_plain = filteredRecall(plain, space, data, queries, k);
+    float recall_linked = filteredRecall(linked, space, data, queries, k);
+    std::cout << "Filtered recall without tag links: " << recall_plain << ", with tag links: " << recall_linked << std::endl;
+    assert(recall_linked > recall_plain);
+
+    // The tag links are part of the saved index
+    linked.saveIndex("tag_links.bin");
+    hnswlib::HierarchicalNSW<float> loaded(&space, "tag_links.bin");
+    loaded.setEf(20);
+    loaded.setQueryPlanner(planner);
+    assert(filteredRecall(loaded, space, data, queries, k) == recall_linked);
+    std::remove("tag_links.bin");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_tag_links();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
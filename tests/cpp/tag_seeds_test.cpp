@@ -0,0 +1,123 @@
+// This is a test file for the per-tag entry points of the filtered search
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+float minPairwiseDistance(const hnswlib::HierarchicalNSW<float>& index, const std::vector<hnswlib::tableint>& ids) {
+    float nearest = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        for (size_t j = i + 1; j < ids.size(); ++j) {
+            nearest = std::min(nearest, index.fstdistfunc_(index.getDataByInternalId(ids[i]),
+                                                           index.getDataByInternalId(ids[j]), index.dist_func_param_));
+        }
+    }
+    return nearest;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+
+    // Elements form clusters, and every cluster has its own tag, so the elements of a tag all lie in one region
+    int d = 8;
+    size_t clusters = 20;
+    size_t per_cluster = 500;
+    size_t n = clusters * per_cluster;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::normal_distribution<> noise(0, 0.05);
+    std::vector<float> centers(clusters * d);
+    for (float& x : centers) {
+        x = distrib(rng);
+    }
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d; ++j) {
+            data[i * d + j] = centers[(i % clusters) * d + j] + noise(rng);
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100);
+    alg_hnsw.setMaxTagSeeds(4);
+    std::vector<std::vector<hnswlib::tableint>> first_elements(clusters);
+    for (size_t i = 0; i < n; ++i) {
+        std::string tag = "cluster_" + std::to_string(i % clusters);
+        alg_hnsw.addPoint(data.data() + i * d, i, {tag});
+        if (first_elements[i % clusters].size() < 4) {
+            first_elements[i % clusters].push_back(alg_hnsw.label_lookup_.at(i));
+        }
+    }
+
+    // Seeds carry their tag and live on their level, and the level-0 seeds only get more spread out than the first elements
+    for (size_t c = 0; c < clusters; ++c) {
+        std::string tag = "cluster_" + std::to_string(c);
+        const auto& tag_seeds = alg_hnsw.tag_seeds_.at(tag);
+        assert(tag_seeds.size() == alg_hnsw.enterpoints.at(tag).first + 1);
+        for (size_t level = 0; level < tag_seeds.size(); ++level) {
+            assert(!tag_seeds[level].ids.empty() && tag_seeds[level].ids.size() <= 4);
+            for (hnswlib::tableint id : tag_seeds[level].ids) {
+                assert(alg_hnsw.getExternalLabel(id) % clusters == c);
+                assert(alg_hnsw.element_levels_[id] >= (int) level);
+            }
+        }
+        assert(minPairwiseDistance(alg_hnsw, tag_seeds[0].ids) >= minPairwiseDistance(alg_hnsw, first_elements[c]));
+    }
+
+    // Queries filtering on two distant clusters, close to the second one, should do about as well as queries filtering on the
+    // second cluster only, since they also start from the second cluster's seeds
+    hnswlib::QueryPlanner planner;
+    planner.enabled = false;
+    alg_hnsw.setQueryPlanner(planner);
+    alg_hnsw.setEf(20);
+    size_t correct_both = 0, correct_second = 0;
+    for (size_t q = 0; q < 200; ++q) {
+        size_t a = q % clusters, b = (q + clusters / 2) % clusters;
+        std::vector<float> query(centers.begin() + b * d, centers.begin() + (b + 1) * d);
+        for (float& x : query) {
+            x += noise(rng);
+        }
+
+        std::vector<std::pair<float, idx_t>> expected;
+        for (size_t i = b; i < n; i += clusters) {
+            expected.emplace_back(space.get_dist_func()(query.data(), data.data() + i * d, space.get_dist_func_param()), i);
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.resize(k);
+
+        auto count_correct = [&](std::priority_queue<std::pair<float, idx_t>> result) {
+            size_t correct = 0;
+            while (!result.empty()) {
+                for (const auto& pair : expected) {
+                    correct += pair.second == result.top().second;
+                }
+                result.pop();
+            }
+            return correct;
+        };
+        std::string tag_a = "cluster_" + std::to_string(a), tag_b = "cluster_" + std::to_string(b);
+        correct_both += count_correct(alg_hnsw.searchKnn(query.data(), k, {tag_a, tag_b}));
+        correct_second += count_correct(alg_hnsw.searchKnn(query.data(), k, {tag_b}));
+    }
+    std::cout << "Recall with both tags: " << correct_both / 2000.0 << ", with the second tag: " << correct_second / 2000.0 << std::endl;
+    assert(correct_both >= 0.9 * correct_second);
+
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
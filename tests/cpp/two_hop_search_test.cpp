@@ -0,0 +1,121 @@
+// This is a test file for the two-hop filtered graph search used for selective filters
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test_plan_choice() {
+    hnswlib::QueryPlanner planner;
+    hnswlib::QueryStats stats;
+    size_t elements = 1000000, ef = 100, maxM0 = 32;
+
+    planner.plan(20000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::TwoHopGraph);
+    assert(stats.estimated_cost == ef * maxM0);
+
+    // Small filters are still scanned, and permissive ones searched with the filtered graph
+    planner.plan(1000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::BruteForce);
+    planner.plan(100000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::FilteredGraph);
+
+    // Without the two-hop search, the filtered graph search is only cheaper than a scan over many more elements
+    planner.two_hop_selectivity = 0;
+    planner.plan(20000, elements, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::BruteForce);
+    planner.plan(2000000, elements * 100, ef, maxM0, stats);
+    assert(stats.plan == hnswlib::QueryPlan::FilteredGraph);
+}
+
+// Elements with the rare tag are scattered over the whole space, so few of them are linked with each other
+void test_search() {
+    int d = 16;
+    idx_t n = 10000;
+    size_t ef = 100, k = 10, nq = 50;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        std::vector<std::string> tags = {"common"};
+        if (i % 50 == 0) {
+            tags.push_back("rare");
+        }
+        alg_hnsw.addPoint(data.data() + d * i, i, tags);
+    }
+
+    auto filter = alg_hnsw.compileTagFilter(hnswlib::TagExpression::of("rare"));
+    size_t found_one_hop = 0, found_two_hop = 0;
+    long distances_one_hop = 0, distances_two_hop = 0;
+
+    for (idx_t q = 0; q < nq; ++q) {
+        const float* query = data.data() + d * (q * 97 + 1);
+        std::vector<hnswlib::tableint> seeds = {
+            alg_hnsw.searchUpperLayers(query, alg_hnsw.enterpoint_node_, alg_hnsw.maxlevel_, &filter)};
+
+        std::priority_queue<std::pair<float, idx_t>> expected;
+        for (idx_t i = 0; i < n; i += 50) {
+            expected.emplace(space.get_dist_func()(query, data.data() + d * i, space.get_dist_func_param()), i);
+            if (expected.size() > k) {
+                expected.pop();
+            }
+        }
+        std::unordered_set<idx_t> expected_labels;
+        while (!expected.empty()) {
+            expected_labels.insert(expected.top().second);
+            expected.pop();
+        }
+
+        for (bool two_hop : {false, true}) {
+            alg_hnsw.metric_distance_computations = 0;
+            auto result = two_hop ?
+                alg_hnsw.searchBaseLayerTwoHop<true, true>(seeds, query, ef, &filter) :
+                alg_hnsw.searchBaseLayerST<true, true>(seeds, query, ef, &filter);
+            (two_hop ? distances_two_hop : distances_one_hop) += alg_hnsw.metric_distance_computations;
+
+            while (result.size() > k) {
+                result.pop();
+            }
+            while (!result.empty()) {
+                idx_t label = alg_hnsw.getExternalLabel(result.top().second);
+                assert(label % 50 == 0);
+                (two_hop ? found_two_hop : found_one_hop) += expected_labels.count(label);
+                result.pop();
+            }
+        }
+    }
+
+    float recall_one_hop = float(found_one_hop) / (nq * k);
+    float recall_two_hop = float(found_two_hop) / (nq * k);
+    std::cout << "Filtered graph: recall " << recall_one_hop << ", " << distances_one_hop / nq << " distances per query" << std::endl;
+    std::cout << "Two-hop graph: recall " << recall_two_hop << ", " << distances_two_hop / nq << " distances per query" << std::endl;
+
+    // The filtered graph search floods nearly the whole graph to reach its recall
+    assert(recall_two_hop >= 0.9f);
+    assert(distances_two_hop * 10 < distances_one_hop);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_plan_choice();
+    test_search();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}